@@ -6,12 +6,26 @@
       'sources': [ 'src/addon.cc',
                     'src/file_utilities_win.cc',
                     'src/file_utilities_mac.mm',
+                    'src/file_utilities_linux.cc',
+                    'src/local_server.cc',
                     'src/registry_win.cc',
+                    'src/work_stealing_queue.cc',
                     'src/wmi/wmi.cpp',
                     'src/wmi/wmiresult.cpp',
+                    'src/restclient/backend.cc',
                     'src/restclient/connection.cc',
+                    'src/restclient/connectionpool.cc',
+                    'src/restclient/diskcache.cc',
+                    'src/restclient/download.cc',
                     'src/restclient/helpers.cc',
+                    'src/restclient/httplibbackend.cc',
+                    'src/restclient/metrics.cc',
+                    'src/restclient/multiclient.cc',
+                    'src/restclient/responsecache.cc',
                     'src/restclient/restclient.cc',
+                    'src/restclient/retrypolicy.cc',
+                    'src/restclient/sharedcache.cc',
+                    'src/restclient/singleflight.cc',
                     ],
 
       'include_dirs': ["<!@(node -p \"require('node-addon-api').include\")",],
@@ -20,6 +34,7 @@
           ['OS=="mac"', {'sources/': [
             ['include', '_mac\\.cc|mm?$'],
             ['exclude', '_win\\.cc$'],
+            ['exclude', '_linux\\.cc$'],
             ['exclude', 'wmi\\.cpp'],
             ['exclude', 'WinHttpClient\\.cpp'],
           ],
@@ -39,9 +54,25 @@
             }
           },
           ],
+          ['OS=="linux"', {'sources/': [
+            ['include', '_linux\\.cc$'],
+            ['exclude', '_win\\.cc$'],
+            ['exclude', '_mac\\.cc|mm?$'],
+            ['exclude', 'wmi/'],
+          ],
+            # system libcurl (libcurl4-openssl-dev or libcurl-devel)
+            'cflags': [ '<!@(curl-config --cflags)' ],
+            'link_settings': {
+              'libraries': [
+                '<!@(curl-config --libs)'
+              ]
+            }
+          }
+          ],
           ['OS=="win"', {'sources/': [
             ['include', '_win\\.cc$'],
             ['exclude', '_mac\\.cc|mm?$'],
+            ['exclude', '_linux\\.cc$'],
         ], 
           'sources': [ 
             'src/WinHttpClient/RegExp.cpp',
@@ -1,2 +1,237 @@
+const fs = require('fs');
+const { Readable } = require('stream');
+
 var sysutilities = require('bindings')('node_sysutilities');
-module.exports = exports = sysutilities
\ No newline at end of file
+
+function abortError(signal) {
+    if (signal.reason !== undefined) {
+        return signal.reason;
+    }
+    const error = new Error('This operation was aborted');
+    error.name = 'AbortError';
+    return error;
+}
+
+// Replaces opts.signal, an AbortSignal, by a native cancelToken. Returns
+// {opts, done} where done() stops listening once the request settled, or
+// null if the signal is already aborted.
+function withCancelToken(opts) {
+    if (!opts || typeof opts !== 'object' || !opts.signal) {
+        return { opts: opts, done: () => {} };
+    }
+    const signal = opts.signal;
+    if (signal.aborted) {
+        return null;
+    }
+    const token = sysutilities.createCancelToken();
+    const onAbort = () => token.cancel();
+    signal.addEventListener('abort', onAbort, { once: true });
+    return {
+        opts: Object.assign({}, opts, { signal: undefined, cancelToken: token }),
+        done: () => signal.removeEventListener('abort', onAbort)
+    };
+}
+
+// Lets the promise returning exports take {signal} as argument optsIndex:
+// aborting it cancels the transfer and rejects with signal.reason, right
+// away unless waitForNative is set, while the transfer winds down.
+function abortable(native, optsIndex, waitForNative) {
+    return function (...args) {
+        const opts = args[optsIndex];
+        const signal = opts && typeof opts === 'object' ? opts.signal : undefined;
+        const request = withCancelToken(opts);
+        if (!request) {
+            return Promise.reject(abortError(signal));
+        }
+        args[optsIndex] = request.opts;
+        let pending;
+        try {
+            pending = native(...args);
+        } catch (error) {
+            request.done();
+            throw error;
+        }
+        return new Promise((resolve, reject) => {
+            const onAbort = () => reject(abortError(signal));
+            if (signal && !waitForNative) {
+                signal.addEventListener('abort', onAbort, { once: true });
+            }
+            const settled = () => {
+                request.done();
+                if (signal) {
+                    signal.removeEventListener('abort', onAbort);
+                }
+            };
+            pending.then((result) => {
+                settled();
+                if (signal && signal.aborted) {
+                    reject(abortError(signal));
+                } else {
+                    resolve(result);
+                }
+            }, (error) => {
+                settled();
+                reject(error);
+            });
+        });
+    };
+}
+
+sysutilities.httpGetAsync = abortable(sysutilities.httpGetAsync, 1);
+sysutilities.httpGetMany = abortable(sysutilities.httpGetMany, 1);
+// downloadFile(url, path, [{segments, minSegmentSize, resume, timeout, connectTimeout, firstByteTimeout, headers,
+//                           retry, signal, onProgress}]) -> Promise<{code, headers}>
+// An aborted download keeps its progress for a later call with resume. The
+// promise only rejects once the file is closed, so resuming cannot overlap.
+sysutilities.downloadFile = abortable(sysutilities.downloadFile, 2, true);
+
+// httpGetStream(url, [{timeout, connectTimeout, firstByteTimeout, headers, http2, retry, signal}])
+//   -> Readable of Buffers
+// The body is handed over chunk by chunk as it arrives, so large downloads
+// use constant memory. 'response' is emitted with {code, headers, timing}
+// right before the stream ends; transport failures destroy the stream, so
+// does aborting signal, with signal.reason. Destroying the stream early, as
+// a break out of for await or a failed pipeline() do, cancels the transfer.
+sysutilities.httpGetStream = function (url, opts) {
+    let handle = null;
+    let token = null;
+    let finished = false;
+    const stream = new Readable({
+        read() {
+            if (handle) {
+                handle.resume();
+            }
+        },
+        destroy(err, cb) {
+            // a paused transfer would otherwise keep its slot and the
+            // process alive; resuming lets it see the cancel and finish
+            if (handle && !finished) {
+                token.cancel();
+                handle.resume();
+            }
+            cb(err);
+        }
+    });
+    const signal = opts && opts.signal;
+    const request = withCancelToken(opts || {});
+    if (!request) {
+        process.nextTick(() => stream.destroy(abortError(signal)));
+        return stream;
+    }
+    token = request.opts.cancelToken || sysutilities.createCancelToken();
+    const nativeOpts = Object.assign({}, request.opts, { cancelToken: token });
+    handle = sysutilities.httpGetStreamNative(url, nativeOpts, (chunk, result) => {
+        if (chunk) {
+            return stream.destroyed || stream.push(chunk);
+        }
+        finished = true;
+        request.done();
+        if (stream.destroyed) {
+            return true;
+        }
+        if (signal && signal.aborted) {
+            stream.destroy(abortError(signal));
+        } else if (result.code < 100) {
+            stream.destroy(new Error(result.body || 'Failed to query.'));
+        } else {
+            stream.emit('response', result);
+            stream.push(null);
+        }
+        return true;
+    });
+    return stream;
+};
+
+// httpUpload(url, body, [{method, size, timeout, connectTimeout, firstByteTimeout, headers, http2, signal,
+//                        onProgress}]) -> Promise<{code, body, headers, timing}>
+// body is a Buffer or string, {path} of a file, or an iterable or async
+// iterable of Buffers and strings such as a generator or a Readable. Files
+// and iterables are streamed with bounded memory; Buffers are sent from
+// where they are instead of being copied, so leave them alone until the
+// promise settled. size is the length of an iterable body if known,
+// otherwise it goes out chunked. onProgress(sent, total) follows the upload,
+// total is -1 if unknown. method is 'POST' (the default) or 'PUT'.
+sysutilities.httpUpload = function (url, body, opts) {
+    opts = opts || {};
+    const signal = opts.signal;
+    const request = withCancelToken(opts);
+    if (!request) {
+        return Promise.reject(abortError(signal));
+    }
+    let native = null;
+    if (typeof body === 'string') {
+        native = Buffer.from(body);
+    } else if (Buffer.isBuffer(body)) {
+        native = body;
+    } else if (body && typeof body.path === 'string') {
+        native = { path: body.path };
+    } else if (!body || (!body[Symbol.asyncIterator] && !body[Symbol.iterator])) {
+        request.done();
+        return Promise.reject(new TypeError('body must be a Buffer, a string, {path} or an iterable'));
+    }
+    // a failing iterable has to be able to stop the request
+    const token = request.opts.cancelToken || (native ? undefined : sysutilities.createCancelToken());
+    const nativeOpts = Object.assign({}, request.opts, { onProgress: undefined, cancelToken: token });
+    return new Promise((resolve, reject) => {
+        let finished = false;
+        let failure = null;
+        let drained = null;
+        const wakeProducer = () => {
+            if (drained) {
+                const resume = drained;
+                drained = null;
+                resume();
+            }
+        };
+        const handle = sysutilities.httpUploadNative(url, native, nativeOpts, (type, a, b) => {
+            if (type === 'progress') {
+                if (opts.onProgress) {
+                    opts.onProgress(a, b);
+                }
+            } else if (type === 'drain') {
+                wakeProducer();
+            } else {
+                finished = true;
+                request.done();
+                wakeProducer();
+                if (signal && signal.aborted) {
+                    reject(abortError(signal));
+                } else if (failure) {
+                    reject(failure);
+                } else if (a.code < 100) {
+                    reject(new Error(a.body || 'Failed to query.'));
+                } else {
+                    resolve(a);
+                }
+            }
+        });
+        if (native) {
+            return;
+        }
+        (async () => {
+            for await (const chunk of body) {
+                if (finished) {
+                    return;
+                }
+                if (!handle.write(typeof chunk === 'string' ? Buffer.from(chunk) : chunk)) {
+                    await new Promise((resume) => { drained = resume; });
+                }
+            }
+            handle.end();
+        })().catch((err) => {
+            failure = err;
+            token.cancel();
+        });
+    });
+};
+
+// setCacheDirectory(directory, [{maxBytes}])
+// Keeps the responses of {cache: true} requests in directory as well, so
+// they are still cached after a restart. Call once, before the first request.
+sysutilities.setCacheDirectory = function (directory, opts) {
+    fs.mkdirSync(directory, { recursive: true });
+    const maxBytes = (opts && opts.maxBytes) || 256 * 1024 * 1024;
+    return sysutilities.setResponseCacheDirectory(directory, maxBytes);
+};
+
+module.exports = exports = sysutilities
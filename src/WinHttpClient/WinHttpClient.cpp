@@ -27,8 +27,19 @@ WinHttpClient::WinHttpClient(const wstring &url, PROGRESSPROC progressProc)
 	m_resolveTimeout(0),
 	m_connectTimeout(60000),
 	m_sendTimeout(30000),
-	m_receiveTimeout(30000)
+	m_receiveTimeout(30000),
+	m_retryPolicy(),
+	m_attempts(0),
+	m_retryDelay(-1),
+	m_bCancelled(false),
+	m_requestHandle(NULL)
 {
+	// Without SetRetryPolicy failed transfers of any verb are tried 3 times without
+	// delay, as they always were. Responses are never retried.
+	m_retryPolicy.SetMaxAttempts(3);
+	m_retryPolicy.SetBackoff(0, 0);
+	m_retryPolicy.SetIdempotentOnly(false);
+	m_retryPolicy.SetRetryableStatus(std::set<int>());
 }
 
 WinHttpClient::~WinHttpClient(void)
@@ -71,6 +82,7 @@ bool WinHttpClient::SendHttpRequest(const wstring &httpVerb, bool disableAutoRed
 		return false;
 	}
 	bool bRetVal = true;
+	m_retryDelay = -1;
 
 	if (m_sessionHandle == NULL)
 	{
@@ -134,12 +146,22 @@ bool WinHttpClient::SendHttpRequest(const wstring &httpVerb, bool disableAutoRed
 						sizeof(DWORD));
 				}
 
+				{
+					// Cancel() closes the handle from another thread, which ends a blocking call.
+					std::lock_guard<std::mutex> lock(m_requestHandleMutex);
+					m_requestHandle = hRequest;
+				}
+
 				bool bGetReponseSucceed = false;
-				unsigned int iRetryTimes = 0;
+				bool bRetry = !m_bCancelled;
+				string method(verb.begin(), verb.end());
+				string retryAfter;
 
-				// Retry for several times if fails.
-				while (!bGetReponseSucceed && iRetryTimes++ < INT_RETRYTIMES)
+				// Retry right away as long as the retry policy allows. A retry that has
+				// to wait ends the call, GetRetryDelay tells the caller for how long.
+				while (!bGetReponseSucceed && bRetry)
 				{
+					m_attempts++;
 					if (m_additionalRequestHeaders.size() > 0)
 					{
 						if (!::WinHttpAddRequestHeaders(hRequest, m_additionalRequestHeaders.c_str(), m_additionalRequestHeaders.size(), WINHTTP_ADDREQ_FLAG_COALESCE_WITH_SEMICOLON))
@@ -520,19 +542,61 @@ bool WinHttpClient::SendHttpRequest(const wstring &httpVerb, bool disableAutoRed
 									}
 								}
 							}
+
+							// A retryable status is kept if no attempt is left.
+							if (bGetReponseSucceed &&
+								m_retryPolicy.IsRetryableStatus(_wtoi(m_statusCode.c_str())) &&
+								m_retryPolicy.CanRetry(method, m_attempts))
+							{
+								bGetReponseSucceed = false;
+
+								// A Retry-After of the server stretches the next delay.
+								wchar_t szRetryAfter[64] = { 0 };
+								DWORD dwRetryAfterSize = sizeof(szRetryAfter) - sizeof(wchar_t);
+								if (::WinHttpQueryHeaders(hRequest,
+									WINHTTP_QUERY_RETRY_AFTER,
+									WINHTTP_HEADER_NAME_BY_INDEX,
+									szRetryAfter,
+									&dwRetryAfterSize,
+									WINHTTP_NO_HEADER_INDEX))
+								{
+									wstring value(szRetryAfter);
+									retryAfter.assign(value.begin(), value.end());
+								}
+							}
 						}
 						else
 						{
 							m_dwLastError = ::GetLastError();
 						}
 					}
+
+					bRetry = false;
+					if (!bGetReponseSucceed && !m_bCancelled && m_retryPolicy.CanRetry(method, m_attempts))
+					{
+						int iDelay = m_retryPolicy.DelayMs(m_attempts, retryAfter);
+						retryAfter.clear();
+						if (iDelay > 0)
+						{
+							m_retryDelay = iDelay;
+						}
+						else
+						{
+							bRetry = true;
+						}
+					}
 				} // while
 				if (!bGetReponseSucceed)
 				{
 					bRetVal = false;
 				}
 
-				::WinHttpCloseHandle(hRequest);
+				std::lock_guard<std::mutex> lock(m_requestHandleMutex);
+				if (m_requestHandle != NULL)
+				{
+					::WinHttpCloseHandle(m_requestHandle);
+					m_requestHandle = NULL;
+				}
 			}
 			::WinHttpCloseHandle(hConnect);
 		}
@@ -646,6 +710,8 @@ bool WinHttpClient::ResetAdditionalDataToSend(void)
 bool WinHttpClient::UpdateUrl(const wstring &url)
 {
 	m_requestURL = url;
+	m_attempts = 0;
+	m_retryDelay = -1;
 	ResetAdditionalDataToSend();
 
 	return true;
@@ -732,6 +798,29 @@ wstring WinHttpClient::GetResponseLocation(void)
 	return m_location;
 }
 
+bool WinHttpClient::SetRetryPolicy(const RestClient::RetryPolicy &policy)
+{
+	m_retryPolicy = policy;
+
+	return true;
+}
+
+int WinHttpClient::GetRetryDelay(void)
+{
+	return m_retryDelay;
+}
+
+void WinHttpClient::Cancel(void)
+{
+	m_bCancelled = true;
+	std::lock_guard<std::mutex> lock(m_requestHandleMutex);
+	if (m_requestHandle != NULL)
+	{
+		::WinHttpCloseHandle(m_requestHandle);
+		m_requestHandle = NULL;
+	}
+}
+
 bool WinHttpClient::SetTimeouts(unsigned int resolveTimeout,
 	unsigned int connectTimeout,
 	unsigned int sendTimeout,
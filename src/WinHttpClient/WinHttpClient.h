@@ -10,15 +10,17 @@
 
 #include "RegExp.h"
 #include "StringProcess.h"
+#include "../restclient/retrypolicy.h"
 #include <comutil.h>
 #include <windows.h>
 #include <Winhttp.h>
+#include <atomic>
+#include <mutex>
 #include <string>
 using namespace std;
 
 typedef bool (*PROGRESSPROC)(double);
 
-static const unsigned int INT_RETRYTIMES = 3;
 static const wchar_t *SZ_AGENT = L"WinHttpClient";
 static const int INT_BUFFERSIZE = 10240;    // Initial 10 KB temporary buffer, double if it is not enough.
 #define _import __declspec(dllexport)
@@ -58,6 +60,18 @@ public:
                             unsigned int connectTimeout = 60000,
                             unsigned int sendTimeout = 30000,
                             unsigned int receiveTimeout = 30000);
+    // Attempts, backoff and retryable status codes, the same policy the libcurl
+    // path uses. By default failed transfers of any verb are tried 3 times
+    // right away, as they always were.
+    bool SetRetryPolicy(const RestClient::RetryPolicy &policy);
+    // Milliseconds to wait before calling SendHttpRequest again, -1 if no retry
+    // is due. SendHttpRequest never waits out a backoff itself, it returns and
+    // leaves scheduling the next attempt to the caller.
+    int GetRetryDelay(void);
+    // Ends a running SendHttpRequest from another thread by closing its request
+    // handle, which makes a blocking WinHTTP call return. No further attempt
+    // is made.
+    void Cancel(void);
 
 private:
     inline WinHttpClient(const WinHttpClient &other);
@@ -92,6 +106,12 @@ private:
     unsigned int m_connectTimeout;
     unsigned int m_sendTimeout;
     unsigned int m_receiveTimeout;
+    RestClient::RetryPolicy m_retryPolicy;
+    int m_attempts;
+    int m_retryDelay;
+    std::atomic<bool> m_bCancelled;
+    std::mutex m_requestHandleMutex;
+    HINTERNET m_requestHandle;
 };
 
 #endif // WINHTTPCLIENT_H
@@ -1,19 +1,41 @@
 #include <napi.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <locale>
 #include <codecvt>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+// libcurl pulls in winsock2.h, which has to come before windows.h
+#include "restclient/restclient.h"
+#include "restclient/multiclient.h"
+#include "restclient/metrics.h"
+#include "restclient/responsecache.h"
+#include "restclient/diskcache.h"
+#include "restclient/retrypolicy.h"
+#include "restclient/download.h"
+#include "restclient/helpers.h"
+#include "restclient/backend.h"
+#include "restclient/httplibbackend.h"
+#include "local_server.h"
 
 #if defined(_WIN32)
 #include "file_utilities_win.h"
 #include "WinHttpClient/WinHttpClient.h"
 #elif defined(__APPLE__)
 #include "file_utilities_mac.h"
-#include "restclient/restclient.h"
+#else
+#include "file_utilities_linux.h"
 #endif
 
-// #define CPPHTTPLIB_OPENSSL_SUPPORT
-// #include "httplib.h"
-
 std::string wstringToUtf8(const std::wstring &str)
 {
     std::wstring_convert<std::codecvt_utf8<wchar_t>> strCnv;
@@ -80,7 +102,7 @@ Napi::Value unsafeShowOpenWith(const Napi::CallbackInfo &info)
     REQUIRE_ARGUMENT_STRING(0, path);
 #if defined(_WIN32)
     Platform::File::UnsafeShowOpenWith(utf8ToWstring(path));
-#elif defined(__APPLE__)
+#else
     Platform::File::UnsafeShowOpenWith(path);
 #endif
     return env.Null();
@@ -92,7 +114,7 @@ Napi::Value unsafeOpenEmailLink(const Napi::CallbackInfo &info)
     REQUIRE_ARGUMENT_STRING(0, path);
 #if defined(_WIN32)
     Platform::File::UnsafeOpenEmailLink(utf8ToWstring(path));
-#elif defined(__APPLE__)
+#else
     Platform::File::UnsafeOpenEmailLink(path);
 #endif
     return env.Null();
@@ -111,7 +133,7 @@ Napi::Value unsafeLaunch(const Napi::CallbackInfo &info)
     REQUIRE_ARGUMENT_STRING(0, path);
 #if defined(_WIN32)
     Platform::File::UnsafeLaunch(utf8ToWstring(path));
-#elif defined(__APPLE__)
+#else
     Platform::File::UnsafeLaunch(path);
 #endif
     return env.Null();
@@ -142,68 +164,1714 @@ Napi::Value unsafeLaunch(const Napi::CallbackInfo &info)
     if (res.IsEmpty())                                                     \
         return env.Null();
 
-Napi::Value httpGet(const Napi::CallbackInfo &info)
+// Outcome of a single native GET, filled on whichever thread ran it so the
+// same code path serves both the sync and the Promise based exports.
+struct HttpGetResult
 {
-    Napi::Env env = info.Env();
-    REQUIRE_ARGUMENT_STRING(0, url);
-    OPTIONAL_ARGUMENT_INTEGER(1, timeout, 3000);
-    // REQUIRE_ARGUMENT_STRING(1, path);
-    // OPTIONAL_ARGUMENT_FUNCTION(2, cb);
-    // std::cout << host << std::endl;
-    // std::cout << path << std::endl;
-    // httplib::Client cli(host);
-    // const httplib::Result&& res = cli.Get(path.c_str());
-    // if (res) {
-    //     Napi::Object result = Napi::Object::New(env);
-    //     (result).Set("status", res->status);
-    //     (result).Set("reason", res->reason);
-    //     (result).Set("body", res->body);
-    //     return result;
-    // } else {
-    //     return env.Null();
-    // }
+    bool ok;
+    int code;
+    std::string body;
+    // WinHTTP requests carry no timing
+    bool hasTiming;
+    RestClient::RequestInfo timing;
+    // set instead of body for responses read from the disk cache
+    std::shared_ptr<RestClient::MappedFile> mappedBody;
+};
+
+Napi::Value requestInfoToObject(Napi::Env env, const RestClient::RequestInfo &info)
+{
+    Napi::Object timing = Napi::Object::New(env);
+    (timing).Set("totalTime", info.totalTime);
+    (timing).Set("nameLookupTime", info.nameLookupTime);
+    (timing).Set("connectTime", info.connectTime);
+    (timing).Set("appConnectTime", info.appConnectTime);
+    (timing).Set("preTransferTime", info.preTransferTime);
+    (timing).Set("startTransferTime", info.startTransferTime);
+    (timing).Set("redirectTime", info.redirectTime);
+    (timing).Set("redirectCount", info.redirectCount);
+    (timing).Set("uploadSize", static_cast<double>(info.uploadSize));
+    (timing).Set("downloadSize", static_cast<double>(info.downloadSize));
+    (timing).Set("decodedSize", static_cast<double>(info.decodedSize));
+    (timing).Set("connectionReused", info.connectionReused);
+    (timing).Set("httpVersion", info.httpVersion);
+    (timing).Set("remoteIp", info.remoteIp);
+    (timing).Set("responseCode", info.responseCode);
+    (timing).Set("effectiveUrl", info.effectiveUrl);
+    return timing;
+}
+
+// Native side of an AbortSignal, see createCancelToken. multi records that
+// the flag went into a MultiClient request, which has to be told to drop it.
+// Requests blocked in calls that cannot watch flag (WinHTTP) register an
+// abort function with Watch() instead.
+struct CancelToken : public std::enable_shared_from_this<CancelToken>
+{
+    RestClient::CancelFlag flag;
+    bool multi;
+    std::mutex mutex;
+    std::map<uint64_t, std::function<void()>> watchers;
+    uint64_t nextWatcher;
+
+    CancelToken() : flag(std::make_shared<std::atomic<bool>>(false)), multi(false), nextWatcher(1) {}
+
+    // Sets flag and calls the abort functions, from the JS thread.
+    void Cancel()
+    {
+        // only wake the event loop when it has requests of this token
+        if (multi)
+        {
+            RestClient::MultiClient::instance().Cancel(flag);
+        }
+        else
+        {
+            flag->store(true);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::map<uint64_t, std::function<void()>>::iterator it = watchers.begin(); it != watchers.end(); ++it)
+        {
+            it->second();
+        }
+    }
+
+    // abort is called by Cancel(), right away if that already happened.
+    // Returns the id to pass to Unwatch().
+    uint64_t Watch(const std::function<void()> &abort)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (flag->load())
+        {
+            abort();
+            return 0;
+        }
+        watchers[nextWatcher] = abort;
+        return nextWatcher++;
+    }
+
+    // Once this returns abort is neither running nor called any more.
+    void Unwatch(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watchers.erase(id);
+    }
+};
+
+// Returns the token passed as `cancelToken`, NULL if value is not one.
+CancelToken *cancelTokenFromValue(const Napi::Value &value)
+{
+    if (!value.IsObject())
+    {
+        return NULL;
+    }
+    Napi::Value handle = value.As<Napi::Object>().Get("handle");
+    if (!handle.IsExternal())
+    {
+        return NULL;
+    }
+    return handle.As<Napi::External<std::shared_ptr<CancelToken>>>().Data()->get();
+}
+
+// Options shared by the GET exports, see readHttpGetOptions. All times are
+// in milliseconds, 0 for none. backend is NULL for the platform default,
+// retry NULL for no retries. cancelToken is the token cancel comes from.
+struct HttpGetOptions
+{
+    int timeout;
+    bool asBuffer;
+    bool cache;
+    int connectTimeout;
+    int firstByteTimeout;
+    RestClient::CancelFlag cancel;
+    RestClient::Backend *backend;
+    std::shared_ptr<const RestClient::RetryPolicy> retry;
+    std::shared_ptr<CancelToken> cancelToken;
+};
+
+RestClient::Deadlines deadlinesFromOptions(const HttpGetOptions &options)
+{
+    RestClient::Deadlines deadlines = {options.connectTimeout, options.firstByteTimeout,
+                                       options.timeout > 0 ? options.timeout : 0};
+    return deadlines;
+}
+
+HttpGetResult performHttpGet(const std::string &url, const HttpGetOptions &options)
+{
+    HttpGetResult result = {false, 0, std::string(), false, RestClient::RequestInfo(),
+                            std::shared_ptr<RestClient::MappedFile>()};
+    // URLs the chosen backend cannot fetch take the default path
+    if (options.backend && options.backend->Supports(url))
+    {
+        RestClient::Response res = options.backend->get(url, RestClient::defaultHeaders(),
+                                                        deadlinesFromOptions(options), options.cancel);
+        result.ok = true;
+        result.code = res.code;
+        result.body.swap(res.body);
+        result.hasTiming = true;
+        result.timing = res.timing;
+        return result;
+    }
 #if defined(_WIN32)
+    // WinHTTP blocks in its calls and cannot watch the cancel flag, the token
+    // closes the request handle instead, which ends them
+    int timeout = options.timeout;
     WinHttpClient httpClient(utf8ToWstring(url).c_str());
-    httpClient.SetTimeouts(0, timeout, timeout, 0);
-    bool ret = httpClient.SendHttpRequest();
-    if (ret)
-    {
-        std::wstring wResp = httpClient.GetResponseContent();
-        std::wstring wStatusCode = httpClient.GetResponseStatusCode();
-        Napi::Object result = Napi::Object::New(env);
-        (result).Set("code", _wtoi(wStatusCode.c_str()));
-        (result).Set("body", wstringToUtf8(wResp));
-        return result;
+    httpClient.SetTimeouts(0, options.connectTimeout > 0 ? options.connectTimeout : timeout, timeout,
+                           options.firstByteTimeout > 0 ? options.firstByteTimeout : timeout);
+    uint64_t watch = 0;
+    if (options.cancelToken)
+    {
+        watch = options.cancelToken->Watch([&httpClient] { httpClient.Cancel(); });
+    }
+    bool sent = httpClient.SendHttpRequest();
+    if (options.cancelToken)
+    {
+        options.cancelToken->Unwatch(watch);
+    }
+    if (sent)
+    {
+        result.ok = true;
+        result.code = _wtoi(httpClient.GetResponseStatusCode().c_str());
+        // keep the bytes as received instead of decoding them as text
+        if (options.asBuffer)
+        {
+            result.body.assign(reinterpret_cast<const char *>(httpClient.GetRawResponseContent()),
+                               httpClient.GetRawResponseReceivedContentLength());
+        }
+        else
+        {
+            result.body = wstringToUtf8(httpClient.GetResponseContent());
+        }
+    }
+#else
+    RestClient::Response res = RestClient::get(
+        url, deadlinesFromOptions(options), options.cache ? &RestClient::ResponseCache::instance() : NULL,
+        &result.mappedBody, options.cancel);
+    result.ok = true;
+    result.code = res.code;
+    result.body.swap(res.body);
+    result.hasTiming = true;
+    result.timing = res.timing;
+#endif
+    return result;
+}
+
+// Hands the body over to JS without copying it: the Buffer points into a
+// heap string that the finalizer frees once the Buffer is collected.
+Napi::Value bodyToBuffer(Napi::Env env, std::string &body)
+{
+    std::string *owned = new std::string();
+    owned->swap(body);
+    return Napi::Buffer<char>::New(
+        env, &(*owned)[0], owned->size(),
+        [](Napi::Env, char *, std::string *data) { delete data; }, owned);
+}
+
+// Same for a body read from the disk cache: the Buffer points into the file
+// mapping and keeps it alive until the Buffer is collected.
+Napi::Value mappedBodyToValue(Napi::Env env, const std::shared_ptr<RestClient::MappedFile> &mapped, bool asBuffer)
+{
+    if (mapped->size() == 0)
+    {
+        return asBuffer ? Napi::Value(Napi::Buffer<char>::New(env, 0)) : Napi::Value(Napi::String::New(env, ""));
+    }
+    if (!asBuffer)
+    {
+        return Napi::String::New(env, mapped->data(), mapped->size());
+    }
+    std::shared_ptr<RestClient::MappedFile> *owner = new std::shared_ptr<RestClient::MappedFile>(mapped);
+    return Napi::Buffer<char>::New(
+        env, const_cast<char *>(mapped->data()), mapped->size(),
+        [](Napi::Env, char *, std::shared_ptr<RestClient::MappedFile> *data) { delete data; }, owner);
+}
+
+Napi::Value bodyToValue(Napi::Env env, std::string &body, bool asBuffer)
+{
+    if (asBuffer)
+    {
+        return bodyToBuffer(env, body);
+    }
+    return Napi::String::New(env, body);
+}
+
+// Reads `retry: true | attempts | {attempts, baseDelay, maxDelay, jitter,
+// statusCodes, idempotentOnly}` into a policy, delays in milliseconds.
+// false, 0 and a missing option mean no retries.
+std::shared_ptr<const RestClient::RetryPolicy> retryPolicyFromValue(const Napi::Value &value)
+{
+    std::shared_ptr<RestClient::RetryPolicy> policy;
+    if (value.IsNumber())
+    {
+        int attempts = value.As<Napi::Number>().Int32Value();
+        if (attempts > 1)
+        {
+            policy = std::make_shared<RestClient::RetryPolicy>();
+            policy->SetMaxAttempts(attempts);
+        }
+    }
+    else if (value.IsObject())
+    {
+        Napi::Object opts = value.As<Napi::Object>();
+        policy = std::make_shared<RestClient::RetryPolicy>();
+        if (opts.Has("attempts") && opts.Get("attempts").IsNumber())
+        {
+            policy->SetMaxAttempts(opts.Get("attempts").As<Napi::Number>().Int32Value());
+        }
+        int baseDelay = 100;
+        int maxDelay = 5000;
+        if (opts.Has("baseDelay") && opts.Get("baseDelay").IsNumber())
+        {
+            baseDelay = opts.Get("baseDelay").As<Napi::Number>().Int32Value();
+        }
+        if (opts.Has("maxDelay") && opts.Get("maxDelay").IsNumber())
+        {
+            maxDelay = opts.Get("maxDelay").As<Napi::Number>().Int32Value();
+        }
+        policy->SetBackoff(baseDelay, maxDelay);
+        if (opts.Has("jitter") && opts.Get("jitter").IsNumber())
+        {
+            policy->SetJitter(opts.Get("jitter").As<Napi::Number>().DoubleValue());
+        }
+        if (opts.Has("statusCodes") && opts.Get("statusCodes").IsArray())
+        {
+            Napi::Array codes = opts.Get("statusCodes").As<Napi::Array>();
+            std::set<int> retryable;
+            for (uint32_t i = 0; i < codes.Length(); ++i)
+            {
+                retryable.insert(codes.Get(i).ToNumber().Int32Value());
+            }
+            policy->SetRetryableStatus(retryable);
+        }
+        if (opts.Has("idempotentOnly"))
+        {
+            policy->SetIdempotentOnly(opts.Get("idempotentOnly").ToBoolean());
+        }
+    }
+    else if (value.ToBoolean())
+    {
+        policy = std::make_shared<RestClient::RetryPolicy>();
+    }
+    return policy;
+}
+
+// Reads `[timeout | {timeout, connectTimeout, firstByteTimeout, responseType,
+// cache, cancelToken, backend, retry}]` at argument i. timeout bounds the whole
+// request, connectTimeout the connection setup and firstByteTimeout the wait
+// for the first byte of the response, all in milliseconds. responseType
+// 'buffer' returns the body as a Buffer, 'string' (the default) decodes it.
+// cache answers from the process wide response cache where HTTP caching
+// headers allow it (default libcurl path only). cancelToken comes from
+// createCancelToken. backend 'httplib' makes httpGet and httpGetAsync send
+// http:// requests with the vendored cpp-httplib client, 'curl' with libcurl,
+// which is also the default outside Windows. retry, see
+// retryPolicyFromValue, is taken by the asynchronous exports, httpGet refuses
+// it. Returns false with a pending exception on bad arguments.
+bool readHttpGetOptions(const Napi::CallbackInfo &info, size_t i, HttpGetOptions *options)
+{
+    Napi::Env env = info.Env();
+    if (info.Length() <= i || info[i].IsUndefined())
+    {
+        return true;
+    }
+    if (info[i].IsNumber())
+    {
+        options->timeout = info[i].As<Napi::Number>().Int32Value();
+        return true;
+    }
+    if (!info[i].IsObject())
+    {
+        Napi::TypeError::New(env, "Argument 1 must be an integer or an object").ThrowAsJavaScriptException();
+        return false;
+    }
+    Napi::Object opts = info[i].As<Napi::Object>();
+    if (opts.Has("timeout") && opts.Get("timeout").IsNumber())
+    {
+        options->timeout = opts.Get("timeout").As<Napi::Number>().Int32Value();
+    }
+    if (opts.Has("responseType") && !opts.Get("responseType").IsUndefined())
+    {
+        std::string type = opts.Get("responseType").ToString();
+        if (type != "buffer" && type != "string")
+        {
+            Napi::TypeError::New(env, "responseType must be 'buffer' or 'string'").ThrowAsJavaScriptException();
+            return false;
+        }
+        options->asBuffer = type == "buffer";
+    }
+    if (opts.Has("connectTimeout") && opts.Get("connectTimeout").IsNumber())
+    {
+        options->connectTimeout = opts.Get("connectTimeout").As<Napi::Number>().Int32Value();
+    }
+    if (opts.Has("firstByteTimeout") && opts.Get("firstByteTimeout").IsNumber())
+    {
+        options->firstByteTimeout = opts.Get("firstByteTimeout").As<Napi::Number>().Int32Value();
+    }
+    if (opts.Has("cache"))
+    {
+        options->cache = opts.Get("cache").ToBoolean();
+    }
+    if (opts.Has("retry"))
+    {
+        options->retry = retryPolicyFromValue(opts.Get("retry"));
+    }
+    if (opts.Has("cancelToken"))
+    {
+        CancelToken *token = cancelTokenFromValue(opts.Get("cancelToken"));
+        if (!token)
+        {
+            Napi::TypeError::New(env, "cancelToken must come from createCancelToken").ThrowAsJavaScriptException();
+            return false;
+        }
+        options->cancel = token->flag;
+        options->cancelToken = token->shared_from_this();
+    }
+    if (opts.Has("backend") && !opts.Get("backend").IsUndefined())
+    {
+        std::string backend = opts.Get("backend").ToString();
+        if (backend == "httplib")
+        {
+            options->backend = &RestClient::HttplibBackend::instance();
+        }
+        else if (backend == "curl")
+        {
+#if defined(_WIN32)
+            // the default there is WinHTTP
+            options->backend = &RestClient::CurlBackend::instance();
+#else
+            // the default path, which also has the cache and coalescing
+            options->backend = NULL;
+#endif
+        }
+        else
+        {
+            Napi::TypeError::New(env, "backend must be 'curl' or 'httplib'").ThrowAsJavaScriptException();
+            return false;
+        }
+    }
+    return true;
+}
+
+Napi::Value httpGetResultToValue(Napi::Env env, HttpGetResult &res, bool asBuffer)
+{
+    if (!res.ok)
+    {
+        return env.Null();
+    }
+    Napi::Object result = Napi::Object::New(env);
+    (result).Set("code", res.code);
+    if (res.mappedBody)
+    {
+        (result).Set("body", mappedBodyToValue(env, res.mappedBody, asBuffer));
     }
     else
+    {
+        (result).Set("body", bodyToValue(env, res.body, asBuffer));
+    }
+    if (res.hasTiming)
+    {
+        (result).Set("timing", requestInfoToObject(env, res.timing));
+    }
+    return result;
+}
+
+// Runs performHttpGet on the libuv thread pool and settles a Promise with
+// the same value the synchronous httpGet would have returned.
+class HttpGetWorker : public Napi::AsyncWorker
+{
+public:
+    HttpGetWorker(Napi::Env env, const std::string &url, const HttpGetOptions &options)
+        : Napi::AsyncWorker(env), deferred_(Napi::Promise::Deferred::New(env)),
+          url_(url), options_(options), result_()
+    {
+    }
+
+    Napi::Promise Promise() { return deferred_.Promise(); }
+
+    void Execute() override
+    {
+        try
+        {
+            result_ = performHttpGet(url_, options_);
+        }
+        catch (const std::exception &e)
+        {
+            SetError(e.what());
+        }
+    }
+
+    void OnOK() override
+    {
+        deferred_.Resolve(httpGetResultToValue(Env(), result_, options_.asBuffer));
+    }
+
+    void OnError(const Napi::Error &e) override
+    {
+        deferred_.Reject(e.Value());
+    }
+
+private:
+    Napi::Promise::Deferred deferred_;
+    std::string url_;
+    HttpGetOptions options_;
+    HttpGetResult result_;
+};
+
+// httpGetAsync with retry. The request goes to the MultiClient on every
+// platform, which waits out the backoff on its event loop instead of
+// blocking a thread, and settles the Promise from there.
+class HttpGetRetried
+{
+public:
+    HttpGetRetried(Napi::Env env, const RestClient::Request &request, bool asBuffer)
+        : deferred_(Napi::Promise::Deferred::New(env)), request_(request), asBuffer_(asBuffer), result_()
+    {
+        tsfn_ = Napi::ThreadSafeFunction::New(
+            env, Napi::Function::New(env, [](const Napi::CallbackInfo &) {}), "httpGetAsync", 0, 1);
+    }
+
+    Napi::Promise Promise() { return deferred_.Promise(); }
+
+    // Must be called once, on the JS thread. Deletes itself after the Promise
+    // is settled.
+    void Start()
+    {
+        RestClient::MultiClient::instance().Submit(request_, [this](RestClient::Response &res) {
+            onResponse(res);
+        });
+    }
+
+private:
+    // runs on the curl event loop thread
+    void onResponse(RestClient::Response &res)
+    {
+        result_.ok = true;
+        result_.code = res.code;
+        result_.body.swap(res.body);
+        result_.hasTiming = true;
+        result_.timing = res.timing;
+        // settle() deletes this, possibly before Release() would return
+        Napi::ThreadSafeFunction tsfn = tsfn_;
+        tsfn.NonBlockingCall(this, [](Napi::Env env, Napi::Function, HttpGetRetried *get) { get->settle(env); });
+        tsfn.Release();
+    }
+
+    // runs on the JS thread
+    void settle(Napi::Env env)
+    {
+        deferred_.Resolve(httpGetResultToValue(env, result_, asBuffer_));
+        delete this;
+    }
+
+    Napi::Promise::Deferred deferred_;
+    Napi::ThreadSafeFunction tsfn_;
+    RestClient::Request request_;
+    bool asBuffer_;
+    HttpGetResult result_;
+};
+
+// httpGet(url, [timeout | {timeout, connectTimeout, firstByteTimeout, responseType, cache, cancelToken, backend}])
+//   -> {code, body, timing} | null
+// retry is refused, a synchronous call could only wait out the backoff on
+// the JS thread; use httpGetAsync.
+Napi::Value httpGet(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    REQUIRE_ARGUMENT_STRING(0, url);
+    HttpGetOptions options = {3000, false, false, 0, 0, RestClient::CancelFlag(), NULL};
+    if (!readHttpGetOptions(info, 1, &options))
     {
         return env.Null();
     }
-#elif defined(__APPLE__)
-    RestClient::Response res = RestClient::get(url);
-    httpClient.SetTimeout(timeout / 1000);
+    if (options.retry)
+    {
+        Napi::TypeError::New(env, "httpGet does not retry, use httpGetAsync").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    HttpGetResult res = performHttpGet(url, options);
+    return httpGetResultToValue(env, res, options.asBuffer);
+}
+
+// httpGetAsync(url, [timeout | {timeout, connectTimeout, firstByteTimeout, responseType, cache, cancelToken, backend,
+//                                retry}])
+//   -> Promise<{code, body, timing} | null>
+// With retry the request is sent through the MultiClient (libcurl, also on
+// Windows), which schedules the retries; cache and backend do not apply then.
+Napi::Value httpGetAsync(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    REQUIRE_ARGUMENT_STRING(0, url);
+    HttpGetOptions options = {3000, false, false, 0, 0, RestClient::CancelFlag(), NULL};
+    if (!readHttpGetOptions(info, 1, &options))
+    {
+        return env.Null();
+    }
+
+    if (options.retry)
+    {
+        if (options.cache || options.backend)
+        {
+            Napi::TypeError::New(env, "retry cannot be combined with cache or backend").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        RestClient::Request request;
+        request.method = "GET";
+        request.url = url;
+        request.headers = RestClient::defaultHeaders();
+        request.timeout = 0;
+        request.deadlines = deadlinesFromOptions(options);
+        request.http2 = false;
+        request.retry = options.retry;
+        request.cancel = options.cancel;
+        if (request.cancel)
+        {
+            cancelTokenFromValue(info[1].As<Napi::Object>().Get("cancelToken"))->multi = true;
+        }
+        HttpGetRetried *get = new HttpGetRetried(env, request, options.asBuffer);
+        Napi::Promise promise = get->Promise();
+        get->Start();
+        return promise;
+    }
+
+    HttpGetWorker *worker = new HttpGetWorker(env, url, options);
+    Napi::Promise promise = worker->Promise();
+    worker->Queue();
+    return promise;
+}
+
+// The body is moved out of res when asBuffer is set.
+Napi::Value responseToObject(Napi::Env env, RestClient::Response &res, bool asBuffer = false)
+{
     Napi::Object result = Napi::Object::New(env);
     (result).Set("code", res.code);
-    (result).Set("body", res.body);
+    (result).Set("body", bodyToValue(env, res.body, asBuffer));
+    Napi::Object headers = Napi::Object::New(env);
+    for (RestClient::HeaderFields::const_iterator it = res.headers.begin(); it != res.headers.end(); ++it)
+    {
+        (headers).Set(it->first, it->second);
+    }
+    (result).Set("headers", headers);
+    (result).Set("timing", requestInfoToObject(env, res.timing));
+    return result;
+}
+
+RestClient::HeaderFields headersFromObject(const Napi::Object &object)
+{
+    RestClient::HeaderFields headers;
+    Napi::Array keys = object.GetPropertyNames();
+    for (uint32_t i = 0; i < keys.Length(); ++i)
+    {
+        std::string key = keys.Get(i).ToString();
+        headers[key] = object.Get(key).ToString();
+    }
+    return headers;
+}
+
+// Reads `hedge: delay | {delay, percentile, alternateIp}` into a policy. A
+// duplicate is sent when no response byte came within delay milliseconds,
+// or within the given percentile (e.g. 0.95) of the recorded server latency.
+std::shared_ptr<const RestClient::HedgePolicy> hedgePolicyFromValue(const Napi::Value &value)
+{
+    std::shared_ptr<RestClient::HedgePolicy> policy;
+    if (value.IsNumber())
+    {
+        policy = std::make_shared<RestClient::HedgePolicy>();
+        policy->delayMs = value.As<Napi::Number>().Int32Value();
+        policy->percentile = 0;
+    }
+    else if (value.IsObject())
+    {
+        Napi::Object opts = value.As<Napi::Object>();
+        policy = std::make_shared<RestClient::HedgePolicy>();
+        policy->delayMs = 200;
+        policy->percentile = 0;
+        if (opts.Has("delay") && opts.Get("delay").IsNumber())
+        {
+            policy->delayMs = opts.Get("delay").As<Napi::Number>().Int32Value();
+        }
+        if (opts.Has("percentile") && opts.Get("percentile").IsNumber())
+        {
+            policy->percentile = opts.Get("percentile").As<Napi::Number>().DoubleValue();
+        }
+        if (opts.Has("alternateIp") && opts.Get("alternateIp").IsString())
+        {
+            policy->alternateAddress = opts.Get("alternateIp").As<Napi::String>();
+        }
+    }
+    return policy;
+}
+
+// One httpGetMany call. Requests are fed to the shared MultiClient so that
+// at most `concurrency` of them are in flight; responses are collected in
+// input order on the curl event loop and handed back to JS in one go.
+class HttpGetManyBatch
+{
+public:
+    HttpGetManyBatch(Napi::Env env, const std::vector<RestClient::Request> &requests, size_t concurrency, bool asBuffer)
+        : deferred_(Napi::Promise::Deferred::New(env)), requests_(requests),
+          responses_(requests.size()), next_(0), remaining_(requests.size()),
+          concurrency_(concurrency == 0 ? requests.size() : concurrency), asBuffer_(asBuffer)
+    {
+        tsfn_ = Napi::ThreadSafeFunction::New(
+            env, Napi::Function::New(env, [](const Napi::CallbackInfo &) {}), "httpGetMany", 0, 1);
+    }
+
+    Napi::Promise Promise() { return deferred_.Promise(); }
+
+    // Must be called once, on the JS thread. The batch deletes itself after
+    // the Promise is settled.
+    void Start()
+    {
+        std::vector<size_t> first;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (next_ < requests_.size() && next_ < concurrency_)
+            {
+                first.push_back(next_++);
+            }
+        }
+        for (size_t i = 0; i < first.size(); ++i)
+        {
+            submit(first[i]);
+        }
+    }
+
+private:
+    void submit(size_t index)
+    {
+        RestClient::MultiClient::instance().Submit(requests_[index], [this, index](RestClient::Response &res) {
+            onResponse(index, res);
+        });
+    }
+
+    // runs on the curl event loop thread
+    void onResponse(size_t index, RestClient::Response &res)
+    {
+        bool done = false;
+        bool more = false;
+        size_t nextIndex = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            responses_[index] = std::move(res);
+            done = --remaining_ == 0;
+            if (next_ < requests_.size())
+            {
+                more = true;
+                nextIndex = next_++;
+            }
+        }
+        if (more)
+        {
+            submit(nextIndex);
+        }
+        if (done)
+        {
+            // settle() deletes the batch on the JS thread, possibly before
+            // NonBlockingCall returns here, so only the copy is released
+            Napi::ThreadSafeFunction tsfn = tsfn_;
+            tsfn.NonBlockingCall(this, [](Napi::Env env, Napi::Function, HttpGetManyBatch *batch) {
+                batch->settle(env);
+            });
+            tsfn.Release();
+        }
+    }
+
+    // runs on the JS thread
+    void settle(Napi::Env env)
+    {
+        Napi::Array results = Napi::Array::New(env, responses_.size());
+        for (size_t i = 0; i < responses_.size(); ++i)
+        {
+            results.Set(static_cast<uint32_t>(i), responseToObject(env, responses_[i], asBuffer_));
+        }
+        deferred_.Resolve(results);
+        delete this;
+    }
+
+    Napi::Promise::Deferred deferred_;
+    Napi::ThreadSafeFunction tsfn_;
+    std::vector<RestClient::Request> requests_;
+    std::vector<RestClient::Response> responses_;
+    std::mutex mutex_;
+    size_t next_;
+    size_t remaining_;
+    size_t concurrency_;
+    bool asBuffer_;
+};
+
+// httpGetMany(urls, [{concurrency, timeout, connectTimeout, firstByteTimeout, headers, responseType, http2,
+//                     retry, hedge, cancelToken}])
+//   -> Promise<[{code, body, headers, timing}]> in the order of urls
+Napi::Value httpGetMany(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsArray())
+    {
+        Napi::TypeError::New(env, "Argument 0 must be an array").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Array urls = info[0].As<Napi::Array>();
+
+    int concurrency = 16;
+    bool http2 = false;
+    std::shared_ptr<const RestClient::HedgePolicy> hedge;
+    HttpGetOptions options = {3000, false, false, 0, 0, RestClient::CancelFlag(), NULL};
+    RestClient::HeaderFields headers;
+    if (!readHttpGetOptions(info, 1, &options))
+    {
+        return env.Null();
+    }
+    if (info.Length() > 1 && info[1].IsObject())
+    {
+        Napi::Object opts = info[1].As<Napi::Object>();
+        if (opts.Has("concurrency") && opts.Get("concurrency").IsNumber())
+        {
+            concurrency = opts.Get("concurrency").As<Napi::Number>().Int32Value();
+        }
+        if (opts.Has("headers") && opts.Get("headers").IsObject())
+        {
+            headers = headersFromObject(opts.Get("headers").As<Napi::Object>());
+        }
+        if (opts.Has("http2"))
+        {
+            http2 = opts.Get("http2").ToBoolean();
+        }
+        if (opts.Has("hedge"))
+        {
+            hedge = hedgePolicyFromValue(opts.Get("hedge"));
+        }
+        if (opts.Has("cancelToken"))
+        {
+            cancelTokenFromValue(opts.Get("cancelToken"))->multi = true;
+        }
+    }
+
+    std::vector<RestClient::Request> requests;
+    for (uint32_t i = 0; i < urls.Length(); ++i)
+    {
+        Napi::Value url = urls.Get(i);
+        if (!url.IsString())
+        {
+            Napi::TypeError::New(env, "Argument 0 must be an array of strings").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        RestClient::Request request;
+        request.method = "GET";
+        request.url = url.As<Napi::String>();
+        request.headers = headers;
+        request.timeout = 0;
+        request.deadlines = deadlinesFromOptions(options);
+        request.http2 = http2;
+        request.retry = options.retry;
+        request.hedge = hedge;
+        request.cancel = options.cancel;
+        requests.push_back(request);
+    }
+
+    if (requests.empty())
+    {
+        Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+        deferred.Resolve(Napi::Array::New(env));
+        return deferred.Promise();
+    }
+
+    HttpGetManyBatch *batch = new HttpGetManyBatch(env, requests, concurrency > 0 ? concurrency : 0, options.asBuffer);
+    Napi::Promise promise = batch->Promise();
+    batch->Start();
+    return promise;
+}
+
+// Backpressure state of one httpGetStream call. Chunks are produced on the
+// curl event loop and consumed on the JS thread; the transfer is paused while
+// the JS stream is full or too many chunks are still queued for delivery, so
+// memory stays bounded no matter how large the response is.
+class HttpStream : public std::enable_shared_from_this<HttpStream>
+{
+public:
+    static const int kHighWaterChunks = 16;
+
+    HttpStream() : id_(0), queued_(0), paused_(false), jsFull_(false) {}
+
+    void Start(Napi::Env env, const Napi::Function &onEvent, RestClient::Request &request)
+    {
+        std::shared_ptr<HttpStream> self = shared_from_this();
+        tsfn_ = Napi::ThreadSafeFunction::New(env, onEvent, "httpGetStream", 0, 1);
+        request.sink = [self](const char *data, size_t length) {
+            return self->onChunk(data, length);
+        };
+        uint64_t id = RestClient::MultiClient::instance().Submit(request, [self](RestClient::Response &res) {
+            self->onDone(res);
+        });
+        std::lock_guard<std::mutex> lock(mutex_);
+        id_ = id;
+    }
+
+    // called from JS whenever the consumer wants more data
+    void Resume()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jsFull_ = false;
+        resumeIfDrained();
+    }
+
+private:
+    // runs on the curl event loop thread
+    int onChunk(const char *data, size_t length)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (jsFull_ || queued_ >= kHighWaterChunks)
+            {
+                paused_ = true;
+                return RestClient::SINK_PAUSE;
+            }
+            queued_++;
+        }
+        char *copy = new char[length];
+        memcpy(copy, data, length);
+        std::shared_ptr<HttpStream> self = shared_from_this();
+        napi_status status = tsfn_.NonBlockingCall([self, copy, length](Napi::Env env, Napi::Function onEvent) {
+            Napi::Buffer<char> chunk = Napi::Buffer<char>::New(env, copy, length, [](Napi::Env, char *p) { delete[] p; });
+            Napi::Value wantMore = onEvent.Call({chunk});
+            self->delivered(wantMore.IsEmpty() || wantMore.ToBoolean());
+        });
+        if (status != napi_ok)
+        {
+            delete[] copy;
+            return RestClient::SINK_ABORT;
+        }
+        return RestClient::SINK_CONTINUE;
+    }
+
+    // runs on the curl event loop thread, the last event of the stream
+    void onDone(RestClient::Response &res)
+    {
+        RestClient::Response *result = new RestClient::Response(std::move(res));
+        tsfn_.NonBlockingCall(result, [](Napi::Env env, Napi::Function onEvent, RestClient::Response *result) {
+            onEvent.Call({env.Null(), responseToObject(env, *result)});
+            delete result;
+        });
+        tsfn_.Release();
+    }
+
+    // runs on the JS thread after a chunk was pushed into the JS stream
+    void delivered(bool wantMore)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_--;
+        if (!wantMore)
+        {
+            jsFull_ = true;
+        }
+        resumeIfDrained();
+    }
+
+    // mutex_ must be held
+    void resumeIfDrained()
+    {
+        if (paused_ && !jsFull_ && queued_ < kHighWaterChunks)
+        {
+            paused_ = false;
+            RestClient::MultiClient::instance().Resume(id_);
+        }
+    }
+
+    Napi::ThreadSafeFunction tsfn_;
+    std::mutex mutex_;
+    uint64_t id_;
+    int queued_;
+    bool paused_;
+    bool jsFull_;
+};
+
+// httpGetStreamNative(url, {timeout, connectTimeout, firstByteTimeout, headers, http2, retry, cancelToken},
+//                     onEvent) -> {resume()}
+// onEvent(chunk) is called per body chunk and returns false when the consumer
+// is full; onEvent(null, {code, headers, timing}) ends the stream. See
+// httpGetStream in lib/binding.js for the Readable built on top of it.
+Napi::Value httpGetStreamNative(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    REQUIRE_ARGUMENT_STRING(0, url);
+    if (info.Length() < 3 || !info[2].IsFunction())
+    {
+        Napi::TypeError::New(env, "Argument 2 must be a function").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    RestClient::Request request;
+    request.method = "GET";
+    request.url = url;
+    request.timeout = 0;
+    request.deadlines = RestClient::Deadlines();
+    request.http2 = false;
+    if (info[1].IsObject())
+    {
+        Napi::Object opts = info[1].As<Napi::Object>();
+        // no total timeout unless asked for, a stream may run for long
+        HttpGetOptions options = {0, false, false, 0, 0, RestClient::CancelFlag(), NULL};
+        if (!readHttpGetOptions(info, 1, &options))
+        {
+            return env.Null();
+        }
+        request.deadlines = deadlinesFromOptions(options);
+        request.cancel = options.cancel;
+        request.retry = options.retry;
+        if (request.cancel)
+        {
+            cancelTokenFromValue(opts.Get("cancelToken"))->multi = true;
+        }
+        if (opts.Has("headers") && opts.Get("headers").IsObject())
+        {
+            request.headers = headersFromObject(opts.Get("headers").As<Napi::Object>());
+        }
+        if (opts.Has("http2"))
+        {
+            request.http2 = opts.Get("http2").ToBoolean();
+        }
+    }
+
+    std::shared_ptr<HttpStream> stream = std::make_shared<HttpStream>();
+    stream->Start(env, info[2].As<Napi::Function>(), request);
+
+    Napi::Object handle = Napi::Object::New(env);
+    (handle).Set("resume", Napi::Function::New(env, [stream](const Napi::CallbackInfo &info) {
+        stream->Resume();
+        return info.Env().Undefined();
+    }));
+    return handle;
+}
+
+// shortest time between two progress events of an upload or download
+const std::chrono::milliseconds kProgressInterval(100);
+
+// Uploads a request body through the MultiClient. The body is a Buffer that
+// is pinned for the duration of the request, a file, or Buffers written from
+// JS one by one; either way libcurl reads it straight from the JS or file
+// memory into its upload buffer. Progress, 'drain' and the final response
+// are all reported through one onEvent(type, ...) function.
+class HttpUpload : public std::enable_shared_from_this<HttpUpload>
+{
+public:
+    // bytes written from JS and not yet sent before write() returns false
+    static constexpr size_t kHighWaterBytes = 1024 * 1024;
+
+    HttpUpload() : id_(0), queuedBytes_(0), offset_(0), ended_(false), paused_(false), full_(false) {}
+
+    // keeps buffer from being collected or moved until the upload finished
+    void Pin(const Napi::Buffer<char> &buffer)
+    {
+        pinned_.push_back(new Napi::Reference<Napi::Buffer<char>>(Napi::Persistent(buffer)));
+    }
+
+    // streamed uploads take their body from Write() and End()
+    void Start(Napi::Env env, const Napi::Function &onEvent, RestClient::Request &request, bool streamed)
+    {
+        std::shared_ptr<HttpUpload> self = shared_from_this();
+        tsfn_ = Napi::ThreadSafeFunction::New(env, onEvent, "httpUpload", 0, 1);
+        if (streamed)
+        {
+            request.source = [self](char *buffer, size_t length) {
+                return self->read(buffer, length);
+            };
+        }
+        request.uploadProgress = [self](int64_t sent, int64_t total) {
+            self->onProgress(sent, total);
+        };
+        uint64_t id = RestClient::MultiClient::instance().Submit(request, [self](RestClient::Response &res) {
+            self->onDone(res);
+        });
+        std::lock_guard<std::mutex> lock(mutex_);
+        id_ = id;
+    }
+
+    // called from JS with the next part of a streamed body, false asks the
+    // producer to wait for 'drain'
+    bool Write(const Napi::Buffer<char> &chunk)
+    {
+        releaseConsumed();
+        if (chunk.Length() == 0)
+        {
+            return true;
+        }
+        Chunk entry = {new Napi::Reference<Napi::Buffer<char>>(Napi::Persistent(chunk)), chunk.Data(), chunk.Length()};
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(entry);
+        queuedBytes_ += entry.length;
+        resumeIfPaused();
+        if (queuedBytes_ >= kHighWaterBytes)
+        {
+            full_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    // called from JS after the last Write()
+    void End()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ended_ = true;
+        resumeIfPaused();
+    }
+
+private:
+    typedef struct
+    {
+        Napi::Reference<Napi::Buffer<char>> *ref;
+        const char *data;
+        size_t length;
+    } Chunk;
+
+    // runs on the curl event loop thread
+    int64_t read(char *buffer, size_t length)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t written = 0;
+        while (written < length && !queue_.empty())
+        {
+            Chunk &chunk = queue_.front();
+            size_t n = std::min(chunk.length - offset_, length - written);
+            memcpy(buffer + written, chunk.data + offset_, n);
+            written += n;
+            offset_ += n;
+            queuedBytes_ -= n;
+            if (offset_ == chunk.length)
+            {
+                consumed_.push_back(chunk.ref);
+                queue_.pop_front();
+                offset_ = 0;
+            }
+        }
+        if (full_ && queuedBytes_ < kHighWaterBytes / 2)
+        {
+            full_ = false;
+            std::shared_ptr<HttpUpload> self = shared_from_this();
+            tsfn_.NonBlockingCall([self](Napi::Env env, Napi::Function onEvent) {
+                self->releaseConsumed();
+                onEvent.Call({Napi::String::New(env, "drain")});
+            });
+        }
+        if (written > 0)
+        {
+            return static_cast<int64_t>(written);
+        }
+        if (ended_)
+        {
+            return 0;
+        }
+        paused_ = true;
+        return RestClient::SOURCE_PAUSE;
+    }
+
+    // runs on the curl event loop thread
+    void onProgress(int64_t sent, int64_t total)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (sent != total && now - lastProgress_ < kProgressInterval)
+        {
+            return;
+        }
+        lastProgress_ = now;
+        tsfn_.NonBlockingCall([sent, total](Napi::Env env, Napi::Function onEvent) {
+            onEvent.Call({Napi::String::New(env, "progress"), Napi::Number::New(env, static_cast<double>(sent)),
+                          Napi::Number::New(env, static_cast<double>(total))});
+        });
+    }
+
+    // runs on the curl event loop thread, the last event of the upload
+    void onDone(RestClient::Response &res)
+    {
+        RestClient::Response *result = new RestClient::Response(std::move(res));
+        std::shared_ptr<HttpUpload> self = shared_from_this();
+        tsfn_.NonBlockingCall(result, [self](Napi::Env env, Napi::Function onEvent, RestClient::Response *result) {
+            self->releaseAll();
+            onEvent.Call({Napi::String::New(env, "response"), responseToObject(env, *result)});
+            delete result;
+        });
+        tsfn_.Release();
+    }
+
+    // mutex_ must be held
+    void resumeIfPaused()
+    {
+        if (paused_)
+        {
+            paused_ = false;
+            RestClient::MultiClient::instance().Resume(id_);
+        }
+    }
+
+    // References may only be deleted on the JS thread
+    void releaseConsumed()
+    {
+        std::vector<Napi::Reference<Napi::Buffer<char>> *> consumed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            consumed.swap(consumed_);
+        }
+        for (size_t i = 0; i < consumed.size(); ++i)
+        {
+            delete consumed[i];
+        }
+    }
+
+    // runs on the JS thread once the transfer is over
+    void releaseAll()
+    {
+        releaseConsumed();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < queue_.size(); ++i)
+        {
+            delete queue_[i].ref;
+        }
+        queue_.clear();
+        for (size_t i = 0; i < pinned_.size(); ++i)
+        {
+            delete pinned_[i];
+        }
+        pinned_.clear();
+    }
+
+    Napi::ThreadSafeFunction tsfn_;
+    std::mutex mutex_;
+    uint64_t id_;
+    std::deque<Chunk> queue_;
+    std::vector<Napi::Reference<Napi::Buffer<char>> *> consumed_;
+    std::vector<Napi::Reference<Napi::Buffer<char>> *> pinned_;
+    size_t queuedBytes_;
+    size_t offset_;
+    bool ended_;
+    bool paused_;
+    bool full_;
+    std::chrono::steady_clock::time_point lastProgress_;
+};
+
+// httpUploadNative(url, body, {method, size, timeout, connectTimeout, firstByteTimeout, headers, http2,
+//                              cancelToken}, onEvent) -> {write(chunk), end()}
+// body is a Buffer, {path} of a file, or null for a body passed to write()
+// chunk by chunk and finished with end(); size gives its length if known,
+// otherwise it is sent chunked. method is 'POST' (the default) or 'PUT'.
+// onEvent('progress', sent, total), onEvent('drain') once written chunks
+// were sent after write() returned false, and onEvent('response', {code,
+// body, headers, timing}) last. See httpUpload in lib/binding.js.
+Napi::Value httpUploadNative(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    REQUIRE_ARGUMENT_STRING(0, url);
+    if (info.Length() < 4 || !info[2].IsObject() || !info[3].IsFunction())
+    {
+        Napi::TypeError::New(env, "Argument 2 must be an object and 3 a function").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Object opts = info[2].As<Napi::Object>();
+    // no total timeout unless asked for, an upload may run for long
+    HttpGetOptions options = {0, false, false, 0, 0, RestClient::CancelFlag(), NULL};
+    if (!readHttpGetOptions(info, 2, &options))
+    {
+        return env.Null();
+    }
+
+    RestClient::Request request;
+    request.method = "POST";
+    request.url = url;
+    request.timeout = 0;
+    request.deadlines = deadlinesFromOptions(options);
+    request.http2 = false;
+    request.cancel = options.cancel;
+    request.uploadSize = -1;
+    if (request.cancel)
+    {
+        cancelTokenFromValue(opts.Get("cancelToken"))->multi = true;
+    }
+    if (opts.Has("method") && !opts.Get("method").IsUndefined())
+    {
+        request.method = opts.Get("method").ToString().Utf8Value();
+        if (request.method != "POST" && request.method != "PUT")
+        {
+            Napi::TypeError::New(env, "method must be 'POST' or 'PUT'").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+    }
+    if (opts.Has("headers") && opts.Get("headers").IsObject())
+    {
+        request.headers = headersFromObject(opts.Get("headers").As<Napi::Object>());
+    }
+    if (opts.Has("http2"))
+    {
+        request.http2 = opts.Get("http2").ToBoolean();
+    }
+
+    std::shared_ptr<HttpUpload> upload = std::make_shared<HttpUpload>();
+    bool streamed = false;
+    if (info[1].IsBuffer())
+    {
+        Napi::Buffer<char> buffer = info[1].As<Napi::Buffer<char>>();
+        upload->Pin(buffer);
+        request.source = RestClient::Helpers::buffer_source(buffer.Data(), buffer.Length());
+        request.uploadSize = static_cast<int64_t>(buffer.Length());
+    }
+    else if (info[1].IsObject() && info[1].As<Napi::Object>().Get("path").IsString())
+    {
+        std::string path = info[1].As<Napi::Object>().Get("path").ToString().Utf8Value();
+        request.source = RestClient::Helpers::file_source(path, &request.uploadSize);
+        if (!request.source)
+        {
+            Napi::Error::New(env, "Cannot open " + path).ThrowAsJavaScriptException();
+            return env.Null();
+        }
+    }
+    else if (info[1].IsNull())
+    {
+        streamed = true;
+        if (opts.Has("size") && opts.Get("size").IsNumber())
+        {
+            request.uploadSize = static_cast<int64_t>(opts.Get("size").As<Napi::Number>().DoubleValue());
+        }
+    }
+    else
+    {
+        Napi::TypeError::New(env, "Argument 1 must be a Buffer, {path} or null").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    upload->Start(env, info[3].As<Napi::Function>(), request, streamed);
+
+    Napi::Object handle = Napi::Object::New(env);
+    (handle).Set("write", Napi::Function::New(env, [upload](const Napi::CallbackInfo &info) {
+        Napi::Env env = info.Env();
+        if (info.Length() < 1 || !info[0].IsBuffer())
+        {
+            Napi::TypeError::New(env, "Argument 0 must be a Buffer").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        return Napi::Value(Napi::Boolean::New(env, upload->Write(info[0].As<Napi::Buffer<char>>())));
+    }));
+    (handle).Set("end", Napi::Function::New(env, [upload](const Napi::CallbackInfo &info) {
+        upload->End();
+        return info.Env().Undefined();
+    }));
+    return handle;
+}
+
+// Runs RestClient::downloadFile on the libuv thread pool. Progress is
+// forwarded to onProgress through a thread safe function, at most every
+// kProgressInterval.
+class DownloadWorker : public Napi::AsyncWorker
+{
+public:
+    DownloadWorker(Napi::Env env, const std::string &url, const std::string &path,
+                   const RestClient::DownloadOptions &options, const Napi::Value &onProgress)
+        : Napi::AsyncWorker(env), deferred_(Napi::Promise::Deferred::New(env)),
+          url_(url), path_(path), options_(options), response_(), hasProgress_(onProgress.IsFunction())
+    {
+        if (hasProgress_)
+        {
+            progress_ = Napi::ThreadSafeFunction::New(env, onProgress.As<Napi::Function>(), "downloadFile", 0, 1);
+            Napi::ThreadSafeFunction progress = progress_;
+            std::shared_ptr<std::chrono::steady_clock::time_point> last =
+                std::make_shared<std::chrono::steady_clock::time_point>();
+            // runs on the curl event loop thread
+            options_.progress = [progress, last](int64_t received, int64_t total) {
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if (received != total && now - *last < kProgressInterval)
+                {
+                    return;
+                }
+                *last = now;
+                progress.NonBlockingCall([received, total](Napi::Env env, Napi::Function onProgress) {
+                    onProgress.Call({Napi::Number::New(env, static_cast<double>(received)),
+                                     Napi::Number::New(env, static_cast<double>(total))});
+                });
+            };
+        }
+    }
+
+    Napi::Promise Promise() { return deferred_.Promise(); }
+
+    void Execute() override
+    {
+        try
+        {
+            response_ = RestClient::downloadFile(url_, path_, options_);
+        }
+        catch (const std::exception &e)
+        {
+            SetError(e.what());
+        }
+    }
+
+    void OnOK() override
+    {
+        releaseProgress();
+        deferred_.Resolve(responseToObject(Env(), response_));
+    }
+
+    void OnError(const Napi::Error &e) override
+    {
+        releaseProgress();
+        deferred_.Reject(e.Value());
+    }
+
+private:
+    void releaseProgress()
+    {
+        if (hasProgress_)
+        {
+            progress_.Release();
+        }
+    }
+
+    Napi::Promise::Deferred deferred_;
+    std::string url_;
+    std::string path_;
+    RestClient::DownloadOptions options_;
+    RestClient::Response response_;
+    bool hasProgress_;
+    Napi::ThreadSafeFunction progress_;
+};
+
+// downloadFile(url, path, [{segments, minSegmentSize, resume, timeout, connectTimeout, firstByteTimeout, headers,
+//                           retry, cancelToken, onProgress}]) -> Promise<{code, body, headers, timing}>
+// Writes the body to path as it arrives, see RestClient::downloadFile.
+// segments (default 1) range requests of at least minSegmentSize bytes
+// (default 4 MiB) run in parallel; resume (default true) continues an
+// earlier download that failed. timeout applies to each request. code is
+// 200 once path is complete. onProgress(received, total) follows the
+// download, total is -1 if unknown.
+Napi::Value downloadFile(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    REQUIRE_ARGUMENT_STRING(0, url);
+    REQUIRE_ARGUMENT_STRING(1, path);
+    HttpGetOptions options = {0, false, false, 0, 0, RestClient::CancelFlag(), NULL};
+    if (!readHttpGetOptions(info, 2, &options))
+    {
+        return env.Null();
+    }
+
+    RestClient::DownloadOptions download;
+    download.deadlines = deadlinesFromOptions(options);
+    download.segments = 1;
+    download.minSegmentSize = 4 * 1024 * 1024;
+    download.resume = true;
+    download.cancel = options.cancel;
+    download.retry = options.retry;
+    Napi::Value onProgress = env.Undefined();
+    if (info.Length() > 2 && info[2].IsObject())
+    {
+        Napi::Object opts = info[2].As<Napi::Object>();
+        if (opts.Has("segments") && opts.Get("segments").IsNumber())
+        {
+            download.segments = opts.Get("segments").As<Napi::Number>().Int32Value();
+        }
+        if (opts.Has("minSegmentSize") && opts.Get("minSegmentSize").IsNumber())
+        {
+            download.minSegmentSize = static_cast<int64_t>(opts.Get("minSegmentSize").As<Napi::Number>().DoubleValue());
+        }
+        if (opts.Has("resume"))
+        {
+            download.resume = opts.Get("resume").ToBoolean();
+        }
+        if (opts.Has("headers") && opts.Get("headers").IsObject())
+        {
+            download.headers = headersFromObject(opts.Get("headers").As<Napi::Object>());
+        }
+        if (download.cancel)
+        {
+            cancelTokenFromValue(opts.Get("cancelToken"))->multi = true;
+        }
+        onProgress = opts.Get("onProgress");
+    }
+
+    DownloadWorker *worker = new DownloadWorker(env, url, path, download, onProgress);
+    Napi::Promise promise = worker->Promise();
+    worker->Queue();
+    return promise;
+}
+
+// setResponseCacheDirectory(directory, maxBytes) keeps the responses of
+// {cache: true} requests in directory too, so they survive restarts. Only
+// the first call takes effect.
+Napi::Value setResponseCacheDirectory(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    REQUIRE_ARGUMENT_STRING(0, directory);
+    double maxBytes = 256.0 * 1024 * 1024;
+    if (info.Length() > 1 && info[1].IsNumber())
+    {
+        maxBytes = info[1].As<Napi::Number>().DoubleValue();
+    }
+
+    static std::mutex configured;
+    static RestClient::DiskCache *disk = NULL;
+    std::lock_guard<std::mutex> lock(configured);
+    if (disk)
+    {
+        return Napi::Boolean::New(env, false);
+    }
+    try
+    {
+        // never destroyed, requests on other threads may still use it at exit
+        disk = new RestClient::DiskCache(directory, static_cast<uint64_t>(maxBytes));
+    }
+    catch (const std::exception &e)
+    {
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    RestClient::ResponseCache::instance().SetDiskCache(disk);
+    return Napi::Boolean::New(env, true);
+}
+
+// Servers started by startServer, by port. They keep running until stopped,
+// also when JS drops the object startServer returned.
+std::mutex localServersMutex;
+std::map<int, std::shared_ptr<LocalServer>> localServers;
+
+// Stops a server on the libuv thread pool, requests still being proxied may
+// take a while to finish.
+class StopServerWorker : public Napi::AsyncWorker
+{
+public:
+    StopServerWorker(Napi::Env env, const std::shared_ptr<LocalServer> &server)
+        : Napi::AsyncWorker(env), deferred_(Napi::Promise::Deferred::New(env)), server_(server)
+    {
+    }
+
+    Napi::Promise Promise() { return deferred_.Promise(); }
+
+    void Execute() override
+    {
+        server_->Stop();
+    }
+
+    void OnOK() override
+    {
+        deferred_.Resolve(Env().Undefined());
+    }
+
+private:
+    Napi::Promise::Deferred deferred_;
+    std::shared_ptr<LocalServer> server_;
+};
+
+// startServer({host, port, threads, routes: [{path, dir, headers} | {path, proxy, headers, timeout}]})
+//   -> {port, stop() -> Promise}
+// Serves the files under dir at path, or forwards requests below path to the
+// proxy URL with libcurl. timeout bounds each proxied request in
+// milliseconds, 30000 by default. Everything runs on the server's own
+// threads, no request reaches JS. host defaults to 127.0.0.1, port 0 picks a
+// free one.
+Napi::Value startServer(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsObject())
+    {
+        Napi::TypeError::New(env, "Argument 0 must be an object").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Object opts = info[0].As<Napi::Object>();
+    std::string host = "127.0.0.1";
+    int port = 0;
+    int threads = 0;
+    if (opts.Has("host") && opts.Get("host").IsString())
+    {
+        host = opts.Get("host").As<Napi::String>();
+    }
+    if (opts.Has("port") && opts.Get("port").IsNumber())
+    {
+        port = opts.Get("port").As<Napi::Number>().Int32Value();
+    }
+    if (opts.Has("threads") && opts.Get("threads").IsNumber())
+    {
+        threads = opts.Get("threads").As<Napi::Number>().Int32Value();
+    }
+
+    std::shared_ptr<LocalServer> server = std::make_shared<LocalServer>();
+    Napi::Value routesValue = opts.Get("routes");
+    if (routesValue.IsArray())
+    {
+        Napi::Array routes = routesValue.As<Napi::Array>();
+        for (uint32_t i = 0; i < routes.Length(); i++)
+        {
+            Napi::Value routeValue = routes.Get(i);
+            if (!routeValue.IsObject())
+            {
+                Napi::TypeError::New(env, "routes must hold objects").ThrowAsJavaScriptException();
+                return env.Null();
+            }
+            Napi::Object route = routeValue.As<Napi::Object>();
+            if (!route.Get("path").IsString())
+            {
+                Napi::TypeError::New(env, "route path must be a string").ThrowAsJavaScriptException();
+                return env.Null();
+            }
+            std::string path = route.Get("path").As<Napi::String>();
+            RestClient::HeaderFields headers;
+            if (route.Has("headers") && route.Get("headers").IsObject())
+            {
+                headers = headersFromObject(route.Get("headers").As<Napi::Object>());
+            }
+            if (route.Get("dir").IsString())
+            {
+                std::string dir = route.Get("dir").As<Napi::String>();
+                if (!server->Mount(path, dir, headers))
+                {
+                    Napi::TypeError::New(env, "route dir " + dir + " is not a directory").ThrowAsJavaScriptException();
+                    return env.Null();
+                }
+            }
+            else if (route.Get("proxy").IsString())
+            {
+                long timeoutMs = 30000;
+                if (route.Has("timeout") && route.Get("timeout").IsNumber())
+                {
+                    timeoutMs = route.Get("timeout").As<Napi::Number>().Int32Value();
+                }
+                if (timeoutMs <= 0)
+                {
+                    Napi::TypeError::New(env, "route timeout must be positive").ThrowAsJavaScriptException();
+                    return env.Null();
+                }
+                server->Proxy(path, route.Get("proxy").As<Napi::String>(), headers, timeoutMs);
+            }
+            else
+            {
+                Napi::TypeError::New(env, "route needs a dir or a proxy").ThrowAsJavaScriptException();
+                return env.Null();
+            }
+        }
+    }
+
+    port = server->Start(host, port, threads);
+    if (port < 0)
+    {
+        Napi::Error::New(env, "could not listen on " + host).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    {
+        std::lock_guard<std::mutex> lock(localServersMutex);
+        localServers[port] = server;
+    }
+
+    Napi::Object result = Napi::Object::New(env);
+    (result).Set("port", port);
+    (result).Set("stop", Napi::Function::New(env, [port](const Napi::CallbackInfo &info) -> Napi::Value {
+        std::shared_ptr<LocalServer> stopping;
+        {
+            std::lock_guard<std::mutex> lock(localServersMutex);
+            std::map<int, std::shared_ptr<LocalServer>>::iterator it = localServers.find(port);
+            if (it != localServers.end())
+            {
+                stopping = it->second;
+                localServers.erase(it);
+            }
+        }
+        if (!stopping)
+        {
+            Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(info.Env());
+            deferred.Resolve(info.Env().Undefined());
+            return deferred.Promise();
+        }
+        StopServerWorker *worker = new StopServerWorker(info.Env(), stopping);
+        Napi::Promise promise = worker->Promise();
+        worker->Queue();
+        return promise;
+    }));
+    return result;
+}
+
+// Histogram of a phase as {buckets: [count per bound, then above], sum, count}
+Napi::Value histogramToObject(Napi::Env env, const RestClient::Metrics::Histogram &histogram)
+{
+    Napi::Object result = Napi::Object::New(env);
+    Napi::Array buckets = Napi::Array::New(env, RestClient::Metrics::BOUND_COUNT + 1);
+    for (size_t i = 0; i <= RestClient::Metrics::BOUND_COUNT; ++i)
+    {
+        buckets.Set(static_cast<uint32_t>(i), static_cast<double>(histogram.buckets[i]));
+    }
+    (result).Set("buckets", buckets);
+    (result).Set("sum", histogram.sum);
+    (result).Set("count", static_cast<double>(histogram.count));
+    return result;
+}
+
+// createCancelToken() -> {handle, cancel()}
+// Pass it as cancelToken to any of the GET exports; cancel() ends the
+// requests carrying it with code -1. lib/binding.js connects it to an
+// AbortSignal.
+Napi::Value createCancelToken(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    std::shared_ptr<CancelToken> token = std::make_shared<CancelToken>();
+    Napi::Object result = Napi::Object::New(env);
+    (result).Set("handle", Napi::External<std::shared_ptr<CancelToken>>::New(
+        env, new std::shared_ptr<CancelToken>(token),
+        [](Napi::Env, std::shared_ptr<CancelToken> *data) { delete data; }));
+    (result).Set("cancel", Napi::Function::New(env, [token](const Napi::CallbackInfo &) {
+        token->Cancel();
+    }));
+    return result;
+}
+
+// httpMetrics(['prometheus']) -> {requests, errors, ..., bounds, phases} or
+// the same counters as Prometheus exposition text
+Napi::Value httpMetrics(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    RestClient::Metrics &metrics = RestClient::Metrics::instance();
+    if (info.Length() > 0 && info[0].IsString())
+    {
+        std::string format = info[0].As<Napi::String>();
+        if (format != "prometheus")
+        {
+            Napi::TypeError::New(env, "Argument 0 must be 'prometheus'").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        return Napi::String::New(env, metrics.Prometheus("sysutilities_http"));
+    }
+
+    RestClient::Metrics::Snapshot snapshot = metrics.GetSnapshot();
+    Napi::Object result = Napi::Object::New(env);
+    (result).Set("requests", static_cast<double>(snapshot.requests));
+    (result).Set("errors", static_cast<double>(snapshot.errors));
+    (result).Set("reusedConnections", static_cast<double>(snapshot.reusedConnections));
+    (result).Set("bytesUp", static_cast<double>(snapshot.bytesUp));
+    (result).Set("bytesDown", static_cast<double>(snapshot.bytesDown));
+    (result).Set("coalesced", static_cast<double>(snapshot.coalesced));
+    (result).Set("retries", static_cast<double>(snapshot.retries));
+    (result).Set("hedges", static_cast<double>(snapshot.hedges));
+    (result).Set("hedgeWins", static_cast<double>(snapshot.hedgeWins));
+    Napi::Array bounds = Napi::Array::New(env, RestClient::Metrics::BOUND_COUNT);
+    for (size_t i = 0; i < RestClient::Metrics::BOUND_COUNT; ++i)
+    {
+        bounds.Set(static_cast<uint32_t>(i), RestClient::Metrics::BOUNDS[i]);
+    }
+    (result).Set("bounds", bounds);
+    Napi::Object phases = Napi::Object::New(env);
+    for (int phase = 0; phase < RestClient::Metrics::PHASE_COUNT; ++phase)
+    {
+        (phases).Set(RestClient::Metrics::PhaseName(phase), histogramToObject(env, snapshot.phases[phase]));
+    }
+    (result).Set("phases", phases);
     return result;
-#endif
-    /* if (!cb.IsUndefined() && cb.IsFunction()) {
-         Napi::Object result = Napi::Object::New(env);
-         (result).Set("status", res->status);
-         (result).Set("reason", res->reason);
-         (result).Set("body", res->body);
-         Napi::Value argv[] = { result };
-         TRY_CATCH_CALL(info.This(), cb, 1, argv);
-     }*/
 }
 
 Napi::Object Init(Napi::Env env, Napi::Object exports)
 {
+    // curl_global_init is not thread safe, run it before any worker does
+    RestClient::init();
     exports.Set(Napi::String::New(env, "unsafeShowOpenWith"), Napi::Function::New(env, unsafeShowOpenWith));
     exports.Set(Napi::String::New(env, "unsafeOpenEmailLink"), Napi::Function::New(env, unsafeOpenEmailLink));
     exports.Set(Napi::String::New(env, "unsafeLaunch"), Napi::Function::New(env, unsafeLaunch));
     exports.Set(Napi::String::New(env, "deviceId"), Napi::Function::New(env, deviceId));
     exports.Set(Napi::String::New(env, "httpGet"), Napi::Function::New(env, httpGet));
+    exports.Set(Napi::String::New(env, "httpGetAsync"), Napi::Function::New(env, httpGetAsync));
+    exports.Set(Napi::String::New(env, "httpGetMany"), Napi::Function::New(env, httpGetMany));
+    exports.Set(Napi::String::New(env, "httpGetStreamNative"), Napi::Function::New(env, httpGetStreamNative));
+    exports.Set(Napi::String::New(env, "createCancelToken"), Napi::Function::New(env, createCancelToken));
+    exports.Set(Napi::String::New(env, "httpUploadNative"), Napi::Function::New(env, httpUploadNative));
+    exports.Set(Napi::String::New(env, "downloadFile"), Napi::Function::New(env, downloadFile));
+    exports.Set(Napi::String::New(env, "startServer"), Napi::Function::New(env, startServer));
+    exports.Set(Napi::String::New(env, "httpMetrics"), Napi::Function::New(env, httpMetrics));
+    exports.Set(Napi::String::New(env, "setResponseCacheDirectory"), Napi::Function::New(env, setResponseCacheDirectory));
     return exports;
 }
 
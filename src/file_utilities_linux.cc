@@ -0,0 +1,81 @@
+#include "file_utilities_linux.h"
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fstream>
+
+namespace {
+
+// Run a desktop helper detached from the node process. The intermediate
+// child is reaped right away so the launched program never becomes a zombie.
+bool SpawnDetached(const char *program, const std::string &arg)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        if (fork() == 0) {
+            setsid();
+            execlp(program, program, arg.c_str(), (char *)NULL);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return true;
+}
+
+std::string ReadFirstLine(const char *path)
+{
+    std::ifstream in(path);
+    std::string line;
+    if (in) {
+        std::getline(in, line);
+    }
+    return line;
+}
+
+} // namespace
+
+namespace Platform {
+namespace File {
+
+bool UnsafeShowOpenWith(const std::string& filepath)
+{
+    // there is no portable "open with" chooser, fall back to the default app
+    return SpawnDetached("xdg-open", filepath);
+}
+
+void UnsafeOpenEmailLink(const std::string& email)
+{
+    SpawnDetached("xdg-open", "mailto:" + email);
+}
+
+void UnsafeLaunch(const std::string& filepath)
+{
+    SpawnDetached("xdg-open", filepath);
+}
+
+void UnsafeShowInFolder(const std::string& filepath)
+{
+    size_t found = filepath.find_last_of('/');
+    std::string folder = found == std::string::npos ? "." : filepath.substr(0, found);
+    SpawnDetached("xdg-open", folder);
+}
+
+} // namespace File
+
+namespace SystemInfo
+{
+    std::string DeviceId() {
+        // systemd and dbus both keep a stable per-install machine id
+        std::string machineId = ReadFirstLine("/etc/machine-id");
+        if (machineId.empty()) {
+            machineId = ReadFirstLine("/var/lib/dbus/machine-id");
+        }
+        return machineId;
+    }
+} // namespace SystemInfo
+
+} // namespace Platform
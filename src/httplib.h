@@ -20,6 +20,16 @@
 #define CPPHTTPLIB_KEEPALIVE_MAX_COUNT 5
 #endif
 
+// The epoll reactor (Server::set_reactor_mode) holds more sockets than
+// select() can watch
+#if defined(__linux__) && !defined(CPPHTTPLIB_USE_POLL)
+#define CPPHTTPLIB_USE_POLL
+#endif
+
+#ifndef CPPHTTPLIB_REACTOR_MAX_EVENTS
+#define CPPHTTPLIB_REACTOR_MAX_EVENTS 256
+#endif
+
 #ifndef CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND
 #define CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND 300
 #endif
@@ -103,6 +113,10 @@
 #define CPPHTTPLIB_LISTEN_BACKLOG 5
 #endif
 
+#ifndef CPPHTTPLIB_FILE_CHUNK_SIZE
+#define CPPHTTPLIB_FILE_CHUNK_SIZE size_t(1024u * 1024u)
+#endif
+
 /*
  * Headers
  */
@@ -181,9 +195,14 @@ using socket_t = SOCKET;
 #endif
 #include <csignal>
 #include <pthread.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
 
 using socket_t = int;
 #ifndef INVALID_SOCKET
@@ -215,6 +234,7 @@ using socket_t = int;
 #include <string>
 #include <sys/stat.h>
 #include <thread>
+#include <unordered_map>
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 // these are defined in wincrypt.h and it breaks compilation if BoringSSL is
@@ -328,6 +348,9 @@ public:
   DataSink &operator=(DataSink &&) = delete;
 
   std::function<bool(const char *data, size_t data_len)> write;
+  // Sends data_len bytes of the file fd from offset without copying them
+  // through user space. Only set when the stream supports it.
+  std::function<bool(int fd, size_t offset, size_t data_len)> write_file;
   std::function<void()> done;
   std::function<bool()> is_writable;
   std::ostream os;
@@ -508,6 +531,13 @@ public:
   virtual void get_remote_ip_and_port(std::string &ip, int &port) const = 0;
   virtual socket_t socket() const = 0;
 
+  // Streams that can write a file region straight from the kernel page cache
+  // (sendfile on plain Linux sockets) override these two.
+  virtual bool can_send_file() const { return false; }
+  virtual ssize_t send_file(int /*fd*/, size_t /*offset*/, size_t /*size*/) {
+    return -1;
+  }
+
   template <typename... Args>
   ssize_t write_format(const char *fmt, const Args &...args);
   ssize_t write(const char *ptr);
@@ -665,6 +695,11 @@ public:
   Server &set_keep_alive_max_count(size_t count);
   Server &set_keep_alive_timeout(time_t sec);
 
+  // Linux only: idle keep-alive connections wait in epoll instead of each
+  // holding a task queue thread, only sockets with a request to read are
+  // handed to the task queue. Ignored elsewhere and by SSLServer.
+  Server &set_reactor_mode(bool on);
+
   Server &set_read_timeout(time_t sec, time_t usec = 0);
   template <class Rep, class Period>
   Server &set_read_timeout(const std::chrono::duration<Rep, Period> &duration);
@@ -705,6 +740,11 @@ protected:
   time_t idle_interval_sec_ = CPPHTTPLIB_IDLE_INTERVAL_SECOND;
   time_t idle_interval_usec_ = CPPHTTPLIB_IDLE_INTERVAL_USECOND;
   size_t payload_max_length_ = CPPHTTPLIB_PAYLOAD_MAX_LENGTH;
+  bool reactor_mode_ = false;
+
+  // false for servers whose connections carry per socket state the reactor
+  // does not keep, such as a TLS session
+  virtual bool supports_reactor() const;
 
 private:
   using Handlers = std::vector<std::pair<std::regex, Handler>>;
@@ -715,10 +755,12 @@ private:
                                 SocketOptions socket_options) const;
   int bind_internal(const char *host, int port, int socket_flags);
   bool listen_internal();
+#ifdef __linux__
+  bool listen_internal_reactor();
+#endif
 
   bool routing(Request &req, Response &res, Stream &strm);
-  bool handle_file_request(const Request &req, Response &res,
-                           bool head = false);
+  bool handle_file_request(Request &req, Response &res, bool head = false);
   bool dispatch_request(Request &req, Response &res, const Handlers &handlers);
   bool
   dispatch_request_for_content_reader(Request &req, Response &res,
@@ -1401,6 +1443,7 @@ public:
 
 private:
   bool process_and_close_socket(socket_t sock) override;
+  bool supports_reactor() const override;
 
   SSL_CTX *ctx_;
   std::mutex ctx_mutex_;
@@ -2107,6 +2150,99 @@ inline void read_file(const std::string &path, std::string &out) {
   fs.read(&out[0], static_cast<std::streamsize>(size));
 }
 
+// A read-only mapping of a whole file. The descriptor stays open as well so
+// the file can also be handed to sendfile. An empty file opens without a
+// mapping and data() is nullptr.
+class mmap {
+public:
+  explicit mmap(const char *path) { open(path); }
+  ~mmap() { close(); }
+
+  mmap(const mmap &) = delete;
+  mmap &operator=(const mmap &) = delete;
+
+  bool is_open() const { return is_open_; }
+  size_t size() const { return size_; }
+  const char *data() const { return static_cast<const char *>(addr_); }
+  int fd() const { return fd_; }
+
+private:
+  bool open(const char *path) {
+#ifdef _WIN32
+    hFile_ = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile_ == INVALID_HANDLE_VALUE) { return false; }
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(hFile_, &size)) {
+      close();
+      return false;
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+
+    if (size_ > 0) {
+      hMapping_ = ::CreateFileMappingA(hFile_, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (hMapping_ == NULL) {
+        close();
+        return false;
+      }
+      addr_ = ::MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0);
+      if (addr_ == nullptr) {
+        close();
+        return false;
+      }
+    }
+#else
+    fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_ == -1) { return false; }
+
+    struct stat sb;
+    if (fstat(fd_, &sb) == -1) {
+      close();
+      return false;
+    }
+    size_ = static_cast<size_t>(sb.st_size);
+
+    if (size_ > 0) {
+      addr_ = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (addr_ == MAP_FAILED) {
+        addr_ = nullptr;
+        close();
+        return false;
+      }
+    }
+#endif
+    is_open_ = true;
+    return true;
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (addr_) { ::UnmapViewOfFile(addr_); }
+    if (hMapping_) { ::CloseHandle(hMapping_); }
+    if (hFile_ != INVALID_HANDLE_VALUE) { ::CloseHandle(hFile_); }
+    hMapping_ = NULL;
+    hFile_ = INVALID_HANDLE_VALUE;
+#else
+    if (addr_) { ::munmap(addr_, size_); }
+    if (fd_ != -1) { ::close(fd_); }
+    fd_ = -1;
+#endif
+    addr_ = nullptr;
+    size_ = 0;
+    is_open_ = false;
+  }
+
+#ifdef _WIN32
+  HANDLE hFile_ = INVALID_HANDLE_VALUE;
+  HANDLE hMapping_ = NULL;
+#endif
+  int fd_ = -1;
+  bool is_open_ = false;
+  size_t size_ = 0;
+  void *addr_ = nullptr;
+};
+
 inline std::string file_extension(const std::string &path) {
   std::smatch m;
   static auto re = std::regex("\\.([a-zA-Z0-9]+)$");
@@ -2396,6 +2532,10 @@ public:
   ssize_t write(const char *ptr, size_t size) override;
   void get_remote_ip_and_port(std::string &ip, int &port) const override;
   socket_t socket() const override;
+#ifdef __linux__
+  bool can_send_file() const override;
+  ssize_t send_file(int fd, size_t offset, size_t size) override;
+#endif
 
 private:
   socket_t sock_;
@@ -3483,6 +3623,22 @@ inline bool write_content(Stream &strm, const ContentProvider &content_provider,
     return ok;
   };
 
+  if (strm.can_send_file()) {
+    data_sink.write_file = [&](int fd, size_t off, size_t l) -> bool {
+      while (ok && l > 0) {
+        auto n = strm.send_file(fd, off, l);
+        if (n <= 0) {
+          ok = false;
+        } else {
+          off += static_cast<size_t>(n);
+          offset += static_cast<size_t>(n);
+          l -= static_cast<size_t>(n);
+        }
+      }
+      return ok;
+    };
+  }
+
   data_sink.is_writable = [&](void) { return ok && strm.is_writable(); };
 
   while (offset < end_offset && !is_shutting_down()) {
@@ -4014,7 +4170,8 @@ get_range_offset_and_length(const Request &req, size_t content_length,
     r.second = slen - 1;
   }
 
-  if (r.second == -1) { r.second = slen - 1; }
+  // a last byte past the end means the end of the content
+  if (r.second == -1 || r.second >= slen) { r.second = slen - 1; }
   return std::make_pair(r.first, static_cast<size_t>(r.second - r.first) + 1);
 }
 
@@ -4045,12 +4202,15 @@ bool process_multipart_ranges_data(const Request &req, Response &res,
       ctoken("\r\n");
     }
 
-    auto offsets = get_range_offset_and_length(req, res.body.size(), i);
+    // a content provider leaves the body empty and has the length instead
+    auto content_length =
+        res.content_provider_ ? res.content_length_ : res.body.size();
+    auto offsets = get_range_offset_and_length(req, content_length, i);
     auto offset = offsets.first;
     auto length = offsets.second;
 
     ctoken("Content-Range: ");
-    stoken(make_content_range_header_field(offset, length, res.body.size()));
+    stoken(make_content_range_header_field(offset, length, content_length));
     ctoken("\r\n");
     ctoken("\r\n");
     if (!content(offset, length)) { return false; }
@@ -4674,6 +4834,17 @@ inline void SocketStream::get_remote_ip_and_port(std::string &ip,
 
 inline socket_t SocketStream::socket() const { return sock_; }
 
+#ifdef __linux__
+inline bool SocketStream::can_send_file() const { return true; }
+
+inline ssize_t SocketStream::send_file(int fd, size_t offset, size_t size) {
+  if (!is_writable()) { return -1; }
+
+  auto off = static_cast<off_t>(offset);
+  return handle_EINTR([&]() { return sendfile(sock_, fd, &off, size); });
+}
+#endif
+
 // Buffer stream implementation
 inline bool BufferStream::is_readable() const { return true; }
 
@@ -4888,6 +5059,13 @@ inline Server &Server::set_keep_alive_timeout(time_t sec) {
   return *this;
 }
 
+inline Server &Server::set_reactor_mode(bool on) {
+  reactor_mode_ = on;
+  return *this;
+}
+
+inline bool Server::supports_reactor() const { return true; }
+
 inline Server &Server::set_read_timeout(time_t sec, time_t usec) {
   read_timeout_sec_ = sec;
   read_timeout_usec_ = usec;
@@ -5236,7 +5414,7 @@ inline bool Server::read_content_core(Stream &strm, Request &req, Response &res,
   return true;
 }
 
-inline bool Server::handle_file_request(const Request &req, Response &res,
+inline bool Server::handle_file_request(Request &req, Response &res,
                                         bool head) {
   for (const auto &entry : base_dirs_) {
     // Prefix match
@@ -5247,13 +5425,51 @@ inline bool Server::handle_file_request(const Request &req, Response &res,
         if (path.back() == '/') { path += "index.html"; }
 
         if (detail::is_file(path)) {
-          detail::read_file(path, res.body);
+          // the file is sent from the mapping (or by sendfile) as the
+          // response is written, never read into the body
+          auto mm = std::make_shared<detail::mmap>(path.c_str());
+          if (!mm->is_open()) { return false; }
+
           auto type =
               detail::find_content_type(path, file_extension_and_mimetype_map_);
           if (type) { res.set_header("Content-Type", type); }
           for (const auto &kv : entry.headers) {
             res.set_header(kv.first.c_str(), kv.second);
           }
+
+          // ranges that start past the end are dropped, only when none is
+          // left the request is unsatisfiable (RFC 7233 4.4)
+          if (!req.ranges.empty()) {
+            Ranges satisfiable;
+            for (size_t i = 0; i < req.ranges.size(); i++) {
+              auto offsets =
+                  detail::get_range_offset_and_length(req, mm->size(), i);
+              if (offsets.first < mm->size()) {
+                satisfiable.push_back(req.ranges[i]);
+              }
+            }
+            if (satisfiable.empty()) {
+              res.set_header("Content-Range",
+                             "bytes */" + std::to_string(mm->size()));
+              res.status = 416;
+              return true;
+            }
+            req.ranges.swap(satisfiable);
+          }
+
+          if (mm->size() > 0) {
+            res.content_length_ = mm->size();
+            res.content_provider_ = [mm](size_t offset, size_t length,
+                                         DataSink &sink) {
+              length = (std::min)(length, CPPHTTPLIB_FILE_CHUNK_SIZE);
+              if (sink.write_file) {
+                sink.write_file(mm->fd(), offset, length);
+              } else {
+                sink.write(mm->data() + offset, length);
+              }
+              return true;
+            };
+          }
           res.status = req.has_header("Range") ? 206 : 200;
           if (!head && file_request_handler_) {
             file_request_handler_(req, res);
@@ -5307,6 +5523,9 @@ inline int Server::bind_internal(const char *host, int port, int socket_flags) {
 }
 
 inline bool Server::listen_internal() {
+#ifdef __linux__
+  if (reactor_mode_ && supports_reactor()) { return listen_internal_reactor(); }
+#endif
   auto ret = true;
   is_running_ = true;
 
@@ -5386,6 +5605,187 @@ inline bool Server::listen_internal() {
   return ret;
 }
 
+#ifdef __linux__
+// Accepted sockets are registered with epoll one-shot: a readable socket is
+// disarmed and handed to the task queue, which reads and answers one request
+// and arms it again if the connection stays open. Connections idle for
+// longer than the keep-alive timeout are closed by the listener thread.
+inline bool Server::listen_internal_reactor() {
+  using clock = std::chrono::steady_clock;
+  struct Connection {
+    clock::time_point last_active;
+    size_t remaining;
+    bool busy;
+  };
+  struct Reactor {
+    int epfd;
+    std::mutex mutex;
+    std::unordered_map<socket_t, Connection> connections;
+  };
+
+  auto ret = true;
+  is_running_ = true;
+
+  Reactor reactor;
+  reactor.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (reactor.epfd < 0) {
+    is_running_ = false;
+    return false;
+  }
+  socket_t listen_sock = svr_sock_;
+  {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_sock;
+    epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, listen_sock, &ev);
+  }
+
+  auto arm = [&reactor](socket_t sock, int op) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = sock;
+    return epoll_ctl(reactor.epfd, op, sock, &ev) == 0;
+  };
+  auto close_connection = [&reactor](socket_t sock) {
+    {
+      std::lock_guard<std::mutex> guard(reactor.mutex);
+      reactor.connections.erase(sock);
+    }
+    detail::shutdown_socket(sock);
+    detail::close_socket(sock);
+  };
+
+  {
+    std::unique_ptr<TaskQueue> task_queue(new_task_queue());
+    std::vector<epoll_event> events(CPPHTTPLIB_REACTOR_MAX_EVENTS);
+    auto last_sweep = clock::now();
+
+    // the listening socket is closed by stop(), which epoll does not report,
+    // so wake up now and then to notice
+    while (svr_sock_ != INVALID_SOCKET) {
+      auto n = epoll_wait(reactor.epfd, events.data(),
+                          static_cast<int>(events.size()), 100);
+      if (n < 0) {
+        if (errno == EINTR) { continue; }
+        ret = false;
+        break;
+      }
+      if (n == 0 && (idle_interval_sec_ > 0 || idle_interval_usec_ > 0)) {
+        task_queue->on_idle();
+      }
+
+      for (int i = 0; i < n; i++) {
+        socket_t sock = events[i].data.fd;
+        if (sock == listen_sock) {
+          if (svr_sock_ == INVALID_SOCKET) { break; }
+          socket_t client = accept(listen_sock, nullptr, nullptr);
+          if (client == INVALID_SOCKET) {
+            if (errno == EMFILE) {
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            continue;
+          }
+          timeval tv;
+          tv.tv_sec = static_cast<long>(read_timeout_sec_);
+          tv.tv_usec = static_cast<decltype(tv.tv_usec)>(read_timeout_usec_);
+          setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
+          tv.tv_sec = static_cast<long>(write_timeout_sec_);
+          tv.tv_usec = static_cast<decltype(tv.tv_usec)>(write_timeout_usec_);
+          setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv, sizeof(tv));
+          {
+            std::lock_guard<std::mutex> guard(reactor.mutex);
+            reactor.connections[client] =
+                Connection{clock::now(), keep_alive_max_count_, false};
+          }
+          if (!arm(client, EPOLL_CTL_ADD)) { close_connection(client); }
+          continue;
+        }
+
+        // a socket that only reports an error or hang-up has no request
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) &&
+            !(events[i].events & EPOLLIN)) {
+          close_connection(sock);
+          continue;
+        }
+        size_t remaining = 0;
+        {
+          std::lock_guard<std::mutex> guard(reactor.mutex);
+          auto it = reactor.connections.find(sock);
+          if (it == reactor.connections.end()) { continue; }
+          it->second.busy = true;
+          remaining = it->second.remaining;
+        }
+        task_queue->enqueue([this, sock, remaining, &reactor, &arm,
+                             &close_connection]() {
+          auto connection_closed = false;
+          auto last = remaining <= 1;
+          bool ok;
+          {
+            detail::SocketStream strm(sock, read_timeout_sec_,
+                                      read_timeout_usec_, write_timeout_sec_,
+                                      write_timeout_usec_);
+            ok = process_request(strm, last, connection_closed, nullptr);
+          }
+          if (!ok || connection_closed || last ||
+              svr_sock_ == INVALID_SOCKET) {
+            close_connection(sock);
+            return;
+          }
+          bool armed;
+          {
+            // armed under the lock, so the listener thread cannot close the
+            // socket between marking it idle and arming it
+            std::lock_guard<std::mutex> guard(reactor.mutex);
+            auto &connection = reactor.connections[sock];
+            connection.remaining--;
+            connection.busy = false;
+            connection.last_active = clock::now();
+            armed = arm(sock, EPOLL_CTL_MOD);
+          }
+          if (!armed) { close_connection(sock); }
+        });
+      }
+
+      // close idle connections about once a second
+      auto now = clock::now();
+      if (now - last_sweep >= std::chrono::seconds(1)) {
+        last_sweep = now;
+        auto timeout = std::chrono::seconds(keep_alive_timeout_sec_);
+        std::vector<socket_t> expired;
+        {
+          std::lock_guard<std::mutex> guard(reactor.mutex);
+          for (auto it = reactor.connections.begin();
+               it != reactor.connections.end();) {
+            if (!it->second.busy && now - it->second.last_active > timeout) {
+              expired.push_back(it->first);
+              it = reactor.connections.erase(it);
+            } else {
+              ++it;
+            }
+          }
+        }
+        for (auto sock : expired) {
+          detail::shutdown_socket(sock);
+          detail::close_socket(sock);
+        }
+      }
+    }
+
+    // requests in progress finish before the remaining connections close
+    task_queue->shutdown();
+  }
+
+  for (auto &entry : reactor.connections) {
+    detail::shutdown_socket(entry.first);
+    detail::close_socket(entry.first);
+  }
+  close(reactor.epfd);
+
+  is_running_ = false;
+  return ret;
+}
+#endif
+
 inline bool Server::routing(Request &req, Response &res, Stream &strm) {
   if (pre_routing_handler_ &&
       pre_routing_handler_(req, res) == HandlerResponse::Handled) {
@@ -5480,6 +5880,9 @@ inline bool Server::dispatch_request(Request &req, Response &res,
 inline void Server::apply_ranges(const Request &req, Response &res,
                                  std::string &content_type,
                                  std::string &boundary) {
+  // a 416 carries none of the content, not even as multipart
+  if (res.status == 416) { return; }
+
   if (req.ranges.size() > 1) {
     boundary = detail::make_multipart_data_boundary();
 
@@ -5550,6 +5953,10 @@ inline void Server::apply_ranges(const Request &req, Response &res,
       } else {
         res.body.clear();
         res.status = 416;
+        res.headers.erase("Content-Type");
+        if (!content_type.empty()) {
+          res.headers.emplace("Content-Type", content_type);
+        }
       }
     }
 
@@ -7341,6 +7748,8 @@ inline bool SSLServer::is_valid() const { return ctx_; }
 
 inline SSL_CTX *SSLServer::ssl_context() const { return ctx_; }
 
+inline bool SSLServer::supports_reactor() const { return false; }
+
 inline bool SSLServer::process_and_close_socket(socket_t sock) {
   auto ssl = detail::ssl_new(
       sock, ctx_, ctx_mutex_,
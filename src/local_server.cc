@@ -0,0 +1,229 @@
+#include "local_server.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstring>
+
+#include "httplib.h"
+#include "restclient/connection.h"
+#include "restclient/connectionpool.h"
+#include "work_stealing_queue.h"
+
+namespace {
+
+bool EqualsIgnoreCase(const std::string &a, const char *b)
+{
+    size_t i = 0;
+    for (; i < a.size() && b[i]; ++i)
+    {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+        {
+            return false;
+        }
+    }
+    return i == a.size() && !b[i];
+}
+
+// Headers that describe one hop and must not be passed through a proxy,
+// plus the ones httplib adds to every request it receives.
+bool IsHopByHop(const std::string &name)
+{
+    static const char *names[] = {"connection", "keep-alive", "proxy-authenticate", "proxy-authorization",
+                                  "proxy-connection", "te", "trailer", "transfer-encoding", "upgrade",
+                                  "host", "content-length", "expect", "remote_addr", "remote_port",
+                                  "local_addr", "local_port"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        if (EqualsIgnoreCase(name, names[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string EscapeRegex(const std::string &text)
+{
+    std::string escaped;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (std::strchr("\\^$.|?*+()[]{}", text[i]))
+        {
+            escaped += '\\';
+        }
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+// Sends req on to url through a pooled libcurl connection and copies the
+// answer into res, giving up after timeoutMs or once stopping is set.
+// Failures come back as 502, missed deadlines as 504.
+void ForwardRequest(const httplib::Request &req, httplib::Response &res, const std::string &url,
+                    const std::map<std::string, std::string> &extraHeaders, long timeoutMs,
+                    const RestClient::CancelFlag &stopping)
+{
+    RestClient::HeaderFields headers;
+    for (httplib::Headers::const_iterator it = req.headers.begin(); it != req.headers.end(); ++it)
+    {
+        if (!IsHopByHop(it->first))
+        {
+            headers[it->first] = it->second;
+        }
+    }
+    for (std::map<std::string, std::string>::const_iterator it = extraHeaders.begin();
+         it != extraHeaders.end(); ++it)
+    {
+        headers[it->first] = it->second;
+    }
+
+    RestClient::Connection *conn = RestClient::ConnectionPool::instance().checkout(url);
+    conn->SetHeaders(headers);
+    RestClient::Deadlines deadlines;
+    deadlines.totalMs = timeoutMs;
+    conn->SetDeadlines(deadlines);
+    conn->SetCancelFlag(stopping);
+    RestClient::Response upstream;
+    if (req.method == "HEAD")
+    {
+        upstream = conn->head(url);
+    }
+    else if (req.method == "POST")
+    {
+        upstream = conn->post(url, req.body);
+    }
+    else if (req.method == "PUT")
+    {
+        upstream = conn->put(url, req.body);
+    }
+    else if (req.method == "PATCH")
+    {
+        upstream = conn->patch(url, req.body);
+    }
+    else if (req.method == "DELETE")
+    {
+        upstream = conn->del(url);
+    }
+    else if (req.method == "OPTIONS")
+    {
+        upstream = conn->options(url);
+    }
+    else
+    {
+        upstream = conn->get(url);
+    }
+    RestClient::ConnectionPool::instance().checkin(url, conn);
+
+    if (upstream.code < 100)
+    {
+        res.status = upstream.code == 28 ? 504 : 502;
+        res.set_content(upstream.body, "text/plain");
+        return;
+    }
+    res.status = upstream.code;
+    std::string contentType;
+    for (RestClient::HeaderFields::const_iterator it = upstream.headers.begin();
+         it != upstream.headers.end(); ++it)
+    {
+        // the status line is stored as a header without a value
+        if (it->first.compare(0, 5, "HTTP/") == 0 || IsHopByHop(it->first))
+        {
+            continue;
+        }
+        if (EqualsIgnoreCase(it->first, "content-type"))
+        {
+            contentType = it->second;
+            continue;
+        }
+        res.set_header(it->first.c_str(), it->second);
+    }
+    res.set_content(upstream.body, contentType.c_str());
+}
+
+} // namespace
+
+LocalServer::LocalServer()
+    : server_(new httplib::Server()), stopping_(std::make_shared<std::atomic<bool> >(false)), port_(-1)
+{
+}
+
+LocalServer::~LocalServer()
+{
+    Stop();
+}
+
+bool LocalServer::Mount(const std::string &path, const std::string &dir,
+                        const std::map<std::string, std::string> &headers)
+{
+    httplib::Headers fileHeaders(headers.begin(), headers.end());
+    return server_->set_mount_point(path, dir, fileHeaders);
+}
+
+void LocalServer::Proxy(const std::string &path, const std::string &upstream,
+                        const std::map<std::string, std::string> &headers, long timeoutMs)
+{
+    std::string prefix = path;
+    while (!prefix.empty() && prefix[prefix.size() - 1] == '/')
+    {
+        prefix.erase(prefix.size() - 1);
+    }
+    std::string base = upstream;
+    while (!base.empty() && base[base.size() - 1] == '/')
+    {
+        base.erase(base.size() - 1);
+    }
+    // the raw target keeps the query string and the percent-encoding
+    RestClient::CancelFlag stopping = stopping_;
+    httplib::Server::Handler handler = [prefix, base, headers, timeoutMs, stopping](const httplib::Request &req,
+                                                                                   httplib::Response &res) {
+        ForwardRequest(req, res, base + req.target.substr(prefix.size()), headers, timeoutMs, stopping);
+    };
+    std::string pattern = EscapeRegex(prefix) + "(/.*)?";
+    server_->Get(pattern, handler);
+    server_->Post(pattern, handler);
+    server_->Put(pattern, handler);
+    server_->Patch(pattern, handler);
+    server_->Delete(pattern, handler);
+    server_->Options(pattern, handler);
+}
+
+int LocalServer::Start(const std::string &host, int port, int threads)
+{
+    size_t count = threads > 0 ? static_cast<size_t>(threads) : CPPHTTPLIB_THREAD_POOL_COUNT;
+    server_->new_task_queue = [count] { return new WorkStealingQueue(count); };
+    // webviews keep many connections open, idle ones must not hold workers
+    server_->set_reactor_mode(true);
+    if (port == 0)
+    {
+        port = server_->bind_to_any_port(host.c_str());
+    }
+    else if (!server_->bind_to_port(host.c_str(), port))
+    {
+        port = -1;
+    }
+    if (port < 0)
+    {
+        return -1;
+    }
+    port_ = port;
+    stopping_->store(false);
+    httplib::Server *server = server_.get();
+    listener_ = std::thread([server] { server->listen_after_bind(); });
+    // stop() does nothing until the listener runs, Stop() would hang
+    while (!server_->is_running())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return port_;
+}
+
+void LocalServer::Stop()
+{
+    // running upstream calls would hold their workers until they time out
+    stopping_->store(true);
+    server_->stop();
+    if (listener_.joinable())
+    {
+        listener_.join();
+    }
+}
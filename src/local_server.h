@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace httplib {
+class Server;
+}
+
+// An HTTP server on the vendored cpp-httplib, answered entirely in native
+// code on its own thread pool so serving files and proxying API calls never
+// waits on the JS event loop. Routes are added before Start().
+class LocalServer
+{
+public:
+    LocalServer();
+    ~LocalServer();
+
+    // Serves the files under dir at path. headers are added to every file
+    // response. Returns false if dir is not a directory.
+    bool Mount(const std::string &path, const std::string &dir,
+               const std::map<std::string, std::string> &headers);
+
+    // Forwards GET, HEAD, POST, PUT, PATCH, DELETE and OPTIONS requests below
+    // path to upstream, which takes the place of path in the URL. headers are
+    // added to the upstream requests. An upstream that has not answered
+    // within timeoutMs gets the client a 504.
+    void Proxy(const std::string &path, const std::string &upstream,
+               const std::map<std::string, std::string> &headers, long timeoutMs);
+
+    // Listens on host:port (0 picks a free port) with threads workers on a
+    // WorkStealingQueue, 0 for as many as httplib would start. On Linux idle
+    // keep-alive connections wait in epoll, not on a worker. Returns the
+    // port, -1 if it could not bind.
+    int Start(const std::string &host, int port, int threads);
+
+    // Stops listening, aborts running proxy requests and waits for the
+    // running requests to finish.
+    void Stop();
+
+    int Port() const { return port_; }
+
+private:
+    LocalServer(const LocalServer &);
+    LocalServer &operator=(const LocalServer &);
+
+    std::unique_ptr<httplib::Server> server_;
+    std::thread listener_;
+    // set by Stop(), the cancel flag of every upstream request
+    std::shared_ptr<std::atomic<bool> > stopping_;
+    int port_;
+};
@@ -0,0 +1,78 @@
+/**
+ * @file backend.cpp
+ * @brief implementation of the libcurl backend
+ */
+
+#include "backend.h"
+
+#include <mutex>
+#include <string>
+
+#include "connection.h"
+#include "connectionpool.h"
+#include "version.h"
+
+/**
+ * @brief get the instance shared by the whole process. Never destroyed, so
+ * it is still usable from threads that outlive static destruction.
+ *
+ * @return curl backend instance
+ */
+RestClient::CurlBackend&
+RestClient::CurlBackend::instance() {
+  static RestClient::CurlBackend* backend = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    backend = new RestClient::CurlBackend();
+  });
+  return *backend;
+}
+
+/**
+ * @brief get the name of the backend
+ *
+ * @return "curl"
+ */
+const char*
+RestClient::CurlBackend::Name() const {
+  return "curl";
+}
+
+/**
+ * @brief check whether url can be fetched, leaving unsupported schemes for
+ * libcurl to report
+ *
+ * @param url to query
+ *
+ * @return always true
+ */
+bool
+RestClient::CurlBackend::Supports(const std::string& url) const {
+  return true;
+}
+
+/**
+ * @brief HTTP GET on a pooled connection
+ *
+ * @param url to query
+ * @param headers sent with the request
+ * @param deadlines for connecting, the first byte and the whole request
+ * @param cancel aborts the request once set, NULL for none
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::CurlBackend::get(const std::string& url,
+                             const RestClient::HeaderFields& headers,
+                             const RestClient::Deadlines& deadlines,
+                             const RestClient::CancelFlag& cancel) {
+  RestClient::Connection *conn =
+    RestClient::ConnectionPool::instance().checkout(url);
+  conn->SetDeadlines(deadlines);
+  conn->SetCancelFlag(cancel);
+  conn->SetHeaders(headers);
+  conn->SetCompression(true);
+  RestClient::Response ret = conn->get(url);
+  RestClient::ConnectionPool::instance().checkin(url, conn);
+  return ret;
+}
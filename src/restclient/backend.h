@@ -0,0 +1,66 @@
+/**
+ * @file backend.h
+ * @brief common interface of the HTTP client implementations
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_BACKEND_H_
+#define INCLUDE_RESTCLIENT_CPP_BACKEND_H_
+
+#include <string>
+
+#include "restclient.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief sends a GET through one HTTP client implementation and hands back
+  * the outcome as a Response, so callers can switch between libcurl and
+  * cpp-httplib without caring which one ran.
+  *
+  * Implementations keep their connections alive between calls and are safe
+  * to use from several threads at once. Errors are reported the way
+  * Connection reports them: code 28 and "Operation Timeout." for a missed
+  * deadline, -1 and "Request aborted." once cancelled, -1 and "Failed to
+  * query." otherwise.
+  */
+class Backend {
+ public:
+    virtual ~Backend() {}
+
+    // short name, "curl" or "httplib"
+    virtual const char* Name() const = 0;
+
+    // true if url can be fetched by this backend at all
+    virtual bool Supports(const std::string& url) const = 0;
+
+    // GET url with headers, blocking until done
+    virtual RestClient::Response get(const std::string& url,
+                                     const HeaderFields& headers,
+                                     const Deadlines& deadlines,
+                                     const CancelFlag& cancel) = 0;
+};
+
+/**
+  * @brief Backend on top of libcurl, borrowing connections from the
+  * process wide ConnectionPool. Handles every scheme libcurl was built with.
+  */
+class CurlBackend : public Backend {
+ public:
+    // the instance shared by the whole process
+    static CurlBackend& instance();
+
+    const char* Name() const;
+    bool Supports(const std::string& url) const;
+    RestClient::Response get(const std::string& url,
+                             const HeaderFields& headers,
+                             const Deadlines& deadlines,
+                             const CancelFlag& cancel);
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_BACKEND_H_
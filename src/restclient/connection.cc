@@ -26,19 +26,48 @@
  *
  */
 RestClient::Connection::Connection(const std::string& baseUrl)
-                               : headerFields(), lastRequest() {
+                               : headerFields(), lastRequest(),
+                                 sharedCache(NULL), headerList(NULL),
+                                 connectToList(NULL),
+                                 pendingResponse(), responseBuffer(NULL),
+                                 metrics(NULL) {
   this->curlHandle = curl_easy_init();
   if (!this->curlHandle) {
     throw std::runtime_error("Couldn't initialize curl handle");
   }
   this->baseUrl = baseUrl;
   this->timeout = 0;
+  this->deadlines.connectMs = 0;
+  this->deadlines.firstByteMs = 0;
+  this->deadlines.totalMs = 0;
   this->followRedirects = false;
   this->maxRedirects = -1l;
   this->noSignal = false;
+  this->http2 = false;
+  this->compression = false;
+  this->uploadObject.data = NULL;
+  this->uploadObject.length = 0;
+  this->uploadSize = -1;
+  this->writeObject.response = NULL;
+  this->writeObject.body = NULL;
+  this->writeObject.sink = NULL;
+  this->writeObject.expectBody = true;
+  this->writeObject.decodedSize = 0;
+  this->progressObject.handle = this->curlHandle;
+  this->progressObject.cancelled = NULL;
+  this->progressObject.firstByteMs = 0;
+  this->progressObject.timedOut = false;
+  this->progressObject.upload = NULL;
+  this->progressObject.uploaded = 0;
 }
 
 RestClient::Connection::~Connection() {
+  if (this->headerList) {
+    curl_slist_free_all(this->headerList);
+  }
+  if (this->connectToList) {
+    curl_slist_free_all(this->connectToList);
+  }
   if (this->curlHandle) {
     curl_easy_cleanup(this->curlHandle);
   }
@@ -60,6 +89,8 @@ RestClient::Connection::GetInfo() {
   ret.followRedirects = this->followRedirects;
   ret.maxRedirects = this->maxRedirects;
   ret.noSignal = this->noSignal;
+  ret.http2 = this->http2;
+  ret.compression = this->compression;
   ret.basicAuth.username = this->basicAuth.username;
   ret.basicAuth.password = this->basicAuth.password;
   ret.customUserAgent = this->customUserAgent;
@@ -88,6 +119,42 @@ RestClient::Connection::AppendHeader(const std::string& key,
   this->headerFields[key] = value;
 }
 
+/**
+ * @brief reset all per request settings to the values of a freshly
+ * constructed connection. The curl handle is kept, so a connection handed
+ * from one user to the next (see ConnectionPool) reuses its socket and TLS
+ * session but not the previous user's configuration.
+ */
+void
+RestClient::Connection::ResetOptions() {
+  this->headerFields.clear();
+  this->timeout = 0;
+  this->deadlines.connectMs = 0;
+  this->deadlines.firstByteMs = 0;
+  this->deadlines.totalMs = 0;
+  this->followRedirects = false;
+  this->maxRedirects = -1l;
+  this->noSignal = false;
+  this->http2 = false;
+  this->compression = false;
+  this->basicAuth.username.clear();
+  this->basicAuth.password.clear();
+  this->customUserAgent.clear();
+  this->caInfoFilePath.clear();
+  this->certPath.clear();
+  this->certType.clear();
+  this->keyPath.clear();
+  this->keyPassword.clear();
+  this->uriProxy.clear();
+  this->connectTo.clear();
+  this->cancelFlag.reset();
+  this->writeSink = nullptr;
+  this->uploadSource = nullptr;
+  this->uploadSize = -1;
+  this->uploadProgress = nullptr;
+  this->responseBuffer = NULL;
+}
+
 /**
  * @brief set the custom headers map. This will replace the currently
  * configured headers with the provided ones. If you want to add additional
@@ -198,6 +265,75 @@ RestClient::Connection::SetNoSignal(bool no) {
   this->noSignal = no;
 }
 
+/**
+ * @brief set millisecond deadlines for connecting, the first response byte
+ * and the whole request. The first byte deadline is checked from the
+ * progress callback, which curl calls at least once a second and whenever
+ * data moves.
+ *
+ * @param deadlines - limits in milliseconds, 0 for none
+ *
+ */
+void
+RestClient::Connection::SetDeadlines(const RestClient::Deadlines& deadlines) {
+  this->deadlines = deadlines;
+}
+
+/**
+ * @brief set a flag that cancels the request from the progress callback.
+ * The flag is only read, whoever cancels sets it.
+ *
+ * @param flag - NULL to stop
+ *
+ */
+void
+RestClient::Connection::SetCancelFlag(const RestClient::CancelFlag& flag) {
+  this->cancelFlag = flag;
+}
+
+/**
+ * @brief offer HTTP/2 during the TLS handshake (see CURLOPT_HTTP_VERSION,
+ * CURL_HTTP_VERSION_2TLS). Servers that do not pick it via ALPN, plain
+ * http:// URLs and libcurl builds without HTTP/2 keep using HTTP/1.1. When
+ * the request runs on a multi handle it waits for a connection that can be
+ * multiplexed instead of opening another one (see CURLOPT_PIPEWAIT).
+ *
+ * @param http2 - set to true to offer HTTP/2
+ *
+ */
+void
+RestClient::Connection::SetHttp2(bool http2) {
+  this->http2 = http2;
+}
+
+/**
+ * @brief send Accept-Encoding with every encoding the linked libcurl can
+ * decode (gzip and deflate, br and zstd when built with them, see
+ * CURLOPT_ACCEPT_ENCODING). Bodies are decoded chunk by chunk as they
+ * arrive; RequestInfo::downloadSize then counts the compressed bytes and
+ * RequestInfo::decodedSize the decoded ones.
+ *
+ * @param compression - set to true to accept compressed responses
+ *
+ */
+void
+RestClient::Connection::SetCompression(bool compression) {
+  this->compression = compression;
+}
+
+/**
+ * @brief send the request to another address than the URL's host resolves
+ * to, e.g. a second IP of the same service (see CURLOPT_CONNECT_TO). The
+ * port, TLS verification and Host header are unchanged.
+ *
+ * @param address - IPv4 or IPv6 address, empty to connect normally
+ *
+ */
+void
+RestClient::Connection::SetConnectTo(const std::string& address) {
+  this->connectTo = address;
+}
+
 /**
  * @brief set username and password for basic auth
  *
@@ -276,6 +412,90 @@ RestClient::Connection::SetProxy(const std::string& uriProxy) {
   }
 }
 
+/**
+ * @brief deliver the response body of the following requests chunk by chunk
+ * to sink as it arrives. Response::body stays empty, so memory use does not
+ * grow with the size of the response.
+ *
+ * @param sink to call for each chunk, an empty function to collect the body
+ * into Response::body again
+ *
+ */
+void
+RestClient::Connection::SetWriteSink(const RestClient::ChunkSink& sink) {
+  this->writeSink = sink;
+}
+
+/**
+ * @brief take the body of the following POST and PUT requests from source
+ * instead of their data argument. It is pulled chunk by chunk into
+ * libcurl's upload buffer as the request goes out, so neither a file nor a
+ * generated body has to fit into memory.
+ *
+ * @param source to call for each chunk, an empty function to send the data
+ * argument again
+ * @param size of the body in bytes, -1 if unknown. A body of unknown size is
+ * sent with chunked transfer encoding.
+ *
+ */
+void
+RestClient::Connection::SetUploadSource(const RestClient::ChunkSource& source,
+                                        int64_t size) {
+  this->uploadSource = source;
+  this->uploadSize = size;
+}
+
+/**
+ * @brief report how much of the request body of the following requests
+ * was sent. Called from the transfer whenever the count changed.
+ *
+ * @param progress to call, an empty function to stop
+ *
+ */
+void
+RestClient::Connection::SetUploadProgress(
+    const RestClient::UploadProgress& progress) {
+  this->uploadProgress = progress;
+}
+
+/**
+ * @brief collect the response body of the following requests into buffer
+ * instead of Response::body. The buffer is cleared before each request but
+ * keeps its capacity, so reusing it for similar responses avoids allocating
+ * a new body every time.
+ *
+ * @param buffer to write the body to, has to outlive the requests. NULL to
+ * collect into Response::body again
+ *
+ */
+void
+RestClient::Connection::SetResponseBuffer(std::string* buffer) {
+  this->responseBuffer = buffer;
+}
+
+/**
+ * @brief share DNS results, TLS sessions and possibly connections with all
+ * other connections using the same cache
+ *
+ * @param cache to use, NULL to stop sharing
+ *
+ */
+void
+RestClient::Connection::SetSharedCache(RestClient::SharedCache* cache) {
+  this->sharedCache = cache;
+}
+
+/**
+ * @brief record the timing of every following request in metrics
+ *
+ * @param metrics to record into, NULL to stop recording
+ *
+ */
+void
+RestClient::Connection::SetMetrics(RestClient::Metrics* metrics) {
+  this->metrics = metrics;
+}
+
 /**
  * @brief helper function to get called from the actual request methods to
  * prepare the curlHandle for transfer with generic options, perform the
@@ -285,19 +505,31 @@ RestClient::Connection::SetProxy(const std::string& uriProxy) {
  * parameters on the object for another request.
  *
  * @param uri URI to query
- * @param ret Reference to the Response struct that should be filled
  *
- * @return 0 on success and 1 on error
+ * @return response struct
  */
 RestClient::Response
 RestClient::Connection::performCurlRequest(const std::string& uri) {
+  this->prepareCurlRequest(uri);
+  CURLcode res = curl_easy_perform(this->curlHandle);
+  return this->finishCurlRequest(res);
+}
+
+/**
+ * @brief set generic options on the curlHandle so it is ready to be
+ * performed. The response is collected into pendingResponse until
+ * finishCurlRequest() is called.
+ *
+ * @param uri URI to query
+ */
+void
+RestClient::Connection::prepareCurlRequest(const std::string& uri) {
   // init return type
-  RestClient::Response ret = {};
+  this->pendingResponse = RestClient::Response();
+  this->pendingResponse.code = 0;
 
   std::string url = std::string(this->baseUrl + uri);
   std::string headerString;
-  CURLcode res = CURLE_OK;
-  curl_slist* headerList = NULL;
 
   curl_easy_setopt(this->curlHandle, CURLOPT_SSL_VERIFYPEER, 1L);
   curl_easy_setopt(this->curlHandle, CURLOPT_SSL_VERIFYHOST, 1L);
@@ -307,22 +539,33 @@ RestClient::Connection::performCurlRequest(const std::string& uri) {
   curl_easy_setopt(this->curlHandle, CURLOPT_WRITEFUNCTION,
                    Helpers::write_callback);
   /** set data object to pass to callback function */
-  curl_easy_setopt(this->curlHandle, CURLOPT_WRITEDATA, &ret);
+  this->writeObject.response = &this->pendingResponse;
+  if (this->responseBuffer) {
+    this->responseBuffer->clear();
+    this->writeObject.body = this->responseBuffer;
+  } else {
+    this->writeObject.body = &this->pendingResponse.body;
+  }
+  this->writeObject.sink = this->writeSink ? &this->writeSink : NULL;
+  this->writeObject.decodedSize = 0;
+  curl_easy_setopt(this->curlHandle, CURLOPT_WRITEDATA, &this->writeObject);
   /** set the header callback function */
   curl_easy_setopt(this->curlHandle, CURLOPT_HEADERFUNCTION,
                    Helpers::header_callback);
-  /** callback object for headers */
-  curl_easy_setopt(this->curlHandle, CURLOPT_HEADERDATA, &ret);
+  /** callback object for headers, also sizes the body buffer */
+  curl_easy_setopt(this->curlHandle, CURLOPT_HEADERDATA,
+                   &this->writeObject);
   /** set http headers */
   for (HeaderFields::const_iterator it = this->headerFields.begin();
       it != this->headerFields.end(); ++it) {
     headerString = it->first;
     headerString += ": ";
     headerString += it->second;
-    headerList = curl_slist_append(headerList, headerString.c_str());
+    this->headerList = curl_slist_append(this->headerList,
+                                         headerString.c_str());
   }
   curl_easy_setopt(this->curlHandle, CURLOPT_HTTPHEADER,
-      headerList);
+      this->headerList);
 
   // set basic auth if configured
   if (this->basicAuth.username.length() > 0) {
@@ -341,6 +584,34 @@ RestClient::Connection::performCurlRequest(const std::string& uri) {
     // dont want to get a sig alarm on timeout
     curl_easy_setopt(this->curlHandle, CURLOPT_NOSIGNAL, 1);
   }
+  // the millisecond variants share the setting, so these win over timeout
+  if (this->deadlines.connectMs > 0) {
+    curl_easy_setopt(this->curlHandle, CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<long>(this->deadlines.connectMs));  // NOLINT
+    curl_easy_setopt(this->curlHandle, CURLOPT_NOSIGNAL, 1);
+  }
+  if (this->deadlines.totalMs > 0) {
+    curl_easy_setopt(this->curlHandle, CURLOPT_TIMEOUT_MS,
+                     static_cast<long>(this->deadlines.totalMs));  // NOLINT
+    curl_easy_setopt(this->curlHandle, CURLOPT_NOSIGNAL, 1);
+  }
+  this->progressObject.handle = this->curlHandle;
+  this->progressObject.cancelled = this->cancelFlag.get();
+  this->progressObject.firstByteMs = this->deadlines.firstByteMs;
+  this->progressObject.started = std::chrono::steady_clock::now();
+  this->progressObject.timedOut = false;
+  this->progressObject.upload =
+    this->uploadProgress ? &this->uploadProgress : NULL;
+  this->progressObject.uploaded = 0;
+  if (this->cancelFlag || this->deadlines.firstByteMs > 0 ||
+      this->uploadProgress) {
+    curl_easy_setopt(this->curlHandle, CURLOPT_XFERINFOFUNCTION,
+                     Helpers::progress_callback);
+    curl_easy_setopt(this->curlHandle, CURLOPT_XFERINFODATA,
+                     &this->progressObject);
+    curl_easy_setopt(this->curlHandle, CURLOPT_NOPROGRESS, 0L);
+  }
+
   // set follow redirect
   if (this->followRedirects == true) {
     curl_easy_setopt(this->curlHandle, CURLOPT_FOLLOWLOCATION, 1L);
@@ -353,6 +624,31 @@ RestClient::Connection::performCurlRequest(const std::string& uri) {
     curl_easy_setopt(this->curlHandle, CURLOPT_NOSIGNAL, 1);
   }
 
+  // negotiate HTTP/2 over ALPN, fails harmlessly without HTTP/2 support
+  if (this->http2) {
+    curl_easy_setopt(this->curlHandle, CURLOPT_HTTP_VERSION,
+                     CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(this->curlHandle, CURLOPT_PIPEWAIT, 1L);
+  }
+
+  // an empty string offers all built-in encodings
+  if (this->compression) {
+    curl_easy_setopt(this->curlHandle, CURLOPT_ACCEPT_ENCODING, "");
+  }
+
+  // "::address:" maps any host and port to address on the same port
+  if (!this->connectTo.empty()) {
+    std::string target = this->connectTo;
+    if (target.find(':') != std::string::npos && target[0] != '[') {
+      target = "[" + target + "]";
+    }
+    target = "::" + target + ":";
+    this->connectToList = curl_slist_append(this->connectToList,
+                                            target.c_str());
+    curl_easy_setopt(this->curlHandle, CURLOPT_CONNECT_TO,
+                     this->connectToList);
+  }
+
   // if provided, supply CA path
   if (!this->caInfoFilePath.empty()) {
     curl_easy_setopt(this->curlHandle, CURLOPT_CAINFO,
@@ -389,25 +685,49 @@ RestClient::Connection::performCurlRequest(const std::string& uri) {
                      1L);
   }
 
-  res = curl_easy_perform(this->curlHandle);
+  // share DNS, TLS sessions and connections with other handles
+  if (this->sharedCache) {
+    curl_easy_setopt(this->curlHandle, CURLOPT_SHARE,
+                     this->sharedCache->handle());
+  }
+}
+
+/**
+ * @brief turn the outcome of a transfer prepared by prepareCurlRequest()
+ * into a response, record stats and reset the handle
+ *
+ * @param res result code of the transfer
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::Connection::finishCurlRequest(CURLcode res) {
+  // a missed first byte deadline is a timeout like any other
+  if (res == CURLE_ABORTED_BY_CALLBACK && this->progressObject.timedOut) {
+    res = CURLE_OPERATION_TIMEDOUT;
+  }
   if (res != CURLE_OK) {
     switch (res) {
       case CURLE_OPERATION_TIMEDOUT:
-        ret.code = res;
-        ret.body = "Operation Timeout.";
+        this->pendingResponse.code = res;
+        this->pendingResponse.body = "Operation Timeout.";
         break;
       case CURLE_SSL_CERTPROBLEM:
-        ret.code = res;
-        ret.body = curl_easy_strerror(res);
+        this->pendingResponse.code = res;
+        this->pendingResponse.body = curl_easy_strerror(res);
+        break;
+      case CURLE_ABORTED_BY_CALLBACK:
+        this->pendingResponse.body = "Request aborted.";
+        this->pendingResponse.code = -1;
         break;
       default:
-        ret.body = "Failed to query.";
-        ret.code = -1;
+        this->pendingResponse.body = "Failed to query.";
+        this->pendingResponse.code = -1;
     }
   } else {
     int64_t http_code = 0;
     curl_easy_getinfo(this->curlHandle, CURLINFO_RESPONSE_CODE, &http_code);
-    ret.code = static_cast<int>(http_code);
+    this->pendingResponse.code = static_cast<int>(http_code);
   }
 
   curl_easy_getinfo(this->curlHandle, CURLINFO_TOTAL_TIME,
@@ -424,15 +744,162 @@ RestClient::Connection::performCurlRequest(const std::string& uri) {
                     &this->lastRequest.startTransferTime);
   curl_easy_getinfo(this->curlHandle, CURLINFO_REDIRECT_TIME,
                     &this->lastRequest.redirectTime);
-  curl_easy_getinfo(this->curlHandle, CURLINFO_REDIRECT_COUNT,
-                    &this->lastRequest.redirectCount);
+  // the integer infos are written as long, which is not always an int
+  long value = 0;  // NOLINT(runtime/int)
+  curl_easy_getinfo(this->curlHandle, CURLINFO_REDIRECT_COUNT, &value);
+  this->lastRequest.redirectCount = static_cast<int>(value);
+  curl_off_t size = 0;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_SIZE_UPLOAD_T, &size);
+  this->lastRequest.uploadSize = static_cast<uint64_t>(size);
+  size = 0;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_SIZE_DOWNLOAD_T, &size);
+  this->lastRequest.downloadSize = static_cast<uint64_t>(size);
+  this->lastRequest.decodedSize = this->writeObject.decodedSize;
+  value = 0;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_NUM_CONNECTS, &value);
+  this->lastRequest.connectionReused = (res == CURLE_OK && value == 0);
+  value = 0;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_HTTP_VERSION, &value);
+  this->lastRequest.httpVersion = Helpers::http_version_name(value);
+  char* ip = NULL;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_PRIMARY_IP, &ip);
+  this->lastRequest.remoteIp = ip ? ip : "";
+  value = 0;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_RESPONSE_CODE, &value);
+  this->lastRequest.responseCode = static_cast<int>(value);
+  char* url = NULL;
+  curl_easy_getinfo(this->curlHandle, CURLINFO_EFFECTIVE_URL, &url);
+  this->lastRequest.effectiveUrl = url ? url : "";
+  this->pendingResponse.timing = this->lastRequest;
+  if (this->metrics) {
+    this->metrics->Record(this->lastRequest, this->pendingResponse.code);
+  }
   // free header list
-  curl_slist_free_all(headerList);
+  curl_slist_free_all(this->headerList);
+  this->headerList = NULL;
+  curl_slist_free_all(this->connectToList);
+  this->connectToList = NULL;
   // reset curl handle
   curl_easy_reset(this->curlHandle);
+  this->uploadObject.data = NULL;
+  this->uploadObject.length = 0;
+
+  RestClient::Response ret;
+#if __cplusplus >= 201103L
+  ret = std::move(this->pendingResponse);
+#else
+  ret = this->pendingResponse;
+#endif
+  this->pendingResponse = RestClient::Response();
   return ret;
 }
 
+/**
+ * @brief set up the curlHandle for an HTTP method. The request body is not
+ * copied and has to stay alive until the request finished.
+ *
+ * @param method HTTP verb, one of GET, POST, PUT, DELETE or HEAD
+ * @param data request body for POST and PUT
+ */
+void
+RestClient::Connection::setupMethod(const std::string& method,
+                                    const std::string& data) {
+  // HEAD answers carry the Content-Length of a body that never comes
+  this->writeObject.expectBody = (method != "HEAD");
+  if ((method == "POST" || method == "PUT") && this->uploadSource) {
+    if (method == "POST") {
+      curl_easy_setopt(this->curlHandle, CURLOPT_POST, 1L);
+      curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDSIZE_LARGE,
+                       static_cast<curl_off_t>(this->uploadSize));
+      // unlike PUT, libcurl only streams a POST of unknown size when asked
+      if (this->uploadSize < 0 &&
+          !Helpers::find_header(this->headerFields, "Transfer-Encoding")) {
+        this->headerList = curl_slist_append(this->headerList,
+                                             "Transfer-Encoding: chunked");
+      }
+    } else {
+      curl_easy_setopt(this->curlHandle, CURLOPT_UPLOAD, 1L);
+      curl_easy_setopt(this->curlHandle, CURLOPT_INFILESIZE_LARGE,
+                       static_cast<curl_off_t>(this->uploadSize));
+    }
+    /** pull the body from the source, see Helpers::source_callback */
+    curl_easy_setopt(this->curlHandle, CURLOPT_READFUNCTION,
+                     RestClient::Helpers::source_callback);
+    curl_easy_setopt(this->curlHandle, CURLOPT_READDATA, &this->uploadSource);
+  } else if (method == "POST") {
+    /** Now specify we want to POST data */
+    curl_easy_setopt(this->curlHandle, CURLOPT_POST, 1L);
+    /** set post fields */
+    curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDS, data.c_str());
+    curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDSIZE, data.size());
+  } else if (method == "PUT") {
+    /** initialize upload object */
+    this->uploadObject.data = data.c_str();
+    this->uploadObject.length = data.size();
+
+    /** Now specify we want to PUT data */
+    curl_easy_setopt(this->curlHandle, CURLOPT_PUT, 1L);
+    curl_easy_setopt(this->curlHandle, CURLOPT_UPLOAD, 1L);
+    /** set read callback function */
+    curl_easy_setopt(this->curlHandle, CURLOPT_READFUNCTION,
+                     RestClient::Helpers::read_callback);
+    /** set data object to pass to callback function */
+    curl_easy_setopt(this->curlHandle, CURLOPT_READDATA, &this->uploadObject);
+    /** set data size */
+    curl_easy_setopt(this->curlHandle, CURLOPT_INFILESIZE,
+                       static_cast<int64_t>(this->uploadObject.length));
+  } else if (method == "PATCH") {
+    /** set HTTP PATCH METHOD, the body is sent like a POST body */
+    curl_easy_setopt(this->curlHandle, CURLOPT_CUSTOMREQUEST, "PATCH");
+    curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDS, data.c_str());
+    curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDSIZE, data.size());
+  } else if (method == "DELETE") {
+    /** set HTTP DELETE METHOD */
+    curl_easy_setopt(this->curlHandle, CURLOPT_CUSTOMREQUEST, "DELETE");
+  } else if (method == "OPTIONS") {
+    /** set HTTP OPTIONS METHOD */
+    curl_easy_setopt(this->curlHandle, CURLOPT_CUSTOMREQUEST, "OPTIONS");
+  } else if (method == "HEAD") {
+    /** set HTTP HEAD METHOD */
+    curl_easy_setopt(this->curlHandle, CURLOPT_CUSTOMREQUEST, "HEAD");
+    curl_easy_setopt(this->curlHandle, CURLOPT_NOBODY, 1L);
+  }
+}
+
+/**
+ * @brief prepare a request without performing it, for driving the transfer
+ * from a curl multi handle (see MultiClient). The returned easy handle must
+ * be performed and then handed back through EndRequest() before the
+ * connection is used for anything else.
+ *
+ * @param method HTTP verb, one of GET, POST, PUT, PATCH, DELETE, OPTIONS or
+ * HEAD
+ * @param uri URI to query
+ * @param data request body for POST, PUT and PATCH, must outlive the transfer
+ *
+ * @return curl easy handle ready to be added to a multi handle
+ */
+CURL*
+RestClient::Connection::BeginRequest(const std::string& method,
+                                     const std::string& uri,
+                                     const std::string& data) {
+  this->setupMethod(method, data);
+  this->prepareCurlRequest(uri);
+  return this->curlHandle;
+}
+
+/**
+ * @brief finish a request started with BeginRequest()
+ *
+ * @param res result code the multi handle reported for the transfer
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::Connection::EndRequest(CURLcode res) {
+  return this->finishCurlRequest(res);
+}
+
 /**
  * @brief HTTP GET method
  *
@@ -455,12 +922,7 @@ RestClient::Connection::get(const std::string& url) {
 RestClient::Response
 RestClient::Connection::post(const std::string& url,
                              const std::string& data) {
-  /** Now specify we want to POST data */
-  curl_easy_setopt(this->curlHandle, CURLOPT_POST, 1L);
-  /** set post fields */
-  curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDS, data.c_str());
-  curl_easy_setopt(this->curlHandle, CURLOPT_POSTFIELDSIZE, data.size());
-
+  this->setupMethod("POST", data);
   return this->performCurlRequest(url);
 }
 /**
@@ -474,23 +936,21 @@ RestClient::Connection::post(const std::string& url,
 RestClient::Response
 RestClient::Connection::put(const std::string& url,
                             const std::string& data) {
-  /** initialize upload object */
-  RestClient::Helpers::UploadObject up_obj;
-  up_obj.data = data.c_str();
-  up_obj.length = data.size();
-
-  /** Now specify we want to PUT data */
-  curl_easy_setopt(this->curlHandle, CURLOPT_PUT, 1L);
-  curl_easy_setopt(this->curlHandle, CURLOPT_UPLOAD, 1L);
-  /** set read callback function */
-  curl_easy_setopt(this->curlHandle, CURLOPT_READFUNCTION,
-                   RestClient::Helpers::read_callback);
-  /** set data object to pass to callback function */
-  curl_easy_setopt(this->curlHandle, CURLOPT_READDATA, &up_obj);
-  /** set data size */
-  curl_easy_setopt(this->curlHandle, CURLOPT_INFILESIZE,
-                     static_cast<int64_t>(up_obj.length));
-
+  this->setupMethod("PUT", data);
+  return this->performCurlRequest(url);
+}
+/**
+ * @brief HTTP PATCH method
+ *
+ * @param url to query
+ * @param data HTTP PATCH body
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::Connection::patch(const std::string& url,
+                              const std::string& data) {
+  this->setupMethod("PATCH", data);
   return this->performCurlRequest(url);
 }
 /**
@@ -502,12 +962,20 @@ RestClient::Connection::put(const std::string& url,
  */
 RestClient::Response
 RestClient::Connection::del(const std::string& url) {
-  /** we want HTTP DELETE */
-  const char* http_delete = "DELETE";
-
-  /** set HTTP DELETE METHOD */
-  curl_easy_setopt(this->curlHandle, CURLOPT_CUSTOMREQUEST, http_delete);
+  this->setupMethod("DELETE", "");
+  return this->performCurlRequest(url);
+}
 
+/**
+ * @brief HTTP OPTIONS method
+ *
+ * @param url to query
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::Connection::options(const std::string& url) {
+  this->setupMethod("OPTIONS", "");
   return this->performCurlRequest(url);
 }
 
@@ -520,12 +988,6 @@ RestClient::Connection::del(const std::string& url) {
  */
 RestClient::Response
 RestClient::Connection::head(const std::string& url) {
-    /** we want HTTP HEAD */
-    const char* http_head = "HEAD";
-
-    /** set HTTP HEAD METHOD */
-    curl_easy_setopt(this->curlHandle, CURLOPT_CUSTOMREQUEST, http_head);
-    curl_easy_setopt(this->curlHandle, CURLOPT_NOBODY, 1L);
-
-    return this->performCurlRequest(url);
+  this->setupMethod("HEAD", "");
+  return this->performCurlRequest(url);
 }
@@ -15,6 +15,9 @@
 #include <cstdlib>
 
 #include "restclient.h"
+#include "helpers.h"
+#include "sharedcache.h"
+#include "metrics.h"
 #include "version.h"
 
 /**
@@ -28,45 +31,10 @@ namespace RestClient {
 class Connection {
  public:
     /**
-      *  @struct RequestInfo
-      *  @brief holds some diagnostics information
-      *  about a request
-      *  @var RequestInfo::totalTime
-      *  Member 'totalTime' contains the total time of the last request in
-      *  seconds Total time of previous transfer. See CURLINFO_TOTAL_TIME
-      *  @var RequestInfo::nameLookupTime
-      *  Member 'nameLookupTime' contains the time spent in DNS lookup in
-      *  seconds Time from start until name resolving completed. See
-      *  CURLINFO_NAMELOOKUP_TIME
-      *  @var RequestInfo::connectTime
-      *  Member 'connectTime' contains the time it took until Time from start
-      *  until remote host or proxy completed. See CURLINFO_CONNECT_TIME
-      *  @var RequestInfo::appConnectTime
-      *  Member 'appConnectTime' contains the time from start until SSL/SSH
-      *  handshake completed. See CURLINFO_APPCONNECT_TIME
-      *  @var RequestInfo::preTransferTime
-      *  Member 'preTransferTime' contains the total time from start until
-      *  just before the transfer begins. See CURLINFO_PRETRANSFER_TIME
-      *  @var RequestInfo::startTransferTime
-      *  Member 'startTransferTime' contains the total time from start until
-      *  just when the first byte is received. See CURLINFO_STARTTRANSFER_TIME
-      *  @var RequestInfo::redirectTime
-      *  Member 'redirectTime' contains the total time taken for all redirect
-      *  steps before the final transfer. See CURLINFO_REDIRECT_TIME
-      *  @var RequestInfo::redirectCount
-      *  Member 'redirectCount' contains the number of redirects followed. See
-      *  CURLINFO_REDIRECT_COUNT
+      *  @brief diagnostics information about a request, see
+      *  RestClient::RequestInfo
       */
-    typedef struct {
-        double totalTime;
-        double nameLookupTime;
-        double connectTime;
-        double appConnectTime;
-        double preTransferTime;
-        double startTransferTime;
-        double redirectTime;
-        int redirectCount;
-      } RequestInfo;
+    typedef RestClient::RequestInfo RequestInfo;
     /**
       *  @struct Info
       *  @brief holds some diagnostics information
@@ -81,6 +49,11 @@ class Connection {
       *  Member 'followRedirects' contains whether or not to follow redirects
       *  @var Info::maxRedirects
       *  Member 'maxRedirects' contains the maximum number of redirect to follow (-1 unlimited)
+      *  @var Info::http2
+      *  Member 'http2' contains whether HTTP/2 is offered on TLS connections
+      *  @var Info::compression
+      *  Member 'compression' contains whether compressed responses are
+      *  accepted and decoded
       *  @var Info::basicAuth
       *  Member 'basicAuth' contains information about basic auth
       *  @var basicAuth::username
@@ -109,6 +82,8 @@ class Connection {
       bool followRedirects;
       int maxRedirects;
       bool noSignal;
+      bool http2;
+      bool compression;
       struct {
         std::string username;
         std::string password;
@@ -135,9 +110,26 @@ class Connection {
     // set connection timeout to seconds
     void SetTimeout(int seconds);
 
+    // set connect, first byte and total deadlines in milliseconds, they
+    // take precedence over SetTimeout()
+    void SetDeadlines(const RestClient::Deadlines& deadlines);
+
+    // abort the request once flag is set, NULL for none
+    void SetCancelFlag(const RestClient::CancelFlag& flag);
+
     // set to not use signals
     void SetNoSignal(bool no);
 
+    // offer HTTP/2 via ALPN on TLS connections, 1.1 is used if declined
+    void SetHttp2(bool http2);
+
+    // accept gzip, deflate, br and zstd responses and decode them
+    void SetCompression(bool compression);
+
+    // connect to address instead of the host of the URL, empty to stop.
+    // TLS and the Host header still use the URL's host.
+    void SetConnectTo(const std::string& address);
+
     // set whether to follow redirects
     void FollowRedirects(bool follow);
 
@@ -167,6 +159,27 @@ class Connection {
     // set CURLOPT_PROXY
     void SetProxy(const std::string& uriProxy);
 
+    // stream the response body into sink instead of Response::body
+    void SetWriteSink(const RestClient::ChunkSink& sink);
+
+    // send the body of POST and PUT requests from source instead of their
+    // data argument, size -1 if unknown. Empty function to stop.
+    void SetUploadSource(const RestClient::ChunkSource& source, int64_t size);
+
+    // report the bytes of the request body sent so far, empty to stop
+    void SetUploadProgress(const RestClient::UploadProgress& progress);
+
+    // collect the body into buffer instead of Response::body, NULL to stop
+    void SetResponseBuffer(std::string* buffer);
+
+    // set CURLOPT_SHARE, NULL to stop sharing. The cache is kept by
+    // ResetOptions() and has to outlive the connection.
+    void SetSharedCache(RestClient::SharedCache* cache);
+
+    // record request timings, NULL to stop. Kept by ResetOptions() and has to
+    // outlive the connection.
+    void SetMetrics(RestClient::Metrics* metrics);
+
     std::string GetUserAgent();
 
     RestClient::Connection::Info GetInfo();
@@ -181,6 +194,10 @@ class Connection {
     void AppendHeader(const std::string& key,
                       const std::string& value);
 
+    // drop per request settings (headers, auth, timeout, ...) while keeping
+    // the curl handle and with it the live connection and TLS session
+    void ResetOptions();
+
 
     // Basic HTTP verb methods
     RestClient::Response get(const std::string& uri);
@@ -188,17 +205,30 @@ class Connection {
                               const std::string& data);
     RestClient::Response put(const std::string& uri,
                              const std::string& data);
+    RestClient::Response patch(const std::string& uri,
+                               const std::string& data);
     RestClient::Response del(const std::string& uri);
+    RestClient::Response options(const std::string& uri);
     RestClient::Response head(const std::string& uri);
 
+    // Split request methods for driving the transfer from a multi handle
+    CURL* BeginRequest(const std::string& method,
+                       const std::string& uri,
+                       const std::string& data);
+    RestClient::Response EndRequest(CURLcode res);
+
  private:
     CURL* curlHandle;
     std::string baseUrl;
     RestClient::HeaderFields headerFields;
     int timeout;
+    RestClient::Deadlines deadlines;
+    RestClient::CancelFlag cancelFlag;
     bool followRedirects;
     int maxRedirects;
     bool noSignal;
+    bool http2;
+    bool compression;
     struct {
       std::string username;
       std::string password;
@@ -211,6 +241,23 @@ class Connection {
     std::string keyPath;
     std::string keyPassword;
     std::string uriProxy;
+    std::string connectTo;
+    RestClient::SharedCache* sharedCache;
+    curl_slist* headerList;
+    curl_slist* connectToList;
+    RestClient::Response pendingResponse;
+    RestClient::ChunkSink writeSink;
+    RestClient::ChunkSource uploadSource;
+    int64_t uploadSize;
+    RestClient::UploadProgress uploadProgress;
+    std::string* responseBuffer;
+    RestClient::Metrics* metrics;
+    RestClient::Helpers::WriteObject writeObject;
+    RestClient::Helpers::UploadObject uploadObject;
+    RestClient::Helpers::ProgressObject progressObject;
+    void setupMethod(const std::string& method, const std::string& data);
+    void prepareCurlRequest(const std::string& uri);
+    RestClient::Response finishCurlRequest(CURLcode res);
     RestClient::Response performCurlRequest(const std::string& uri);
 };
 };  // namespace RestClient
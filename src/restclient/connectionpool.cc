@@ -0,0 +1,216 @@
+/**
+ * @file connectionpool.cpp
+ * @brief implementation of the connection pool
+ */
+
+#include "connectionpool.h"
+
+#include <string>
+#include <vector>
+
+#include "helpers.h"
+#include "version.h"
+
+/**
+ * @brief constructor for the ConnectionPool object
+ *
+ * @param maxPerHost - maximum number of idle connections kept per origin
+ * @param idleTimeoutSeconds - seconds an idle connection is kept
+ *
+ */
+RestClient::ConnectionPool::ConnectionPool(size_t maxPerHost,
+                                           int idleTimeoutSeconds)
+                               : idle(), sharedCache(NULL), metrics(NULL) {
+  this->maxPerHost = maxPerHost;
+  this->idleTimeout = idleTimeoutSeconds;
+}
+
+RestClient::ConnectionPool::~ConnectionPool() {
+  this->Clear();
+}
+
+/**
+ * @brief get the process wide pool. It is intentionally never destroyed so
+ * no curl handle gets cleaned up after curl_global_cleanup at exit; call
+ * RestClient::disable() to close the pooled connections.
+ *
+ * @return pool instance
+ */
+RestClient::ConnectionPool&
+RestClient::ConnectionPool::instance() {
+  static RestClient::ConnectionPool* pool = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    pool = new RestClient::ConnectionPool(6, 60);
+    pool->SetSharedCache(&RestClient::SharedCache::instance());
+    pool->SetMetrics(&RestClient::Metrics::instance());
+  });
+  return *pool;
+}
+
+/**
+ * @brief take an idle connection for the origin of url out of the pool or
+ * create a new one. The caller owns the connection until it is handed back
+ * with checkin().
+ *
+ * @param url the request will go to
+ *
+ * @return connection object, never NULL
+ */
+RestClient::Connection*
+RestClient::ConnectionPool::checkout(const std::string& url) {
+  std::string key = Helpers::origin(url);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->evictExpired(Clock::now());
+    std::map<std::string, std::deque<IdleConnection> >::iterator it =
+      this->idle.find(key);
+    if (it != this->idle.end() && !it->second.empty()) {
+      // most recently used first, it is the most likely to still be alive
+      RestClient::Connection* conn = it->second.back().conn;
+      it->second.pop_back();
+      return conn;
+    }
+  }
+  RestClient::Connection* conn = new RestClient::Connection("");
+  conn->SetSharedCache(this->sharedCache);
+  conn->SetMetrics(this->metrics);
+  return conn;
+}
+
+/**
+ * @brief hand a connection back after its request finished. Per request
+ * settings are cleared so the next user starts from a clean connection.
+ *
+ * @param url the finished request went to
+ * @param conn connection obtained from checkout()
+ */
+void
+RestClient::ConnectionPool::checkin(const std::string& url,
+                                    RestClient::Connection* conn) {
+  if (conn == NULL) {
+    return;
+  }
+  conn->ResetOptions();
+  std::string key = Helpers::origin(url);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::deque<IdleConnection>& conns = this->idle[key];
+    if (conns.size() < this->maxPerHost && this->idleTimeout > 0) {
+      IdleConnection entry = { conn, Clock::now() };
+      conns.push_back(entry);
+      return;
+    }
+  }
+  delete conn;
+}
+
+/**
+ * @brief set the maximum number of idle connections kept per origin
+ *
+ * @param maxPerHost - 0 disables pooling
+ */
+void
+RestClient::ConnectionPool::SetMaxPerHost(size_t maxPerHost) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->maxPerHost = maxPerHost;
+}
+
+/**
+ * @brief set how long an idle connection may stay in the pool
+ *
+ * @param seconds - 0 disables pooling
+ */
+void
+RestClient::ConnectionPool::SetIdleTimeout(int seconds) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->idleTimeout = seconds;
+}
+
+/**
+ * @brief set the cache for DNS results and TLS sessions handed to
+ * connections the pool creates from now on
+ *
+ * @param cache - NULL for none
+ */
+void
+RestClient::ConnectionPool::SetSharedCache(RestClient::SharedCache* cache) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->sharedCache = cache;
+}
+
+/**
+ * @brief set the metrics that connections the pool creates from now on
+ * record their requests in
+ *
+ * @param metrics - NULL for none
+ */
+void
+RestClient::ConnectionPool::SetMetrics(RestClient::Metrics* metrics) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->metrics = metrics;
+}
+
+/**
+ * @brief get the number of idle connections across all origins
+ *
+ * @return idle connection count
+ */
+size_t
+RestClient::ConnectionPool::IdleCount() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  size_t count = 0;
+  for (std::map<std::string, std::deque<IdleConnection> >::const_iterator it =
+       this->idle.begin(); it != this->idle.end(); ++it) {
+    count += it->second.size();
+  }
+  return count;
+}
+
+/**
+ * @brief close all idle connections
+ */
+void
+RestClient::ConnectionPool::Clear() {
+  std::vector<RestClient::Connection*> closing;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::map<std::string, std::deque<IdleConnection> >::iterator it =
+         this->idle.begin(); it != this->idle.end(); ++it) {
+      for (size_t i = 0; i < it->second.size(); ++i) {
+        closing.push_back(it->second[i].conn);
+      }
+    }
+    this->idle.clear();
+  }
+  for (size_t i = 0; i < closing.size(); ++i) {
+    delete closing[i];
+  }
+}
+
+/**
+ * @brief drop connections idle for longer than the TTL and surplus ones
+ * left over from a lowered maxPerHost. Must be called with the mutex held.
+ *
+ * @param now current time
+ */
+void
+RestClient::ConnectionPool::evictExpired(Clock::time_point now) {
+  Clock::duration ttl = std::chrono::seconds(this->idleTimeout);
+  std::map<std::string, std::deque<IdleConnection> >::iterator it =
+    this->idle.begin();
+  while (it != this->idle.end()) {
+    std::deque<IdleConnection>& conns = it->second;
+    // oldest entries sit at the front
+    while (!conns.empty() && (now - conns.front().lastUsed > ttl ||
+           conns.size() > this->maxPerHost)) {
+      delete conns.front().conn;
+      conns.pop_front();
+    }
+    if (conns.empty()) {
+      this->idle.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
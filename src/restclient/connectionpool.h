@@ -0,0 +1,88 @@
+/**
+ * @file connectionpool.h
+ * @brief process wide pool of reusable Connection objects
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_CONNECTIONPOOL_H_
+#define INCLUDE_RESTCLIENT_CPP_CONNECTIONPOOL_H_
+
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+#include "connection.h"
+#include "sharedcache.h"
+#include "metrics.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief keeps warm Connection objects around, keyed by scheme+host+port.
+  *
+  * A Connection keeps its curl handle between requests and curl keeps the
+  * live socket and TLS session attached to that handle, so handing the same
+  * Connection to the next request for an origin skips the TCP and TLS
+  * handshakes. Connections idle for longer than the TTL are closed on the
+  * next pool access; at most maxPerHost idle connections are kept per
+  * origin, extra ones are closed on checkin.
+  */
+class ConnectionPool {
+ public:
+    ConnectionPool(size_t maxPerHost, int idleTimeoutSeconds);
+    ~ConnectionPool();
+
+    // the pool used by the simple API in restclient.h
+    static ConnectionPool& instance();
+
+    // take a connection for url, creating one if none is idle
+    RestClient::Connection* checkout(const std::string& url);
+
+    // give a connection back after a request to url has finished
+    void checkin(const std::string& url, RestClient::Connection* conn);
+
+    // maximum number of idle connections kept per origin
+    void SetMaxPerHost(size_t maxPerHost);
+
+    // seconds an idle connection may stay in the pool
+    void SetIdleTimeout(int seconds);
+
+    // cache handed to connections created by the pool, NULL for none
+    void SetSharedCache(RestClient::SharedCache* cache);
+
+    // metrics handed to connections created by the pool, NULL for none
+    void SetMetrics(RestClient::Metrics* metrics);
+
+    // number of idle connections across all origins
+    size_t IdleCount();
+
+    // close all idle connections
+    void Clear();
+
+ private:
+    typedef std::chrono::steady_clock Clock;
+    typedef struct {
+      RestClient::Connection* conn;
+      Clock::time_point lastUsed;
+    } IdleConnection;
+
+    ConnectionPool(const ConnectionPool&);
+    ConnectionPool& operator=(const ConnectionPool&);
+
+    void evictExpired(Clock::time_point now);
+
+    std::mutex mutex;
+    std::map<std::string, std::deque<IdleConnection> > idle;
+    size_t maxPerHost;
+    int idleTimeout;
+    RestClient::SharedCache* sharedCache;
+    RestClient::Metrics* metrics;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_CONNECTIONPOOL_H_
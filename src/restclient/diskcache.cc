@@ -0,0 +1,622 @@
+/**
+ * @file diskcache.cpp
+ * @brief implementation of the persistent response store
+ */
+
+#include "diskcache.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "version.h"
+
+namespace {
+
+const char INDEX_FILE[] = "index";
+const char INDEX_MAGIC[] = "restclient-diskcache-1";
+const char BODY_SUFFIX[] = ".body";
+const char TMP_SUFFIX[] = ".tmp";
+
+bool ends_with(const std::string& s, const char* suffix) {
+  size_t n = std::strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// index fields are netstrings, "<length>:<bytes>,", so any byte is allowed
+void put_field(std::string* out, const std::string& value) {
+  *out += std::to_string(value.size());
+  *out += ':';
+  *out += value;
+  *out += ',';
+}
+
+void put_number(std::string* out, int64_t value) {
+  put_field(out, std::to_string(value));
+}
+
+bool get_field(const std::string& in, size_t* pos, std::string* value) {
+  size_t colon = in.find(':', *pos);
+  if (colon == std::string::npos || colon == *pos) {
+    return false;
+  }
+  char* end = NULL;
+  uint64_t length = std::strtoull(in.c_str() + *pos, &end, 10);
+  if (end != in.c_str() + colon || length > in.size() - colon - 1 ||
+      in[colon + 1 + length] != ',') {
+    return false;
+  }
+  value->assign(in, colon + 1, length);
+  *pos = colon + 2 + length;
+  return true;
+}
+
+bool get_number(const std::string& in, size_t* pos, int64_t* value) {
+  std::string field;
+  if (!get_field(in, pos, &field) || field.empty()) {
+    return false;
+  }
+  *value = std::strtoll(field.c_str(), NULL, 10);
+  return true;
+}
+
+void put_headers(std::string* out, const RestClient::HeaderFields& headers) {
+  put_number(out, static_cast<int64_t>(headers.size()));
+  for (RestClient::HeaderFields::const_iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    put_field(out, it->first);
+    put_field(out, it->second);
+  }
+}
+
+bool get_headers(const std::string& in, size_t* pos,
+                 RestClient::HeaderFields* headers) {
+  int64_t count = 0;
+  if (!get_number(in, pos, &count)) {
+    return false;
+  }
+  for (int64_t i = 0; i < count; ++i) {
+    std::string key;
+    std::string value;
+    if (!get_field(in, pos, &key) || !get_field(in, pos, &value)) {
+      return false;
+    }
+    (*headers)[key] = value;
+  }
+  return true;
+}
+
+// 64 bit FNV-1a, only used to give body files a recognisable name
+uint64_t fnv1a(const std::string& s) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < s.size(); ++i) {
+    hash ^= static_cast<unsigned char>(s[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string hex(uint64_t value) {
+  char buf[17];
+  std::snprintf(buf, sizeof(buf), "%016llx",
+                static_cast<unsigned long long>(value));  // NOLINT
+  return buf;
+}
+
+bool read_file(const std::string& path, std::string* content) {
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  char buf[65536];
+  size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) {
+    content->append(buf, n);
+  }
+  bool ok = !std::ferror(f);
+  std::fclose(f);
+  return ok;
+}
+
+// write data to tmp, flush it to disk and move it to path in one step
+bool write_atomic(const std::string& tmp, const std::string& path,
+                  const char* data, size_t size) {
+  FILE* f = std::fopen(tmp.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = size == 0 || std::fwrite(data, 1, size, f) == size;
+  ok = std::fflush(f) == 0 && ok;
+#if defined(_WIN32)
+  ok = FlushFileBuffers(reinterpret_cast<HANDLE>(
+         _get_osfhandle(_fileno(f)))) && ok;
+#else
+  ok = fsync(fileno(f)) == 0 && ok;
+#endif
+  ok = std::fclose(f) == 0 && ok;
+  if (ok) {
+#if defined(_WIN32)
+    ok = MoveFileExA(tmp.c_str(), path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+  }
+  if (!ok) {
+    std::remove(tmp.c_str());
+  }
+  return ok;
+}
+
+bool make_directory(const std::string& directory) {
+#if defined(_WIN32)
+  return CreateDirectoryA(directory.c_str(), NULL) ||
+         GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+  return mkdir(directory.c_str(), 0700) == 0 || errno == EEXIST;
+#endif
+}
+
+std::vector<std::string> list_directory(const std::string& directory) {
+  std::vector<std::string> names;
+#if defined(_WIN32)
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &data);
+  if (find != INVALID_HANDLE_VALUE) {
+    do {
+      names.push_back(data.cFileName);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+  }
+#else
+  DIR* dir = opendir(directory.c_str());
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+      names.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+#endif
+  return names;
+}
+
+}  // namespace
+
+RestClient::MappedFile::MappedFile() : address(NULL), length(0) {
+}
+
+RestClient::MappedFile::~MappedFile() {
+  if (this->address) {
+#if defined(_WIN32)
+    UnmapViewOfFile(this->address);
+#else
+    munmap(this->address, this->length);
+#endif
+  }
+}
+
+/**
+ * @brief map a whole file read only. The file handle is closed right away,
+ * the mapping keeps the data reachable.
+ *
+ * @param path of the file
+ *
+ * @return mapping, NULL on failure. Empty files give an empty mapping.
+ */
+std::shared_ptr<RestClient::MappedFile>
+RestClient::MappedFile::Open(const std::string& path) {
+  std::shared_ptr<RestClient::MappedFile> mapped(
+    new RestClient::MappedFile());
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return std::shared_ptr<RestClient::MappedFile>();
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return std::shared_ptr<RestClient::MappedFile>();
+  }
+  mapped->length = static_cast<size_t>(size.QuadPart);
+  if (mapped->length > 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                        NULL);
+    if (mapping) {
+      mapped->address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return std::shared_ptr<RestClient::MappedFile>();
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return std::shared_ptr<RestClient::MappedFile>();
+  }
+  mapped->length = static_cast<size_t>(st.st_size);
+  if (mapped->length > 0) {
+    void* address = mmap(NULL, mapped->length, PROT_READ, MAP_SHARED, fd, 0);
+    if (address != MAP_FAILED) {
+      mapped->address = address;
+    }
+  }
+  close(fd);
+#endif
+  if (mapped->length > 0 && !mapped->address) {
+    return std::shared_ptr<RestClient::MappedFile>();
+  }
+  return mapped;
+}
+
+/**
+ * @brief get the mapped bytes
+ *
+ * @return start of the file, NULL for an empty file
+ */
+const char*
+RestClient::MappedFile::data() const {
+  return reinterpret_cast<const char*>(this->address);
+}
+
+/**
+ * @brief get the size of the mapping
+ *
+ * @return file size in bytes
+ */
+size_t
+RestClient::MappedFile::size() const {
+  return this->length;
+}
+
+/**
+ * @brief constructor for the DiskCache object, reads the index of an
+ * existing cache and deletes files it does not reference
+ *
+ * @param directory to keep the cache in, its parent has to exist
+ * @param maxBytes - upper bound for the size of all stored bodies
+ *
+ */
+RestClient::DiskCache::DiskCache(const std::string& directory,
+                                 uint64_t maxBytes)
+                               : directory(directory), bytes(0), nextFile(0),
+                                 useCounter(0), dirty(false), entries() {
+  if (!make_directory(directory)) {
+    throw std::runtime_error("Couldn't create cache directory " + directory);
+  }
+  this->maxBytes = maxBytes;
+  this->load();
+  this->removeOrphans();
+  this->evict();
+}
+
+/**
+ * @brief destructor, saves the usage order
+ */
+RestClient::DiskCache::~DiskCache() {
+  this->Flush();
+}
+
+/**
+ * @brief get a stored response
+ *
+ * @param url the response belongs to
+ * @param record receives headers and freshness of the response
+ * @param body receives the mapped body
+ *
+ * @return true if the response was found and its body could be mapped
+ */
+bool
+RestClient::DiskCache::Find(const std::string& url,
+                            RestClient::DiskCache::Record* record,
+                            std::shared_ptr<RestClient::MappedFile>* body) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<std::string, Entry>::iterator it = this->entries.find(url);
+  if (it == this->entries.end()) {
+    return false;
+  }
+  std::shared_ptr<RestClient::MappedFile> mapped =
+    RestClient::MappedFile::Open(this->path(it->second.file));
+  if (!mapped || mapped->size() != it->second.size) {
+    // the body went missing or was changed behind our back
+    this->drop(it);
+    this->saveIndex();
+    return false;
+  }
+  it->second.lastUsed = ++this->useCounter;
+  this->dirty = true;
+  *record = it->second.record;
+  *body = mapped;
+  return true;
+}
+
+/**
+ * @brief store a response. The body goes to a new file, so mappings of a
+ * previous body of the same URL stay valid.
+ *
+ * @param record headers and freshness of the response
+ * @param data body
+ * @param size of the body
+ *
+ * @return false if the response could not be written or is larger than the
+ * whole cache
+ */
+bool
+RestClient::DiskCache::Put(const RestClient::DiskCache::Record& record,
+                           const char* data, size_t size) {
+  std::string file;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (size > this->maxBytes) {
+      return false;
+    }
+    file = hex(fnv1a(record.url)) + "-" + hex(this->nextFile++) +
+           BODY_SUFFIX;
+  }
+  // the body is written without holding the lock
+  if (!write_atomic(this->path(file + TMP_SUFFIX), this->path(file), data,
+                    size)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<std::string, Entry>::iterator it = this->entries.find(record.url);
+  if (it != this->entries.end()) {
+    this->drop(it);
+  }
+  Entry entry;
+  entry.record = record;
+  entry.file = file;
+  entry.size = size;
+  entry.lastUsed = ++this->useCounter;
+  this->entries[record.url] = entry;
+  this->bytes += size;
+  this->evict();
+  return this->saveIndex();
+}
+
+/**
+ * @brief replace headers and freshness of a stored response after it was
+ * revalidated
+ *
+ * @param record new headers and freshness, matched by url
+ */
+void
+RestClient::DiskCache::Update(const RestClient::DiskCache::Record& record) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<std::string, Entry>::iterator it = this->entries.find(record.url);
+  if (it != this->entries.end()) {
+    it->second.record = record;
+    it->second.lastUsed = ++this->useCounter;
+    this->saveIndex();
+  }
+}
+
+/**
+ * @brief delete the stored response of a URL
+ *
+ * @param url the response belongs to
+ */
+void
+RestClient::DiskCache::Remove(const std::string& url) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<std::string, Entry>::iterator it = this->entries.find(url);
+  if (it != this->entries.end()) {
+    this->drop(it);
+    this->saveIndex();
+  }
+}
+
+/**
+ * @brief delete all stored responses
+ */
+void
+RestClient::DiskCache::Clear() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  while (!this->entries.empty()) {
+    this->drop(this->entries.begin());
+  }
+  this->saveIndex();
+}
+
+/**
+ * @brief save the index if only the usage order changed since it was last
+ * written, which lookups do not save right away
+ */
+void
+RestClient::DiskCache::Flush() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->dirty) {
+    this->saveIndex();
+  }
+}
+
+/**
+ * @brief get the size of all stored bodies
+ *
+ * @return size in bytes
+ */
+uint64_t
+RestClient::DiskCache::Size() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->bytes;
+}
+
+/**
+ * @brief get the full path of a file in the cache directory
+ *
+ * @param file name
+ *
+ * @return path
+ */
+std::string
+RestClient::DiskCache::path(const std::string& file) {
+#if defined(_WIN32)
+  return this->directory + "\\" + file;
+#else
+  return this->directory + "/" + file;
+#endif
+}
+
+/**
+ * @brief read the index. A missing or damaged index leaves the cache empty.
+ */
+void
+RestClient::DiskCache::load() {
+  std::string content;
+  if (!read_file(this->path(INDEX_FILE), &content)) {
+    return;
+  }
+  size_t pos = 0;
+  std::string magic;
+  int64_t nextFile = 0;
+  int64_t useCounter = 0;
+  int64_t count = 0;
+  if (!get_field(content, &pos, &magic) || magic != INDEX_MAGIC ||
+      !get_number(content, &pos, &nextFile) ||
+      !get_number(content, &pos, &useCounter) ||
+      !get_number(content, &pos, &count)) {
+    return;
+  }
+
+  std::map<std::string, Entry> loaded;
+  uint64_t bytes = 0;
+  for (int64_t i = 0; i < count; ++i) {
+    Entry entry;
+    int64_t code = 0;
+    int64_t size = 0;
+    int64_t mustRevalidate = 0;
+    if (!get_field(content, &pos, &entry.record.url) ||
+        !get_field(content, &pos, &entry.file) ||
+        !get_number(content, &pos, &code) ||
+        !get_number(content, &pos, &size) ||
+        !get_number(content, &pos, &entry.record.storedAt) ||
+        !get_number(content, &pos, &entry.record.ageAtStore) ||
+        !get_number(content, &pos, &entry.record.lifetime) ||
+        !get_number(content, &pos, &mustRevalidate) ||
+        !get_number(content, &pos, &entry.lastUsed) ||
+        !get_headers(content, &pos, &entry.record.headers) ||
+        !get_headers(content, &pos, &entry.record.vary)) {
+      return;
+    }
+    entry.record.code = static_cast<int>(code);
+    entry.record.mustRevalidate = mustRevalidate != 0;
+    entry.size = static_cast<uint64_t>(size);
+    bytes += entry.size;
+    loaded[entry.record.url] = entry;
+  }
+
+  this->entries.swap(loaded);
+  this->bytes = bytes;
+  this->nextFile = static_cast<uint64_t>(nextFile);
+  this->useCounter = useCounter;
+}
+
+/**
+ * @brief delete body and temporary files the index does not know about,
+ * left over from a crash or from bodies that were still mapped when dropped
+ */
+void
+RestClient::DiskCache::removeOrphans() {
+  std::set<std::string> known;
+  for (std::map<std::string, Entry>::iterator it = this->entries.begin();
+       it != this->entries.end(); ++it) {
+    known.insert(it->second.file);
+  }
+  std::vector<std::string> names = list_directory(this->directory);
+  for (size_t i = 0; i < names.size(); ++i) {
+    if ((ends_with(names[i], BODY_SUFFIX) && !known.count(names[i])) ||
+        ends_with(names[i], TMP_SUFFIX)) {
+      std::remove(this->path(names[i]).c_str());
+    }
+  }
+}
+
+/**
+ * @brief write the index, replacing the old one in one step. The mutex must
+ * be held.
+ *
+ * @return true on success
+ */
+bool
+RestClient::DiskCache::saveIndex() {
+  std::string out;
+  put_field(&out, INDEX_MAGIC);
+  put_number(&out, static_cast<int64_t>(this->nextFile));
+  put_number(&out, this->useCounter);
+  put_number(&out, static_cast<int64_t>(this->entries.size()));
+  for (std::map<std::string, Entry>::const_iterator it =
+       this->entries.begin(); it != this->entries.end(); ++it) {
+    const Entry& entry = it->second;
+    put_field(&out, entry.record.url);
+    put_field(&out, entry.file);
+    put_number(&out, entry.record.code);
+    put_number(&out, static_cast<int64_t>(entry.size));
+    put_number(&out, entry.record.storedAt);
+    put_number(&out, entry.record.ageAtStore);
+    put_number(&out, entry.record.lifetime);
+    put_number(&out, entry.record.mustRevalidate ? 1 : 0);
+    put_number(&out, entry.lastUsed);
+    put_headers(&out, entry.record.headers);
+    put_headers(&out, entry.record.vary);
+  }
+  this->dirty = false;
+  return write_atomic(this->path(std::string(INDEX_FILE) + TMP_SUFFIX),
+                      this->path(INDEX_FILE), out.data(), out.size());
+}
+
+/**
+ * @brief forget a response and delete its body. On Windows the delete fails
+ * while the body is still mapped; the file is removed on the next start
+ * instead. The mutex must be held.
+ *
+ * @param it entry of the response
+ */
+void
+RestClient::DiskCache::drop(std::map<std::string, Entry>::iterator it) {
+  std::remove(this->path(it->second.file).c_str());
+  this->bytes -= it->second.size;
+  this->entries.erase(it);
+}
+
+/**
+ * @brief drop least recently used responses until the size bound holds.
+ * The mutex must be held.
+ */
+void
+RestClient::DiskCache::evict() {
+  while (this->bytes > this->maxBytes && !this->entries.empty()) {
+    std::map<std::string, Entry>::iterator oldest = this->entries.begin();
+    for (std::map<std::string, Entry>::iterator it = this->entries.begin();
+         it != this->entries.end(); ++it) {
+      if (it->second.lastUsed < oldest->second.lastUsed) {
+        oldest = it;
+      }
+    }
+    this->drop(oldest);
+    this->dirty = true;
+  }
+}
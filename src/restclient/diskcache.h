@@ -0,0 +1,146 @@
+/**
+ * @file diskcache.h
+ * @brief persistent store for cached responses
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_DISKCACHE_H_
+#define INCLUDE_RESTCLIENT_CPP_DISKCACHE_H_
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "restclient.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief a file mapped read only into memory. The mapping stays valid
+  * while the object lives, even if the file is deleted meanwhile.
+  */
+class MappedFile {
+ public:
+    // map path, NULL if it cannot be opened or mapped
+    static std::shared_ptr<MappedFile> Open(const std::string& path);
+    ~MappedFile();
+
+    const char* data() const;
+    size_t size() const;
+
+ private:
+    MappedFile();
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void* address;
+    size_t length;
+};
+
+/**
+  * @brief keeps cached responses in a directory so they survive restarts.
+  *
+  * The directory holds one file per body plus an index with the headers and
+  * freshness information of all responses. Bodies are written to a
+  * temporary file and renamed into place under a new name, and the index is
+  * replaced the same way, so a crash never leaves a half written response
+  * behind. Bodies are read by mapping their file. Least recently used
+  * responses are dropped when the bodies exceed the size bound.
+  *
+  * Safe to use from several threads. Only one process should use a
+  * directory at a time.
+  */
+class DiskCache {
+ public:
+    /** @struct Record
+      *  @brief a stored response without its body
+      *  @var Record::url
+      *  Member 'url' contains the URL the response belongs to
+      *  @var Record::code
+      *  Member 'code' contains the HTTP response code
+      *  @var Record::headers
+      *  Member 'headers' contains the response headers
+      *  @var Record::vary
+      *  Member 'vary' contains the request header values named by Vary
+      *  @var Record::storedAt
+      *  Member 'storedAt' contains the time the response was stored or last
+      *  revalidated, seconds since the epoch
+      *  @var Record::ageAtStore
+      *  Member 'ageAtStore' contains the age of the response in seconds at
+      *  storedAt
+      *  @var Record::lifetime
+      *  Member 'lifetime' contains the freshness lifetime in seconds
+      *  @var Record::mustRevalidate
+      *  Member 'mustRevalidate' is true for no-cache responses
+      */
+    typedef struct {
+      std::string url;
+      int code;
+      RestClient::HeaderFields headers;
+      RestClient::HeaderFields vary;
+      int64_t storedAt;
+      int64_t ageAtStore;
+      int64_t lifetime;
+      bool mustRevalidate;
+    } Record;
+
+    // opens or creates directory, throws std::runtime_error if it cannot be
+    // created
+    DiskCache(const std::string& directory, uint64_t maxBytes);
+    ~DiskCache();
+
+    // true if a response for url is stored, body gets its mapping
+    bool Find(const std::string& url, Record* record,
+              std::shared_ptr<MappedFile>* body);
+
+    // store a response, replacing any stored for the same URL
+    bool Put(const Record& record, const char* data, size_t size);
+
+    // replace headers and freshness of a stored response, keeping the body
+    void Update(const Record& record);
+
+    void Remove(const std::string& url);
+
+    void Clear();
+
+    // write the index if lookups changed the usage order since the last save
+    void Flush();
+
+    // size of all stored bodies
+    uint64_t Size();
+
+ private:
+    typedef struct {
+      Record record;
+      std::string file;
+      uint64_t size;
+      int64_t lastUsed;
+    } Entry;
+
+    DiskCache(const DiskCache&);
+    DiskCache& operator=(const DiskCache&);
+
+    std::string path(const std::string& file);
+    void load();
+    void removeOrphans();
+    bool saveIndex();
+    void drop(std::map<std::string, Entry>::iterator it);
+    void evict();
+
+    std::mutex mutex;
+    std::string directory;
+    uint64_t maxBytes;
+    uint64_t bytes;
+    uint64_t nextFile;
+    int64_t useCounter;
+    bool dirty;
+    std::map<std::string, Entry> entries;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_DISKCACHE_H_
@@ -0,0 +1,496 @@
+/**
+ * @file download.cpp
+ * @brief implementation of the file downloads
+ */
+
+#include "download.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "connection.h"
+#include "connectionpool.h"
+#include "helpers.h"
+#include "multiclient.h"
+#include "version.h"
+
+namespace {
+
+const char PART_SUFFIX[] = ".part";
+const char META_SUFFIX[] = ".part.meta";
+const char META_MAGIC[] = "restclient-download-1";
+
+/** @struct Segment
+  *  @brief a byte range of the file
+  *  @var Segment::start
+  *  Member 'start' contains the first byte of the range
+  *  @var Segment::end
+  *  Member 'end' contains the last byte of the range, -1 if the size is
+  *  unknown
+  *  @var Segment::next
+  *  Member 'next' contains the first byte not yet on disk
+  */
+typedef struct {
+  int64_t start;
+  int64_t end;
+  int64_t next;
+} Segment;
+
+/** @struct State
+  *  @brief what is kept in the meta file to resume a download
+  */
+typedef struct {
+  std::string url;
+  std::string validator;
+  int64_t total;
+  std::vector<Segment> segments;
+} State;
+
+bool load_state(const std::string& file, State* state) {
+  std::ifstream in(file.c_str());
+  std::string magic;
+  if (!std::getline(in, magic) || magic != META_MAGIC ||
+      !std::getline(in, state->url) || !std::getline(in, state->validator) ||
+      !(in >> state->total)) {
+    return false;
+  }
+  state->segments.clear();
+  Segment segment;
+  while (in >> segment.start >> segment.end >> segment.next) {
+    if (segment.next < segment.start ||
+        (segment.end >= 0 && segment.next > segment.end + 1)) {
+      return false;
+    }
+    state->segments.push_back(segment);
+  }
+  return !state->segments.empty();
+}
+
+bool save_state(const std::string& file, const State& state) {
+  std::ofstream out(file.c_str(), std::ios::trunc);
+  out << META_MAGIC << "\n" << state.url << "\n" << state.validator << "\n"
+      << state.total << "\n";
+  for (size_t i = 0; i < state.segments.size(); ++i) {
+    const Segment& segment = state.segments[i];
+    out << segment.start << " " << segment.end << " " << segment.next << "\n";
+  }
+  out.flush();
+  return static_cast<bool>(out);
+}
+
+bool file_exists(const std::string& path) {
+#if defined(_WIN32)
+  return GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+#endif
+}
+
+/**
+  * @brief the part file, written at arbitrary offsets so segments can land
+  * in any order
+  */
+class PartFile {
+ public:
+#if defined(_WIN32)
+    PartFile() : handle(INVALID_HANDLE_VALUE) {}
+#else
+    PartFile() : fd(-1) {}
+#endif
+    ~PartFile() { this->Close(); }
+
+    bool Open(const std::string& path, bool truncate) {
+#if defined(_WIN32)
+      this->handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ, NULL,
+                                 truncate ? CREATE_ALWAYS : OPEN_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, NULL);
+      return this->handle != INVALID_HANDLE_VALUE;
+#else
+      this->fd = open(path.c_str(),
+                      O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+      return this->fd >= 0;
+#endif
+    }
+
+    // reserve size bytes on disk, false if there is no room for them
+    bool Preallocate(int64_t size) {
+#if defined(_WIN32)
+      LARGE_INTEGER end;
+      end.QuadPart = size;
+      return SetFilePointerEx(this->handle, end, NULL, FILE_BEGIN) &&
+             SetEndOfFile(this->handle);
+#elif defined(__APPLE__)
+      fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size, 0};
+      if (fcntl(this->fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(this->fd, F_PREALLOCATE, &store) == -1) {
+          return false;
+        }
+      }
+      return ftruncate(this->fd, size) == 0;
+#else
+      if (fallocate(this->fd, 0, 0, size) == 0) {
+        return true;
+      }
+      // file systems without fallocate get it emulated
+      return (errno == EOPNOTSUPP || errno == ENOSYS) &&
+             posix_fallocate(this->fd, 0, size) == 0;
+#endif
+    }
+
+    bool WriteAt(const char* data, size_t length, int64_t offset) {
+      while (length > 0) {
+#if defined(_WIN32)
+        OVERLAPPED at;
+        std::memset(&at, 0, sizeof(at));
+        at.Offset = static_cast<DWORD>(offset & 0xffffffff);
+        at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        DWORD chunk = length > 0x40000000 ? 0x40000000
+                                          : static_cast<DWORD>(length);
+        if (!WriteFile(this->handle, data, chunk, &written, &at)) {
+          return false;
+        }
+#else
+        ssize_t written = pwrite(this->fd, data, length, offset);
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return false;
+        }
+#endif
+        data += written;
+        length -= written;
+        offset += written;
+      }
+      return true;
+    }
+
+    // flush to disk, so the rename that follows never exposes lost data
+    bool Sync() {
+#if defined(_WIN32)
+      return FlushFileBuffers(this->handle) != 0;
+#else
+      return fsync(this->fd) == 0;
+#endif
+    }
+
+    void Close() {
+#if defined(_WIN32)
+      if (this->handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->handle);
+        this->handle = INVALID_HANDLE_VALUE;
+      }
+#else
+      if (this->fd >= 0) {
+        close(this->fd);
+        this->fd = -1;
+      }
+#endif
+    }
+
+ private:
+#if defined(_WIN32)
+    HANDLE handle;
+#else
+    int fd;
+#endif
+};
+
+bool replace_file(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+RestClient::Response local_error(const std::string& message) {
+  RestClient::Response response = RestClient::Response();
+  response.code = -1;
+  response.body = message;
+  return response;
+}
+
+// first byte of a "bytes first-last/total" Content-Range, -1 if missing
+int64_t range_start(const RestClient::Response& response, int64_t* total) {
+  const std::string* range =
+    RestClient::Helpers::find_header(response.headers, "Content-Range");
+  if (!range || range->compare(0, 6, "bytes ") != 0 || range->size() < 7 ||
+      !std::isdigit(static_cast<unsigned char>((*range)[6]))) {
+    return -1;
+  }
+  if (total) {
+    size_t slash = range->find('/');
+    *total = slash == std::string::npos || (*range)[slash + 1] == '*'
+             ? -1 : std::strtoll(range->c_str() + slash + 1, NULL, 10);
+  }
+  return std::strtoll(range->c_str() + 6, NULL, 10);
+}
+
+/**
+ * @brief ask for the first byte to learn the size, the validator and
+ * whether ranges work. A server ignoring the range would send the whole
+ * body, that is cut off after the first chunk.
+ */
+RestClient::Response probe(const std::string& url,
+                           const RestClient::DownloadOptions& options,
+                           bool* ranges, int64_t* total,
+                           std::string* validator) {
+  RestClient::Connection* conn =
+    RestClient::ConnectionPool::instance().checkout(url);
+  conn->SetHeaders(options.headers);
+  conn->AppendHeader("Range", "bytes=0-0");
+  conn->SetDeadlines(options.deadlines);
+  conn->SetCancelFlag(options.cancel);
+  conn->FollowRedirects(true, 10);
+  size_t received = 0;
+  conn->SetWriteSink([&received](const char*, size_t length) {
+    received += length;
+    return received > 1 ? RestClient::SINK_ABORT : RestClient::SINK_CONTINUE;
+  });
+  RestClient::Response response = conn->get(url);
+  RestClient::ConnectionPool::instance().checkin(url, conn);
+
+  // a body cut off after the first chunk failed the transfer, not the
+  // request
+  int status = response.timing.responseCode;
+  if (response.code < 100 && (received <= 1 || status < 200)) {
+    return response;
+  }
+  response.code = status;
+  *ranges = status == 206 && range_start(response, total) == 0 &&
+            *total > 0;
+  if (!*ranges) {
+    // the server sent the whole body; 416 is what an empty file gets
+    const std::string* length =
+      RestClient::Helpers::find_header(response.headers, "Content-Length");
+    *total = status == 416 ? 0
+             : length ? std::strtoll(length->c_str(), NULL, 10) : -1;
+    response.code = status == 416 ? 200 : status;
+  }
+  // weak ETags must not be used with If-Range
+  const std::string* etag =
+    RestClient::Helpers::find_header(response.headers, "ETag");
+  const std::string* modified =
+    RestClient::Helpers::find_header(response.headers, "Last-Modified");
+  *validator = etag && etag->compare(0, 2, "W/") != 0 ? *etag
+               : modified ? *modified : std::string();
+  return response;
+}
+
+// split total bytes into at most count segments of at least minSize
+std::vector<Segment> plan_segments(int64_t total, int count,
+                                   int64_t minSize) {
+  std::vector<Segment> segments;
+  int64_t n = count < 1 ? 1 : count;
+  if (minSize > 0 && total / minSize < n) {
+    n = total / minSize < 1 ? 1 : total / minSize;
+  }
+  int64_t size = total / n;
+  for (int64_t i = 0; i < n; ++i) {
+    Segment segment;
+    segment.start = i * size;
+    segment.end = i == n - 1 ? total - 1 : (i + 1) * size - 1;
+    segment.next = segment.start;
+    segments.push_back(segment);
+  }
+  return segments;
+}
+
+}  // namespace
+
+RestClient::Response RestClient::downloadFile(
+    const std::string& url, const std::string& path,
+    const RestClient::DownloadOptions& options) {
+  std::string part = path + PART_SUFFIX;
+  std::string meta = path + META_SUFFIX;
+  bool ranges = false;
+  int64_t total = -1;
+  std::string validator;
+  RestClient::Response head = probe(url, options, &ranges, &total,
+                                    &validator);
+  if (head.code < 200 || head.code >= 300) {
+    return head;
+  }
+  // requests below go to where the redirects ended
+  std::string target = head.timing.effectiveUrl.empty()
+                       ? url : head.timing.effectiveUrl;
+
+  State state;
+  bool resuming = options.resume && ranges && !validator.empty() &&
+                  file_exists(part) && load_state(meta, &state) &&
+                  state.url == url && state.validator == validator &&
+                  state.total == total;
+  int attempts = options.retry ? options.retry->MaxAttempts() : 1;
+  bool restarted = false;
+  for (int attempt = 1; ; ++attempt) {
+    if (!resuming) {
+      state.url = url;
+      state.validator = validator;
+      state.total = total;
+      if (ranges) {
+        state.segments = plan_segments(total, options.segments,
+                                       options.minSegmentSize);
+      } else {
+        Segment whole = {0, total > 0 ? total - 1 : -1, 0};
+        state.segments.assign(1, whole);
+      }
+      std::remove(meta.c_str());
+    }
+
+    PartFile file;
+    if (!file.Open(part, !resuming)) {
+      return local_error("Cannot write " + part + ".");
+    }
+    if (!resuming && total > 0 && !file.Preallocate(total)) {
+      file.Close();
+      std::remove(part.c_str());
+      return local_error("Not enough space for " + path + ".");
+    }
+
+    // bytes written per segment in this attempt, only the loop thread
+    // touches them while the requests run
+    std::vector<int64_t> written(state.segments.size(), 0);
+    std::vector<char> overflow(state.segments.size(), 0);
+    std::vector<char> failed(state.segments.size(), 0);
+    int64_t received = 0;
+    for (size_t i = 0; i < state.segments.size(); ++i) {
+      received += state.segments[i].next - state.segments[i].start;
+    }
+
+    std::vector<RestClient::Request> requests;
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < state.segments.size(); ++i) {
+      const Segment& segment = state.segments[i];
+      if (segment.end >= 0 && segment.next > segment.end) {
+        continue;
+      }
+      RestClient::Request request;
+      request.method = "GET";
+      request.url = target;
+      request.headers = options.headers;
+      if (ranges) {
+        request.headers["Range"] = "bytes=" + std::to_string(segment.next) +
+                                   "-" + std::to_string(segment.end);
+        request.headers["If-Range"] = validator;
+      }
+      request.timeout = 0;
+      request.deadlines = options.deadlines;
+      // one connection per segment is what makes them faster
+      request.http2 = false;
+      request.retry = options.retry;
+      request.cancel = options.cancel;
+      request.uploadSize = -1;
+      request.sink = [&, i](const char* data, size_t length) {
+        const Segment& segment = state.segments[i];
+        int64_t at = segment.next + written[i];
+        // a server ignoring the range sends more than was asked for
+        if (segment.end >= 0 &&
+            at + static_cast<int64_t>(length) > segment.end + 1) {
+          overflow[i] = 1;
+          return RestClient::SINK_ABORT;
+        }
+        if (!file.WriteAt(data, length, at)) {
+          failed[i] = 1;
+          return RestClient::SINK_ABORT;
+        }
+        written[i] += length;
+        received += length;
+        if (options.progress) {
+          options.progress(received, total);
+        }
+        return RestClient::SINK_CONTINUE;
+      };
+      requests.push_back(request);
+      indexes.push_back(i);
+    }
+    std::vector<RestClient::Response> responses =
+      RestClient::MultiClient::instance().Perform(requests);
+
+    RestClient::Response failure = RestClient::Response();
+    bool complete = true;
+    bool progressed = false;
+    bool changed = false;
+    for (size_t k = 0; k < indexes.size(); ++k) {
+      size_t i = indexes[k];
+      Segment& segment = state.segments[i];
+      const RestClient::Response& response = responses[k];
+      if (failed[i]) {
+        return local_error("Cannot write " + part + ".");
+      }
+      // keep what arrived of the requested range, even from a transfer
+      // that broke off
+      bool rangeOk = ranges && range_start(response, NULL) == segment.next;
+      bool wholeOk = !ranges && response.code >= 200 && response.code < 300;
+      if (overflow[i] || (ranges && response.code == 200)) {
+        changed = true;
+      } else if (rangeOk || wholeOk) {
+        segment.next += written[i];
+        progressed = progressed || written[i] > 0;
+      }
+      bool done = segment.end >= 0 ? segment.next > segment.end
+                                   : wholeOk;
+      if (!done) {
+        complete = false;
+        if (failure.code == 0 || failure.code == 206 || failure.code == 200) {
+          failure = response;
+        }
+      }
+    }
+
+    if (complete) {
+      bool ok = file.Sync();
+      file.Close();
+      if (!ok || !replace_file(part, path)) {
+        return local_error("Cannot write " + path + ".");
+      }
+      std::remove(meta.c_str());
+      head.code = 200;
+      head.body.clear();
+      return head;
+    }
+    file.Close();
+
+    // the file changed on the server, or it ignores ranges after all
+    if (changed && !restarted) {
+      restarted = true;
+      resuming = false;
+      continue;
+    }
+    bool cancelled = options.cancel && options.cancel->load();
+    if (ranges && !changed) {
+      save_state(meta, state);
+    } else {
+      std::remove(part.c_str());
+    }
+    if (cancelled || changed || !ranges || !progressed ||
+        attempt >= attempts) {
+      if (failure.code == 0 || failure.code == 206 || failure.code == 200) {
+        failure = local_error("Download incomplete.");
+      }
+      return failure;
+    }
+    // segments that broke off after making progress continue right away
+    resuming = true;
+  }
+}
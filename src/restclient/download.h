@@ -0,0 +1,92 @@
+/**
+ * @file download.h
+ * @brief resumable, optionally segmented downloads straight to a file
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_DOWNLOAD_H_
+#define INCLUDE_RESTCLIENT_CPP_DOWNLOAD_H_
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "restclient.h"
+#include "retrypolicy.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief gets told how many bytes of a download are on disk and the size
+  * of the file, -1 if unknown
+  */
+typedef std::function<void(int64_t received, int64_t total)>
+  DownloadProgress;
+
+/** @struct DownloadOptions
+  *  @brief how downloadFile() fetches a file
+  *  @var DownloadOptions::headers
+  *  Member 'headers' contains the request headers
+  *  @var DownloadOptions::deadlines
+  *  Member 'deadlines' contains the deadlines of each single request; a
+  *  totalMs limits every segment, not the whole download
+  *  @var DownloadOptions::segments
+  *  Member 'segments' contains how many range requests may run at once,
+  *  each on its own connection. 1 downloads in one piece.
+  *  @var DownloadOptions::minSegmentSize
+  *  Member 'minSegmentSize' contains the smallest segment worth a
+  *  connection of its own, smaller files use fewer segments
+  *  @var DownloadOptions::resume
+  *  Member 'resume' continues from what an earlier, failed download of the
+  *  same URL to the same path left behind
+  *  @var DownloadOptions::retry
+  *  Member 'retry' optionally retries failed requests; segments that failed
+  *  after receiving data continue where they stopped. NULL for none.
+  *  @var DownloadOptions::cancel
+  *  Member 'cancel' optionally aborts the download once set, see
+  *  MultiClient::Cancel()
+  *  @var DownloadOptions::progress
+  *  Member 'progress' is optionally told about the bytes written, on the
+  *  MultiClient event loop thread
+  */
+typedef struct {
+  HeaderFields headers;
+  Deadlines deadlines;
+  int segments;
+  int64_t minSegmentSize;
+  bool resume;
+  std::shared_ptr<const RetryPolicy> retry;
+  CancelFlag cancel;
+  DownloadProgress progress;
+} DownloadOptions;
+
+/**
+  * @brief download url into the file at path, blocking until done.
+  *
+  * The body is written to path + ".part" as it arrives and renamed to path
+  * once complete, so path never holds half a file. A range request for the
+  * first byte finds out the size, whether the server takes ranges and the
+  * ETag or Last-Modified of the file. The part file is then preallocated to
+  * the full size, which fails early if the disk is full and keeps the file
+  * from fragmenting.
+  *
+  * If the server takes ranges, large files are split into up to
+  * options.segments ranges fetched in parallel by the MultiClient.
+  * Progress of unfinished segments is kept in path + ".part.meta" when the
+  * download fails or is cancelled; with options.resume a later call sends
+  * If-Range so it only continues if the file on the server is unchanged,
+  * and starts over otherwise.
+  *
+  * Returns code 200 and the headers of the probe once path is complete,
+  * otherwise the response that failed, or -1 if the file could not be
+  * written.
+  */
+Response downloadFile(const std::string& url, const std::string& path,
+                      const DownloadOptions& options);
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_DOWNLOAD_H_
@@ -6,57 +6,115 @@
 
 #include "helpers.h"
 
+#include <curl/curl.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 
 #include "restclient.h"
 
 /**
- * @brief write callback function for libcurl
+ * @brief write callback function for libcurl. With CURLOPT_ACCEPT_ENCODING
+ * set, libcurl decodes each chunk before it gets here, so a compressed body
+ * never has to be held in full.
  *
  * @param data returned data of size (size*nmemb)
  * @param size size parameter
  * @param nmemb memblock parameter
- * @param userdata pointer to user data to save/work with return data
+ * @param userdata pointer to the WriteObject of the transfer
  *
- * @return (size * nmemb)
+ * @return (size * nmemb), 0 to abort or CURL_WRITEFUNC_PAUSE
  */
 size_t RestClient::Helpers::write_callback(void *data, size_t size,
                                            size_t nmemb, void *userdata) {
-  RestClient::Response* r;
-  r = reinterpret_cast<RestClient::Response*>(userdata);
-  r->body.append(reinterpret_cast<char*>(data), size*nmemb);
+  RestClient::Helpers::WriteObject* w;
+  w = reinterpret_cast<RestClient::Helpers::WriteObject*>(userdata);
+  if (w->sink) {
+    switch ((*w->sink)(reinterpret_cast<char*>(data), size*nmemb)) {
+      case RestClient::SINK_PAUSE:
+        return CURL_WRITEFUNC_PAUSE;
+      case RestClient::SINK_ABORT:
+        return 0;
+      default:
+        w->decodedSize += size * nmemb;
+        return (size * nmemb);
+    }
+  }
+  w->body->append(reinterpret_cast<char*>(data), size*nmemb);
+  w->decodedSize += size * nmemb;
 
   return (size * nmemb);
 }
 
+namespace {
+
+// shrink [begin, end) to exclude leading and trailing white space
+void trim_range(const char** begin, const char** end) {
+  while (*begin < *end && std::isspace(static_cast<unsigned char>(**begin))) {
+    ++*begin;
+  }
+  while (*end > *begin &&
+         std::isspace(static_cast<unsigned char>(*(*end - 1)))) {
+    --*end;
+  }
+}
+
+// case insensitive comparison of [begin, end) with a lower case literal
+bool equals_lower(const char* begin, const char* end, const char* lower) {
+  for (; begin < end; ++begin, ++lower) {
+    if (*lower == '\0' ||
+        std::tolower(static_cast<unsigned char>(*begin)) != *lower) {
+      return false;
+    }
+  }
+  return *lower == '\0';
+}
+
+}  // namespace
+
 /**
- * @brief header callback for libcurl
+ * @brief header callback for libcurl. Key and value are built straight from
+ * the header line without intermediate copies. A Content-Length header
+ * reserves the body buffer once, so the body is not reallocated while it
+ * arrives.
  *
  * @param data returned (header line)
  * @param size of data
  * @param nmemb memblock
- * @param userdata pointer to user data object to save headr data
+ * @param userdata pointer to the WriteObject of the transfer
  * @return size * nmemb;
  */
 size_t RestClient::Helpers::header_callback(void *data, size_t size,
                                             size_t nmemb, void *userdata) {
-  RestClient::Response* r;
-  r = reinterpret_cast<RestClient::Response*>(userdata);
-  std::string header(reinterpret_cast<char*>(data), size*nmemb);
-  size_t seperator = header.find_first_of(':');
-  if ( std::string::npos == seperator ) {
+  RestClient::Helpers::WriteObject* w;
+  w = reinterpret_cast<RestClient::Helpers::WriteObject*>(userdata);
+  const char* begin = reinterpret_cast<char*>(data);
+  const char* end = begin + size*nmemb;
+  const char* seperator = reinterpret_cast<const char*>(
+      std::memchr(begin, ':', size*nmemb));
+  if ( NULL == seperator ) {
     // roll with non seperated headers...
-    trim(header);
-    if (0 == header.length()) {
+    trim_range(&begin, &end);
+    if (begin == end) {
       return (size * nmemb);  // blank line;
     }
-    r->headers[header] = "present";
+    w->response->headers[std::string(begin, end)] = "present";
   } else {
-    std::string key = header.substr(0, seperator);
-    trim(key);
-    std::string value = header.substr(seperator + 1);
-    trim(value);
-    r->headers[key] = value;
+    const char* keyEnd = seperator;
+    const char* valueBegin = seperator + 1;
+    trim_range(&begin, &keyEnd);
+    trim_range(&valueBegin, &end);
+    if (w->expectBody && !w->sink &&
+        equals_lower(begin, keyEnd, "content-length")) {
+      unsigned long long length = std::strtoull(valueBegin, NULL, 10);
+      if (length > 0 && length <= MAX_BODY_RESERVE) {
+        w->body->reserve(w->body->size() + static_cast<size_t>(length));
+      }
+    }
+    w->response->headers[std::string(begin, keyEnd)].assign(valueBegin, end);
   }
 
   return (size * nmemb);
@@ -88,3 +146,227 @@ size_t RestClient::Helpers::read_callback(void *data, size_t size,
   /** return copied size */
   return copy_size;
 }
+
+/**
+ * @brief read callback function for libcurl that asks a ChunkSource for the
+ * next part of the body. The source writes straight into libcurl's upload
+ * buffer, so the body is never held in full.
+ *
+ * @param data pointer of max size (size*nmemb) to write data to
+ * @param size size parameter
+ * @param nmemb memblock parameter
+ * @param userdata pointer to the RestClient::ChunkSource
+ *
+ * @return number of bytes written, CURL_READFUNC_PAUSE or
+ * CURL_READFUNC_ABORT
+ */
+size_t RestClient::Helpers::source_callback(char *data, size_t size,
+                                            size_t nmemb, void *userdata) {
+  RestClient::ChunkSource* source;
+  source = reinterpret_cast<RestClient::ChunkSource*>(userdata);
+  size_t curl_size = size * nmemb;
+  int64_t written = (*source)(data, curl_size);
+  if (written == RestClient::SOURCE_PAUSE) {
+    return CURL_READFUNC_PAUSE;
+  }
+  if (written < 0 || static_cast<uint64_t>(written) > curl_size) {
+    return CURL_READFUNC_ABORT;
+  }
+  return static_cast<size_t>(written);
+}
+
+/**
+ * @brief xferinfo callback for libcurl, called at least once a second while
+ * a transfer runs and whenever data moves
+ *
+ * @param userdata pointer to the ProgressObject of the transfer
+ * @param dltotal bytes expected to be downloaded, unused
+ * @param dlnow bytes of the response body received so far
+ * @param ultotal bytes expected to be uploaded, 0 if unknown
+ * @param ulnow bytes uploaded so far
+ *
+ * @return 0 to continue, 1 to abort with CURLE_ABORTED_BY_CALLBACK
+ */
+int RestClient::Helpers::progress_callback(void *userdata,
+                                           curl_off_t dltotal,
+                                           curl_off_t dlnow,
+                                           curl_off_t ultotal,
+                                           curl_off_t ulnow) {
+  RestClient::Helpers::ProgressObject* p;
+  p = reinterpret_cast<RestClient::Helpers::ProgressObject*>(userdata);
+  if (p->cancelled && p->cancelled->load()) {
+    return 1;
+  }
+  if (ulnow != p->uploaded) {
+    p->uploaded = ulnow;
+    if (p->upload) {
+      (*p->upload)(ulnow, ultotal > 0 ? ultotal : -1);
+    }
+    // the server cannot be expected to answer before the body is sent, so
+    // the time to the first byte counts from the last byte uploaded
+    p->started = std::chrono::steady_clock::now();
+  }
+  if (p->firstByteMs > 0 && dlnow == 0) {
+    // CURLINFO_STARTTRANSFER_TIME is also set once an upload starts, the
+    // header byte count only grows with what the server sent
+    long headerBytes = 0;
+    curl_easy_getinfo(p->handle, CURLINFO_HEADER_SIZE, &headerBytes);
+    if (headerBytes == 0) {
+      // CURLINFO_TOTAL_TIME is only updated now and then during a transfer
+      int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - p->started).count();
+      if (elapsed >= p->firstByteMs) {
+        p->timedOut = true;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief get the origin of a URL as lower case scheme://host:port with the
+ * default port filled in, so that equivalent URLs map to the same key
+ *
+ * @param url absolute URL
+ *
+ * @return origin string
+ */
+std::string RestClient::Helpers::origin(const std::string& url) {
+  std::string scheme = "http";
+  size_t hostStart = 0;
+  size_t schemeEnd = url.find("://");
+  if (schemeEnd != std::string::npos) {
+    scheme = url.substr(0, schemeEnd);
+    hostStart = schemeEnd + 3;
+  }
+  size_t hostEnd = url.find_first_of("/?#", hostStart);
+  std::string authority = url.substr(hostStart, hostEnd == std::string::npos ?
+                                     std::string::npos : hostEnd - hostStart);
+  // drop user info
+  size_t at = authority.rfind('@');
+  if (at != std::string::npos) {
+    authority = authority.substr(at + 1);
+  }
+  std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+  std::transform(authority.begin(), authority.end(), authority.begin(),
+                 ::tolower);
+  // a colon after the closing bracket of an IPv6 literal starts the port
+  size_t bracket = authority.rfind(']');
+  size_t colon = authority.rfind(':');
+  if (colon == std::string::npos ||
+      (bracket != std::string::npos && colon < bracket)) {
+    authority += (scheme == "https") ? ":443" : ":80";
+  }
+  return scheme + "://" + authority;
+}
+
+/**
+ * @brief look up a header regardless of the case the server sent it in
+ *
+ * @param headers to search
+ * @param name of the header
+ *
+ * @return pointer to the value, NULL if the header is not present
+ */
+const std::string* RestClient::Helpers::find_header(
+    const RestClient::HeaderFields& headers, const std::string& name) {
+  RestClient::HeaderFields::const_iterator it = headers.find(name);
+  if (it != headers.end()) {
+    return &it->second;
+  }
+  for (it = headers.begin(); it != headers.end(); ++it) {
+    if (it->first.size() == name.size() &&
+        std::equal(name.begin(), name.end(), it->first.begin(),
+                   [](char a, char b) {
+                     return std::tolower(static_cast<unsigned char>(a)) ==
+                            std::tolower(static_cast<unsigned char>(b));
+                   })) {
+      return &it->second;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief get a readable name for the HTTP version a transfer used
+ *
+ * @param version CURLINFO_HTTP_VERSION value
+ *
+ * @return "1.0", "1.1", "2", "3" or empty if unknown
+ */
+std::string RestClient::Helpers::http_version_name(
+    long version) {  // NOLINT(runtime/int)
+  switch (version) {
+    case CURL_HTTP_VERSION_1_0:
+      return "1.0";
+    case CURL_HTTP_VERSION_1_1:
+      return "1.1";
+    case CURL_HTTP_VERSION_2_0:
+      return "2";
+    case CURL_HTTP_VERSION_3:
+      return "3";
+    default:
+      return "";
+  }
+}
+
+/**
+ * @brief make a ChunkSource handing out a block of memory. Nothing is
+ * copied up front, each chunk goes straight from data into libcurl's upload
+ * buffer.
+ *
+ * @param data body to send, has to stay valid until the request finished
+ * @param length of data
+ *
+ * @return source for Connection::SetUploadSource
+ */
+RestClient::ChunkSource RestClient::Helpers::buffer_source(const char* data,
+                                                           size_t length) {
+  std::shared_ptr<size_t> offset = std::make_shared<size_t>(0);
+  return [data, length, offset](char* buffer, size_t size) -> int64_t {
+    size_t n = length - *offset < size ? length - *offset : size;
+    std::memcpy(buffer, data + *offset, n);
+    *offset += n;
+    return static_cast<int64_t>(n);
+  };
+}
+
+/**
+ * @brief make a ChunkSource reading a file. Each chunk is read straight
+ * into libcurl's upload buffer, so memory use does not depend on the size
+ * of the file. The file is closed once the source is destroyed.
+ *
+ * @param path of the file
+ * @param size receives the size of the file, -1 if it cannot be opened
+ *
+ * @return source for Connection::SetUploadSource, empty if the file cannot
+ * be opened
+ */
+RestClient::ChunkSource RestClient::Helpers::file_source(
+    const std::string& path, int64_t* size) {
+  *size = -1;
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    return nullptr;
+  }
+  std::shared_ptr<FILE> file(f, std::fclose);
+#if defined(_WIN32)
+  if (_fseeki64(f, 0, SEEK_END) == 0) {
+    *size = _ftelli64(f);
+    _fseeki64(f, 0, SEEK_SET);
+  }
+#else
+  if (fseeko(f, 0, SEEK_END) == 0) {
+    *size = ftello(f);
+    fseeko(f, 0, SEEK_SET);
+  }
+#endif
+  return [file](char* buffer, size_t size) -> int64_t {
+    size_t n = std::fread(buffer, 1, size, file.get());
+    if (n == 0 && std::ferror(file.get())) {
+      return RestClient::SOURCE_ABORT;
+    }
+    return static_cast<int64_t>(n);
+  };
+}
@@ -9,11 +9,15 @@
 #ifndef INCLUDE_RESTCLIENT_CPP_HELPERS_H_
 #define INCLUDE_RESTCLIENT_CPP_HELPERS_H_
 
+#include <curl/curl.h>
 #include <string>
 #include <cctype>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <functional>
 
+#include "restclient.h"
 #include "version.h"
 
 /**
@@ -39,6 +43,69 @@ namespace Helpers {
     size_t length;
   } UploadObject;
 
+  /** @struct WriteObject
+    *  @brief This structure tells the write and header callbacks where the
+    *  response goes
+    *  @var WriteObject::response
+    *  Member 'response' contains the response to store the headers in
+    *  @var WriteObject::body
+    *  Member 'body' contains the string the body is appended to, either
+    *  response->body or a buffer provided by the caller
+    *  @var WriteObject::sink
+    *  Member 'sink' contains an optional chunk sink that gets the body
+    *  instead of the body string
+    *  @var WriteObject::expectBody
+    *  Member 'expectBody' is false for requests without a response body
+    *  (HEAD), where Content-Length must not be used to size the buffer
+    *  @var WriteObject::decodedSize
+    *  Member 'decodedSize' counts the body bytes handed over after content
+    *  decoding
+    */
+  typedef struct {
+    RestClient::Response* response;
+    std::string* body;
+    const RestClient::ChunkSink* sink;
+    bool expectBody;
+    uint64_t decodedSize;
+  } WriteObject;
+
+  /** @struct ProgressObject
+    *  @brief This structure tells the progress callback when to stop a
+    *  transfer early
+    *  @var ProgressObject::handle
+    *  Member 'handle' contains the curl handle of the transfer
+    *  @var ProgressObject::cancelled
+    *  Member 'cancelled' contains a flag that aborts the transfer once set,
+    *  may be NULL
+    *  @var ProgressObject::firstByteMs
+    *  Member 'firstByteMs' contains the time allowed until the first
+    *  response byte, 0 for no limit
+    *  @var ProgressObject::started
+    *  Member 'started' contains when the transfer began
+    *  @var ProgressObject::timedOut
+    *  Member 'timedOut' is set when the transfer was stopped for missing
+    *  firstByteMs
+    *  @var ProgressObject::upload
+    *  Member 'upload' contains the function told about upload progress,
+    *  may be NULL
+    *  @var ProgressObject::uploaded
+    *  Member 'uploaded' contains the byte count of the last progress call
+    */
+  typedef struct {
+    CURL* handle;
+    const std::atomic<bool>* cancelled;
+    int firstByteMs;
+    std::chrono::steady_clock::time_point started;
+    bool timedOut;
+    const RestClient::UploadProgress* upload;
+    curl_off_t uploaded;
+  } ProgressObject;
+
+  // largest Content-Length the body buffer is reserved for up front. Bigger
+  // bodies grow as they arrive, so a bogus or hostile header costs at most
+  // this much per transfer and reserve() cannot throw out of a curl callback
+  const size_t MAX_BODY_RESERVE = 8 * 1024 * 1024;
+
   // writedata callback function
   size_t write_callback(void *ptr, size_t size, size_t nmemb,
                               void *userdata);
@@ -50,17 +117,44 @@ namespace Helpers {
   size_t read_callback(void *ptr, size_t size, size_t nmemb,
                               void *userdata);
 
+  // read callback function pulling the body from a ChunkSource
+  size_t source_callback(char *ptr, size_t size, size_t nmemb,
+                         void *userdata);
+
+  // xferinfo callback function, aborts cancelled and late transfers and
+  // reports upload progress
+  int progress_callback(void *userdata, curl_off_t dltotal,
+                        curl_off_t dlnow, curl_off_t ultotal,
+                        curl_off_t ulnow);
+
+  // scheme://host:port of a URL, used to key per origin state
+  std::string origin(const std::string& url);
+
+  // value of a header looked up case insensitively, NULL if not present
+  const std::string* find_header(const RestClient::HeaderFields& headers,
+                                 const std::string& name);
+
+  // "1.0", "1.1", "2" or "3" for a CURLINFO_HTTP_VERSION value
+  std::string http_version_name(long version);  // NOLINT(runtime/int)
+
+  // ChunkSource over memory that has to stay valid until the upload ended
+  RestClient::ChunkSource buffer_source(const char* data, size_t length);
+
+  // ChunkSource reading a file as the upload goes, empty if it cannot be
+  // opened. size receives the file size.
+  RestClient::ChunkSource file_source(const std::string& path, int64_t* size);
+
   // trim from start
   static inline std::string &ltrim(std::string &s) {  // NOLINT
     s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-          std::not1(std::ptr_fun<int, int>(std::isspace))));
+          [](unsigned char c) { return !std::isspace(c); }));
     return s;
   }
 
   // trim from end
   static inline std::string &rtrim(std::string &s) { // NOLINT
     s.erase(std::find_if(s.rbegin(), s.rend(),
-          std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
+          [](unsigned char c) { return !std::isspace(c); }).base(), s.end());
     return s;
   }
 
@@ -0,0 +1,325 @@
+/**
+ * @file httplibbackend.cpp
+ * @brief implementation of the cpp-httplib backend
+ */
+
+#include "httplibbackend.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../httplib.h"
+#include "helpers.h"
+#include "version.h"
+
+namespace {
+
+// stands in for "wait forever", httplib has no such timeout
+const int kNoTimeoutMs = 24 * 60 * 60 * 1000;
+
+// same as CURLOPT_CONNECTTIMEOUT_MS when it is not set
+const int kDefaultConnectTimeoutMs = 300 * 1000;
+
+/**
+ * @brief get the part of url a request line carries
+ *
+ * @param url absolute URL
+ *
+ * @return path and query without the fragment, at least "/"
+ */
+std::string request_path(const std::string& url) {
+  size_t hostStart = url.find("://");
+  hostStart = hostStart == std::string::npos ? 0 : hostStart + 3;
+  size_t pathStart = url.find_first_of("/?#", hostStart);
+  if (pathStart == std::string::npos) {
+    return "/";
+  }
+  std::string path = url.substr(pathStart, url.find('#', pathStart) -
+                                           pathStart);
+  if (path.empty() || path[0] != '/') {
+    path.insert(0, "/");
+  }
+  return path;
+}
+
+/**
+ * @brief milliseconds elapsed since start
+ */
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+/**
+ * @brief constructor for the HttplibBackend object
+ *
+ * @param maxPerHost - maximum number of idle clients kept per origin
+ * @param idleTimeoutSeconds - seconds an idle client is kept
+ */
+RestClient::HttplibBackend::HttplibBackend(size_t maxPerHost,
+                                           int idleTimeoutSeconds)
+                               : idle() {
+  this->maxPerHost = maxPerHost;
+  this->idleTimeout = idleTimeoutSeconds;
+}
+
+RestClient::HttplibBackend::~HttplibBackend() {
+  this->Clear();
+}
+
+/**
+ * @brief get the instance shared by the whole process. Never destroyed, so
+ * it is still usable from threads that outlive static destruction.
+ *
+ * @return httplib backend instance
+ */
+RestClient::HttplibBackend&
+RestClient::HttplibBackend::instance() {
+  static RestClient::HttplibBackend* backend = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    backend = new RestClient::HttplibBackend(6, 60);
+  });
+  return *backend;
+}
+
+/**
+ * @brief get the name of the backend
+ *
+ * @return "httplib"
+ */
+const char*
+RestClient::HttplibBackend::Name() const {
+  return "httplib";
+}
+
+/**
+ * @brief check whether url can be fetched by cpp-httplib as built
+ *
+ * @param url to query
+ *
+ * @return true for http URLs, and https ones with OpenSSL support
+ */
+bool
+RestClient::HttplibBackend::Supports(const std::string& url) const {
+  std::string origin = Helpers::origin(url);
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+  if (origin.compare(0, 8, "https://") == 0) {
+    return true;
+  }
+#endif
+  return origin.compare(0, 7, "http://") == 0;
+}
+
+/**
+ * @brief HTTP GET on a pooled keep-alive client. The cancel flag is checked
+ * as the response arrives, so a request still waiting for the server is
+ * only ended by its deadlines.
+ *
+ * @param url to query
+ * @param headers sent with the request
+ * @param deadlines for connecting, the first byte and the whole request
+ * @param cancel aborts the request once set, NULL for none
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::HttplibBackend::get(const std::string& url,
+                                const RestClient::HeaderFields& headers,
+                                const RestClient::Deadlines& deadlines,
+                                const RestClient::CancelFlag& cancel) {
+  RestClient::Response ret = RestClient::Response();
+  ret.timing.effectiveUrl = url;
+  if (!this->Supports(url)) {
+    ret.code = -1;
+    ret.body = "Failed to query.";
+    return ret;
+  }
+  if (cancel && cancel->load()) {
+    ret.code = -1;
+    ret.body = "Request aborted.";
+    return ret;
+  }
+
+  // every wait for data is bounded by the nearest deadline
+  int readMs = deadlines.totalMs;
+  if (deadlines.firstByteMs > 0 &&
+      (readMs <= 0 || deadlines.firstByteMs < readMs)) {
+    readMs = deadlines.firstByteMs;
+  }
+  int connectMs = deadlines.connectMs > 0 ? deadlines.connectMs
+                                          : kDefaultConnectTimeoutMs;
+  if (deadlines.totalMs > 0 && deadlines.totalMs < connectMs) {
+    connectMs = deadlines.totalMs;
+  }
+  int waitMs = readMs > 0 ? readMs : kNoTimeoutMs;
+
+  httplib::Headers requestHeaders;
+  for (RestClient::HeaderFields::const_iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    requestHeaders.insert(*it);
+  }
+
+  std::string origin = Helpers::origin(url);
+  httplib::Client* client = this->checkout(origin);
+  client->set_connection_timeout(connectMs / 1000, (connectMs % 1000) * 1000);
+  client->set_read_timeout(waitMs / 1000, (waitMs % 1000) * 1000);
+  client->set_write_timeout(waitMs / 1000, (waitMs % 1000) * 1000);
+  bool reused = client->is_socket_open() != 0;
+
+  Clock::time_point start = Clock::now();
+  bool timedOut = false;
+  httplib::Result result = client->Get(
+    request_path(url).c_str(), requestHeaders,
+    [&](const httplib::Response& response) {
+      ret.timing.startTransferTime = elapsed_ms(start) / 1000.0;
+      // presize the body like the curl header callback does, with the
+      // same cap on what a Content-Length header can reserve
+      std::string length = response.get_header_value("Content-Length");
+      if (!length.empty()) {
+        uint64_t size = std::strtoull(length.c_str(), NULL, 10);
+        if (size > 0 && size <= RestClient::Helpers::MAX_BODY_RESERVE) {
+          ret.body.reserve(static_cast<size_t>(size));
+        }
+      }
+      return true;
+    },
+    [&](const char* data, size_t length) {
+      if (cancel && cancel->load()) {
+        return false;
+      }
+      if (deadlines.totalMs > 0 && elapsed_ms(start) > deadlines.totalMs) {
+        timedOut = true;
+        return false;
+      }
+      ret.body.append(data, length);
+      return true;
+    });
+  double elapsed = elapsed_ms(start);
+  this->checkin(origin, client);
+
+  ret.timing.totalTime = elapsed / 1000.0;
+  ret.timing.downloadSize = ret.body.size();
+  ret.timing.decodedSize = ret.body.size();
+  if (result) {
+    ret.code = result->status;
+    for (httplib::Headers::const_iterator it = result->headers.begin();
+         it != result->headers.end(); ++it) {
+      ret.headers[it->first] = it->second;
+    }
+    ret.timing.responseCode = result->status;
+    ret.timing.connectionReused = reused;
+    ret.timing.httpVersion = result->version.compare(0, 5, "HTTP/") == 0 ?
+                             result->version.substr(5) : result->version;
+    return ret;
+  }
+
+  ret.body.clear();
+  httplib::Error error = result.error();
+  // a read that gave up after waitMs is httplib's way of timing out
+  if (timedOut || error == httplib::Error::ConnectionTimeout ||
+      (error == httplib::Error::Read && readMs > 0 && elapsed >= readMs)) {
+    ret.code = 28;
+    ret.body = "Operation Timeout.";
+  } else if (error == httplib::Error::Canceled) {
+    ret.code = -1;
+    ret.body = "Request aborted.";
+  } else {
+    ret.code = -1;
+    ret.body = "Failed to query.";
+  }
+  return ret;
+}
+
+/**
+ * @brief close all idle clients
+ */
+void
+RestClient::HttplibBackend::Clear() {
+  std::vector<httplib::Client*> closing;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::map<std::string, std::deque<IdleClient> >::iterator it =
+         this->idle.begin(); it != this->idle.end(); ++it) {
+      for (size_t i = 0; i < it->second.size(); ++i) {
+        closing.push_back(it->second[i].client);
+      }
+    }
+    this->idle.clear();
+  }
+  for (size_t i = 0; i < closing.size(); ++i) {
+    delete closing[i];
+  }
+}
+
+/**
+ * @brief take the most recently used idle client for origin or create a new
+ * one, closing clients that sat idle for longer than the TTL on the way
+ *
+ * @param origin scheme://host:port, see Helpers::origin()
+ *
+ * @return client, never NULL
+ */
+httplib::Client*
+RestClient::HttplibBackend::checkout(const std::string& origin) {
+  std::vector<httplib::Client*> expired;
+  httplib::Client* client = NULL;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Clock::time_point oldest = Clock::now() -
+                               std::chrono::seconds(this->idleTimeout);
+    for (std::map<std::string, std::deque<IdleClient> >::iterator it =
+         this->idle.begin(); it != this->idle.end();) {
+      // the front is the least recently used
+      while (!it->second.empty() && it->second.front().lastUsed < oldest) {
+        expired.push_back(it->second.front().client);
+        it->second.pop_front();
+      }
+      if (it->second.empty()) {
+        this->idle.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+    std::map<std::string, std::deque<IdleClient> >::iterator it =
+      this->idle.find(origin);
+    if (it != this->idle.end() && !it->second.empty()) {
+      client = it->second.back().client;
+      it->second.pop_back();
+    }
+  }
+  for (size_t i = 0; i < expired.size(); ++i) {
+    delete expired[i];
+  }
+  if (client == NULL) {
+    client = new httplib::Client(origin);
+    client->set_keep_alive(true);
+    client->set_follow_location(false);
+    client->set_tcp_nodelay(true);
+  }
+  return client;
+}
+
+/**
+ * @brief hand a client back after its request finished
+ *
+ * @param origin the request went to
+ * @param client obtained from checkout()
+ */
+void
+RestClient::HttplibBackend::checkin(const std::string& origin,
+                                    httplib::Client* client) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::deque<IdleClient>& clients = this->idle[origin];
+    if (clients.size() < this->maxPerHost && this->idleTimeout > 0) {
+      IdleClient entry = { client, Clock::now() };
+      clients.push_back(entry);
+      return;
+    }
+  }
+  delete client;
+}
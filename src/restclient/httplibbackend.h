@@ -0,0 +1,82 @@
+/**
+ * @file httplibbackend.h
+ * @brief Backend on top of the vendored, header-only cpp-httplib client
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_HTTPLIBBACKEND_H_
+#define INCLUDE_RESTCLIENT_CPP_HTTPLIBBACKEND_H_
+
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+#include "backend.h"
+#include "version.h"
+
+namespace httplib {
+class Client;
+}
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief sends requests with cpp-httplib (src/httplib.h) instead of
+  * libcurl. A httplib::Client holds one keep-alive socket and runs one
+  * request at a time, so idle clients are pooled per origin the way
+  * ConnectionPool pools curl handles: at most maxPerHost are kept, and
+  * those idle for longer than the TTL are closed on the next checkout.
+  *
+  * Only http:// URLs are supported unless the build defines
+  * CPPHTTPLIB_OPENSSL_SUPPORT. Redirects are not followed and bodies are
+  * not decompressed, like the curl GETs of the simple API. connectMs bounds
+  * the connect and the shorter of firstByteMs and totalMs every wait for
+  * data; totalMs is checked again as the body arrives. Requests are not
+  * recorded in Metrics, whose phases come from the curl timings; timing only
+  * holds the total time, the time to the response headers, the body size and
+  * whether the socket was reused.
+  */
+class HttplibBackend : public Backend {
+ public:
+    HttplibBackend(size_t maxPerHost, int idleTimeoutSeconds);
+    ~HttplibBackend();
+
+    // the instance shared by the whole process, 6 clients per origin kept
+    // for 60 seconds
+    static HttplibBackend& instance();
+
+    const char* Name() const;
+    bool Supports(const std::string& url) const;
+    RestClient::Response get(const std::string& url,
+                             const HeaderFields& headers,
+                             const Deadlines& deadlines,
+                             const CancelFlag& cancel);
+
+    // close all idle clients
+    void Clear();
+
+ private:
+    typedef std::chrono::steady_clock Clock;
+    typedef struct {
+      httplib::Client* client;
+      Clock::time_point lastUsed;
+    } IdleClient;
+
+    HttplibBackend(const HttplibBackend&);
+    HttplibBackend& operator=(const HttplibBackend&);
+
+    httplib::Client* checkout(const std::string& origin);
+    void checkin(const std::string& origin, httplib::Client* client);
+
+    std::mutex mutex;
+    std::map<std::string, std::deque<IdleClient> > idle;
+    size_t maxPerHost;
+    int idleTimeout;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_HTTPLIBBACKEND_H_
@@ -0,0 +1,253 @@
+/**
+ * @file metrics.cpp
+ * @brief implementation of the request latency histograms
+ */
+
+#include "metrics.h"
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "version.h"
+
+const double RestClient::Metrics::BOUNDS[RestClient::Metrics::BOUND_COUNT] = {
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+/**
+ * @brief constructor for the Metrics object, all counters start at zero
+ */
+RestClient::Metrics::Metrics() {
+  std::memset(&this->data, 0, sizeof(this->data));
+}
+
+/**
+ * @brief get the metrics shared by the whole process. Never destroyed, like
+ * the connection pool and the multi client recording into it.
+ *
+ * @return metrics instance
+ */
+RestClient::Metrics&
+RestClient::Metrics::instance() {
+  static RestClient::Metrics* metrics = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    metrics = new RestClient::Metrics();
+  });
+  return *metrics;
+}
+
+/**
+ * @brief get the name of a phase
+ *
+ * @param phase - one of Phase
+ *
+ * @return lower case name, "unknown" for anything else
+ */
+const char*
+RestClient::Metrics::PhaseName(int phase) {
+  switch (phase) {
+    case DNS:
+      return "dns";
+    case CONNECT:
+      return "connect";
+    case TLS:
+      return "tls";
+    case SERVER:
+      return "server";
+    case TRANSFER:
+      return "transfer";
+    case TOTAL:
+      return "total";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * @brief add a finished request. Safe to call from any thread.
+ *
+ * @param info timing of the request
+ * @param code response code, below 100 if no HTTP response was received
+ */
+void
+RestClient::Metrics::Record(const RestClient::RequestInfo& info, int code) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->data.requests++;
+  this->data.bytesUp += info.uploadSize;
+  this->data.bytesDown += info.downloadSize;
+  if (code < 100) {
+    this->data.errors++;
+    return;
+  }
+  if (info.connectionReused) {
+    this->data.reusedConnections++;
+  } else {
+    this->observe(DNS, info.nameLookupTime);
+    this->observe(CONNECT, info.connectTime - info.nameLookupTime);
+    if (info.appConnectTime > 0) {
+      this->observe(TLS, info.appConnectTime - info.connectTime);
+    }
+  }
+  if (info.startTransferTime > 0) {
+    this->observe(SERVER, info.startTransferTime - info.preTransferTime);
+    this->observe(TRANSFER, info.totalTime - info.startTransferTime);
+  }
+  this->observe(TOTAL, info.totalTime);
+}
+
+/**
+ * @brief count a request that shared the response of an identical request
+ * instead of being sent. Safe to call from any thread.
+ */
+void
+RestClient::Metrics::RecordCoalesced() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->data.coalesced++;
+}
+
+/**
+ * @brief count an attempt that failed and is repeated. Safe to call from
+ * any thread.
+ */
+void
+RestClient::Metrics::RecordRetry() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->data.retries++;
+}
+
+/**
+ * @brief count a duplicate sent for a slow request, or one that won the
+ * race against the original. Safe to call from any thread.
+ *
+ * @param won - false when the hedge is sent, true when it answered first
+ */
+void
+RestClient::Metrics::RecordHedge(bool won) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (won) {
+    this->data.hedgeWins++;
+  } else {
+    this->data.hedges++;
+  }
+}
+
+/**
+ * @brief estimate a quantile of a phase. The result is the upper bound of
+ * the bucket the quantile falls into, so it errs on the slow side; above
+ * the last bound the last bound is returned.
+ *
+ * @param phase - one of Phase
+ * @param q - quantile between 0 and 1, e.g. 0.95
+ *
+ * @return seconds, 0 if the phase has no observations
+ */
+double
+RestClient::Metrics::Quantile(int phase, double q) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const Histogram& h = this->data.phases[phase];
+  if (h.count == 0) {
+    return 0;
+  }
+  double rank = q * static_cast<double>(h.count);
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < BOUND_COUNT; ++i) {
+    cumulative += h.buckets[i];
+    if (static_cast<double>(cumulative) >= rank) {
+      return BOUNDS[i];
+    }
+  }
+  return BOUNDS[BOUND_COUNT - 1];
+}
+
+/**
+ * @brief copy all counters
+ *
+ * @return snapshot
+ */
+RestClient::Metrics::Snapshot
+RestClient::Metrics::GetSnapshot() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->data;
+}
+
+/**
+ * @brief render the counters in the Prometheus text exposition format
+ *
+ * @param prefix for the metric names, e.g. "myapp_http"
+ *
+ * @return exposition text
+ */
+std::string
+RestClient::Metrics::Prometheus(const std::string& prefix) {
+  RestClient::Metrics::Snapshot snap = this->GetSnapshot();
+  std::ostringstream out;
+
+  out << "# TYPE " << prefix << "_requests_total counter\n"
+      << prefix << "_requests_total " << snap.requests << "\n"
+      << "# TYPE " << prefix << "_errors_total counter\n"
+      << prefix << "_errors_total " << snap.errors << "\n"
+      << "# TYPE " << prefix << "_reused_connections_total counter\n"
+      << prefix << "_reused_connections_total " << snap.reusedConnections
+      << "\n"
+      << "# TYPE " << prefix << "_sent_bytes_total counter\n"
+      << prefix << "_sent_bytes_total " << snap.bytesUp << "\n"
+      << "# TYPE " << prefix << "_received_bytes_total counter\n"
+      << prefix << "_received_bytes_total " << snap.bytesDown << "\n"
+      << "# TYPE " << prefix << "_coalesced_requests_total counter\n"
+      << prefix << "_coalesced_requests_total " << snap.coalesced << "\n"
+      << "# TYPE " << prefix << "_retries_total counter\n"
+      << prefix << "_retries_total " << snap.retries << "\n"
+      << "# TYPE " << prefix << "_hedges_total counter\n"
+      << prefix << "_hedges_total " << snap.hedges << "\n"
+      << "# TYPE " << prefix << "_hedge_wins_total counter\n"
+      << prefix << "_hedge_wins_total " << snap.hedgeWins << "\n";
+
+  std::string name = prefix + "_phase_seconds";
+  out << "# TYPE " << name << " histogram\n";
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    const Histogram& h = snap.phases[phase];
+    std::string label = std::string("phase=\"") + PhaseName(phase) + "\"";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BOUND_COUNT; ++i) {
+      cumulative += h.buckets[i];
+      out << name << "_bucket{" << label << ",le=\"" << BOUNDS[i] << "\"} "
+          << cumulative << "\n";
+    }
+    out << name << "_bucket{" << label << ",le=\"+Inf\"} " << h.count << "\n"
+        << name << "_sum{" << label << "} " << h.sum << "\n"
+        << name << "_count{" << label << "} " << h.count << "\n";
+  }
+  return out.str();
+}
+
+/**
+ * @brief set all counters back to zero
+ */
+void
+RestClient::Metrics::Reset() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::memset(&this->data, 0, sizeof(this->data));
+}
+
+/**
+ * @brief add one observation to a phase, the mutex must be held
+ *
+ * @param phase - one of Phase
+ * @param seconds observed, negative values (rounding) count as zero
+ */
+void
+RestClient::Metrics::observe(int phase, double seconds) {
+  if (seconds < 0) {
+    seconds = 0;
+  }
+  Histogram& h = this->data.phases[phase];
+  size_t bucket = 0;
+  while (bucket < BOUND_COUNT && seconds > BOUNDS[bucket]) {
+    bucket++;
+  }
+  h.buckets[bucket]++;
+  h.sum += seconds;
+  h.count++;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file metrics.h
+ * @brief process wide latency histograms of finished requests
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_METRICS_H_
+#define INCLUDE_RESTCLIENT_CPP_METRICS_H_
+
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+#include "restclient.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief collects the RequestInfo of finished requests into fixed bucket
+  * histograms, one per phase of a request, so DNS, connect, TLS and server
+  * latency can be told apart.
+  *
+  * Phases are taken from the curl timings: DNS is the name lookup, CONNECT
+  * the TCP connect after it, TLS the handshake after that, SERVER the time
+  * from sending the request to the first response byte, TRANSFER the rest of
+  * the body and TOTAL the whole request. The first three are only recorded
+  * for requests that opened a new connection.
+  */
+class Metrics {
+ public:
+    enum Phase {
+      DNS = 0,
+      CONNECT,
+      TLS,
+      SERVER,
+      TRANSFER,
+      TOTAL,
+      PHASE_COUNT
+    };
+
+    // upper bounds of the buckets in seconds, a last bucket takes the rest
+    static const size_t BOUND_COUNT = 13;
+    static const double BOUNDS[BOUND_COUNT];
+
+    /** @struct Histogram
+      *  @brief observations of one phase
+      *  @var Histogram::buckets
+      *  Member 'buckets' contains the number of observations per bucket
+      *  (not cumulative), the last one counting those above all bounds
+      *  @var Histogram::sum
+      *  Member 'sum' contains the sum of all observations in seconds
+      *  @var Histogram::count
+      *  Member 'count' contains the number of observations
+      */
+    typedef struct {
+      uint64_t buckets[BOUND_COUNT + 1];
+      double sum;
+      uint64_t count;
+    } Histogram;
+
+    /** @struct Snapshot
+      *  @brief copy of all counters at one point in time
+      *  @var Snapshot::requests
+      *  Member 'requests' contains the number of finished requests
+      *  @var Snapshot::errors
+      *  Member 'errors' contains the requests that got no HTTP response
+      *  @var Snapshot::reusedConnections
+      *  Member 'reusedConnections' contains the requests that did not open
+      *  a new connection
+      *  @var Snapshot::bytesUp
+      *  Member 'bytesUp' contains the body bytes sent
+      *  @var Snapshot::bytesDown
+      *  Member 'bytesDown' contains the body bytes received
+      *  @var Snapshot::coalesced
+      *  Member 'coalesced' contains the requests that were not sent because
+      *  an identical one was in flight (see SingleFlight)
+      *  @var Snapshot::retries
+      *  Member 'retries' contains the attempts repeated by a RetryPolicy
+      *  @var Snapshot::hedges
+      *  Member 'hedges' contains the duplicates sent for slow requests
+      *  @var Snapshot::hedgeWins
+      *  Member 'hedgeWins' contains the duplicates that answered first
+      *  @var Snapshot::phases
+      *  Member 'phases' contains one histogram per Phase
+      */
+    typedef struct {
+      uint64_t requests;
+      uint64_t errors;
+      uint64_t reusedConnections;
+      uint64_t bytesUp;
+      uint64_t bytesDown;
+      uint64_t coalesced;
+      uint64_t retries;
+      uint64_t hedges;
+      uint64_t hedgeWins;
+      Histogram phases[PHASE_COUNT];
+    } Snapshot;
+
+    Metrics();
+
+    // metrics of every connection of the pool and the multi client
+    static Metrics& instance();
+
+    // lower case name of a phase, e.g. "dns"
+    static const char* PhaseName(int phase);
+
+    // add a finished request, code is Response::code
+    void Record(const RestClient::RequestInfo& info, int code);
+
+    // count a request answered by an identical one in flight
+    void RecordCoalesced();
+
+    // count a failed attempt that is tried again
+    void RecordRetry();
+
+    // count a hedge sent (won false) or a hedge that answered first
+    void RecordHedge(bool won);
+
+    // estimate of the q quantile (0 to 1) of a phase in seconds from its
+    // buckets, 0 if nothing was recorded
+    double Quantile(int phase, double q);
+
+    RestClient::Metrics::Snapshot GetSnapshot();
+
+    // the snapshot in the Prometheus text format, metric names start with
+    // prefix
+    std::string Prometheus(const std::string& prefix);
+
+    void Reset();
+
+ private:
+    Metrics(const Metrics&);
+    Metrics& operator=(const Metrics&);
+
+    void observe(int phase, double seconds);
+
+    std::mutex mutex;
+    Snapshot data;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_METRICS_H_
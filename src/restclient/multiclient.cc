@@ -0,0 +1,742 @@
+/**
+ * @file multiclient.cpp
+ * @brief implementation of the curl multi based request engine
+ */
+
+#include "multiclient.h"
+
+#include <curl/curl.h>
+
+#include <condition_variable>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "helpers.h"
+#include "version.h"
+
+/**
+ * @brief constructor for the MultiClient object, starts the event loop
+ *
+ * @param maxConcurrent - transfers running at once, 0 for no limit
+ *
+ */
+RestClient::MultiClient::MultiClient(size_t maxConcurrent)
+                               : running(true), queued(), resuming(),
+                                 cancelling(),
+                                 pending(0),
+                                 nextId(1), sharedCache(NULL), metrics(NULL),
+                                 active(), delayed(),
+                                 idle() {
+  this->multiHandle = curl_multi_init();
+  if (!this->multiHandle) {
+    throw std::runtime_error("Couldn't initialize curl multi handle");
+  }
+  // run concurrent HTTP/2 streams over one connection
+  curl_multi_setopt(this->multiHandle, CURLMOPT_PIPELINING,
+                    CURLPIPE_MULTIPLEX);
+  this->maxConcurrent = maxConcurrent;
+  this->loop = std::thread(&RestClient::MultiClient::run, this);
+}
+
+/**
+ * @brief stops the event loop. Requests that did not finish yet complete
+ * with code -1 before the destructor returns.
+ */
+RestClient::MultiClient::~MultiClient() {
+  this->running = false;
+  curl_multi_wakeup(this->multiHandle);
+  this->loop.join();
+
+  // drop duplicates first, their twins complete the requests
+  for (std::map<CURL*, Transfer*>::iterator it = this->active.begin();
+       it != this->active.end();) {
+    if (it->second->duplicate) {
+      this->cancelTwin(it->second->twin);
+      it = this->active.begin();
+    } else {
+      ++it;
+    }
+  }
+  for (std::map<CURL*, Transfer*>::iterator it = this->active.begin();
+       it != this->active.end(); ++it) {
+    curl_multi_remove_handle(this->multiHandle, it->first);
+    this->finish(it->second, CURLE_ABORTED_BY_CALLBACK);
+  }
+  this->active.clear();
+
+  std::deque<Transfer*> left;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    left.swap(this->queued);
+  }
+  for (std::multimap<Clock::time_point, Transfer*>::iterator it =
+         this->delayed.begin(); it != this->delayed.end(); ++it) {
+    left.push_back(it->second);
+  }
+  this->delayed.clear();
+  for (size_t i = 0; i < left.size(); ++i) {
+    this->abort(left[i]);
+  }
+
+  for (size_t i = 0; i < this->idle.size(); ++i) {
+    delete this->idle[i];
+  }
+  curl_multi_cleanup(this->multiHandle);
+}
+
+/**
+ * @brief get the client shared by the whole process. Like the connection
+ * pool it is never destroyed, so its loop keeps running until exit.
+ *
+ * @return client instance
+ */
+RestClient::MultiClient&
+RestClient::MultiClient::instance() {
+  static RestClient::MultiClient* client = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    client = new RestClient::MultiClient(0);
+    client->SetSharedCache(&RestClient::SharedCache::instance());
+    client->SetMetrics(&RestClient::Metrics::instance());
+  });
+  return *client;
+}
+
+/**
+ * @brief queue a request. Safe to call from any thread, including from a
+ * completion callback.
+ *
+ * @param request to perform
+ * @param callback called on the event loop thread with the response
+ *
+ * @return id of the queued request
+ */
+uint64_t
+RestClient::MultiClient::Submit(const RestClient::Request& request,
+                                Callback callback) {
+  Transfer* transfer = new Transfer();
+  transfer->request = request;
+  transfer->callback = callback;
+  transfer->conn = NULL;
+  transfer->easy = NULL;
+  transfer->attempt = 0;
+  transfer->twin = NULL;
+  transfer->duplicate = false;
+  transfer->hedgePending = false;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    transfer->id = this->nextId++;
+    this->queued.push_back(transfer);
+    this->pending++;
+  }
+  curl_multi_wakeup(this->multiHandle);
+  return transfer->id;
+}
+
+/**
+ * @brief queue a batch of requests
+ *
+ * @param requests to perform
+ * @param callback called on the event loop thread with the index into
+ * requests and the response, once per request in completion order
+ */
+void
+RestClient::MultiClient::Submit(
+    const std::vector<RestClient::Request>& requests,
+    BatchCallback callback) {
+  for (size_t i = 0; i < requests.size(); ++i) {
+    this->Submit(requests[i], [callback, i](RestClient::Response& res) {
+      callback(i, res);
+    });
+  }
+}
+
+/**
+ * @brief perform a batch of requests concurrently and wait for all of them.
+ * Must not be called from a completion callback.
+ *
+ * @param requests to perform
+ *
+ * @return responses in the order of requests
+ */
+std::vector<RestClient::Response>
+RestClient::MultiClient::Perform(
+    const std::vector<RestClient::Request>& requests) {
+  std::vector<RestClient::Response> responses(requests.size());
+  std::mutex doneMutex;
+  std::condition_variable doneCond;
+  size_t remaining = requests.size();
+
+  this->Submit(requests, [&](size_t index, RestClient::Response& res) {
+    std::lock_guard<std::mutex> lock(doneMutex);
+    responses[index] = std::move(res);
+    if (--remaining == 0) {
+      doneCond.notify_one();
+    }
+  });
+
+  std::unique_lock<std::mutex> lock(doneMutex);
+  doneCond.wait(lock, [&remaining] { return remaining == 0; });
+  return responses;
+}
+
+/**
+ * @brief continue a transfer that was paused because its sink returned
+ * SINK_PAUSE or its source SOURCE_PAUSE. The paused chunk is delivered to
+ * the sink again, the source is asked again. Safe to call from any thread;
+ * unknown or finished ids are ignored.
+ *
+ * @param id returned by Submit()
+ */
+void
+RestClient::MultiClient::Resume(uint64_t id) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->resuming.push_back(id);
+  }
+  curl_multi_wakeup(this->multiHandle);
+}
+
+/**
+ * @brief cancel the requests that carry flag. Running transfers are removed
+ * from the multi handle and queued ones never start; all of them complete
+ * with code -1. Safe to call from any thread.
+ *
+ * @param flag handed to the requests in Request::cancel, gets set
+ */
+void
+RestClient::MultiClient::Cancel(const RestClient::CancelFlag& flag) {
+  if (!flag) {
+    return;
+  }
+  flag->store(true);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->cancelling.push_back(flag);
+  }
+  curl_multi_wakeup(this->multiHandle);
+}
+
+/**
+ * @brief change the number of transfers running at once
+ *
+ * @param maxConcurrent - 0 for no limit
+ */
+void
+RestClient::MultiClient::SetMaxConcurrent(size_t maxConcurrent) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->maxConcurrent = maxConcurrent;
+  }
+  curl_multi_wakeup(this->multiHandle);
+}
+
+/**
+ * @brief set the cache for DNS results and TLS sessions. Connections of the
+ * multi handle are already shared between its transfers.
+ *
+ * @param cache - NULL for none
+ */
+void
+RestClient::MultiClient::SetSharedCache(RestClient::SharedCache* cache) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->sharedCache = cache;
+}
+
+/**
+ * @brief set the metrics the transfers record their timing in
+ *
+ * @param metrics - NULL for none
+ */
+void
+RestClient::MultiClient::SetMetrics(RestClient::Metrics* metrics) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->metrics = metrics;
+}
+
+/**
+ * @brief get the number of requests that are queued or running
+ *
+ * @return pending request count
+ */
+size_t
+RestClient::MultiClient::Pending() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->pending;
+}
+
+/**
+ * @brief the event loop: start queued transfers, drive the multi handle and
+ * hand finished transfers to their callbacks until the client is destroyed
+ */
+void
+RestClient::MultiClient::run() {
+  while (this->running) {
+    this->applyResumes();
+    this->applyCancels();
+    this->fireHedges();
+    this->startQueued();
+
+    int stillRunning = 0;
+    curl_multi_perform(this->multiHandle, &stillRunning);
+
+    CURLMsg* msg = NULL;
+    int msgsLeft = 0;
+    while ((msg = curl_multi_info_read(this->multiHandle, &msgsLeft))) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      CURL* easy = msg->easy_handle;
+      CURLcode res = msg->data.result;
+      std::map<CURL*, Transfer*>::iterator it = this->active.find(easy);
+      curl_multi_remove_handle(this->multiHandle, easy);
+      if (it != this->active.end()) {
+        Transfer* transfer = it->second;
+        this->active.erase(it);
+        this->finish(transfer, res);
+      }
+    }
+
+    // freed slots can be refilled right away without waiting for a socket
+    if (this->startDelayed() + this->startQueued() > 0) {
+      continue;
+    }
+    curl_multi_poll(this->multiHandle, NULL, 0, this->pollTimeout(), NULL);
+  }
+}
+
+/**
+ * @brief unpause the transfers Resume() was called for. Only called on the
+ * event loop thread, as curl_easy_pause has to be.
+ */
+void
+RestClient::MultiClient::applyResumes() {
+  std::vector<uint64_t> ids;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    ids.swap(this->resuming);
+  }
+  for (size_t i = 0; i < ids.size(); ++i) {
+    for (std::map<CURL*, Transfer*>::iterator it = this->active.begin();
+         it != this->active.end(); ++it) {
+      if (it->second->id == ids[i]) {
+        curl_easy_pause(it->first, CURLPAUSE_CONT);
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * @brief move queued transfers onto the multi handle as long as the
+ * concurrency limit allows. Only called on the event loop thread.
+ *
+ * @return number of transfers started
+ */
+size_t
+RestClient::MultiClient::startQueued() {
+  std::vector<Transfer*> starting;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    while (!this->queued.empty() &&
+           (this->maxConcurrent == 0 ||
+            this->active.size() + starting.size() < this->maxConcurrent)) {
+      starting.push_back(this->queued.front());
+      this->queued.pop_front();
+    }
+  }
+
+  for (size_t i = 0; i < starting.size(); ++i) {
+    Transfer* transfer = starting[i];
+    const RestClient::Request& req = transfer->request;
+    if (req.cancel && req.cancel->load()) {
+      this->abort(transfer);
+      continue;
+    }
+    // a duplicate would feed the sink twice or drain the source
+    if (req.hedge && !req.sink && !req.source) {
+      int delay = req.hedge->delayMs;
+      if (req.hedge->percentile > 0 && this->metrics) {
+        double seconds = this->metrics->Quantile(RestClient::Metrics::SERVER,
+                                                 req.hedge->percentile);
+        if (seconds > 0) {
+          delay = static_cast<int>(seconds * 1000);
+        }
+      }
+      transfer->hedgePending = true;
+      transfer->hedgeAt = Clock::now() + std::chrono::milliseconds(delay);
+    }
+    this->beginTransfer(transfer);
+  }
+  return starting.size();
+}
+
+/**
+ * @brief configure a connection for a transfer and add it to the multi
+ * handle. Only called on the event loop thread.
+ *
+ * @param transfer to start, gets its conn and easy handle set
+ */
+void
+RestClient::MultiClient::beginTransfer(Transfer* transfer) {
+  const RestClient::Request& req = transfer->request;
+  transfer->conn = this->takeConnection();
+  transfer->conn->SetHeaders(req.headers);
+  transfer->conn->SetTimeout(req.timeout);
+  transfer->conn->SetDeadlines(req.deadlines);
+  transfer->conn->SetCancelFlag(req.cancel);
+  transfer->conn->SetNoSignal(true);
+  transfer->conn->SetWriteSink(req.sink);
+  transfer->conn->SetUploadSource(req.source, req.source ? req.uploadSize : -1);
+  transfer->conn->SetUploadProgress(req.uploadProgress);
+  transfer->conn->SetHttp2(req.http2);
+  transfer->conn->SetCompression(true);
+  if (transfer->duplicate && !req.hedge->alternateAddress.empty()) {
+    transfer->conn->SetConnectTo(req.hedge->alternateAddress);
+  }
+  transfer->started = Clock::now();
+  transfer->easy = transfer->conn->BeginRequest(
+      req.method.empty() ? "GET" : req.method, req.url, req.body);
+  this->active[transfer->easy] = transfer;
+  curl_multi_add_handle(this->multiHandle, transfer->easy);
+}
+
+/**
+ * @brief send duplicates for hedged transfers that passed their delay
+ * without receiving a response byte. Only called on the event loop thread.
+ */
+void
+RestClient::MultiClient::fireHedges() {
+  Clock::time_point now = Clock::now();
+  std::vector<Transfer*> late;
+  for (std::map<CURL*, Transfer*>::iterator it = this->active.begin();
+       it != this->active.end(); ++it) {
+    Transfer* transfer = it->second;
+    if (!transfer->hedgePending || transfer->hedgeAt > now) {
+      continue;
+    }
+    transfer->hedgePending = false;
+    curl_off_t firstByte = 0;
+    curl_easy_getinfo(it->first, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+    if (firstByte == 0) {
+      late.push_back(transfer);
+    }
+  }
+  for (size_t i = 0; i < late.size(); ++i) {
+    Transfer* duplicate = new Transfer();
+    duplicate->id = late[i]->id;
+    duplicate->request = late[i]->request;
+    duplicate->callback = late[i]->callback;
+    duplicate->conn = NULL;
+    duplicate->easy = NULL;
+    duplicate->attempt = late[i]->attempt;
+    duplicate->twin = late[i];
+    duplicate->duplicate = true;
+    duplicate->hedgePending = false;
+    late[i]->twin = duplicate;
+    this->beginTransfer(duplicate);
+    if (this->metrics) {
+      this->metrics->RecordHedge(false);
+    }
+  }
+}
+
+/**
+ * @brief stop the other transfer of a hedged pair without running its
+ * callback. Only called on the event loop thread.
+ *
+ * @param transfer whose twin is cancelled, left without a twin
+ */
+void
+RestClient::MultiClient::cancelTwin(Transfer* transfer) {
+  Transfer* twin = transfer->twin;
+  transfer->twin = NULL;
+  if (!twin) {
+    return;
+  }
+  curl_multi_remove_handle(this->multiHandle, twin->easy);
+  this->active.erase(twin->easy);
+  // the loser is not a failed request, keep it out of the metrics
+  twin->conn->SetMetrics(NULL);
+  twin->conn->EndRequest(CURLE_ABORTED_BY_CALLBACK);
+  twin->conn->SetMetrics(this->metrics);
+  this->releaseConnection(twin->conn);
+  delete twin;
+}
+
+/**
+ * @brief collect the response of a finished transfer and run its callback
+ *
+ * @param transfer that finished, deleted afterwards
+ * @param res result code reported by the multi handle
+ */
+void
+RestClient::MultiClient::finish(Transfer* transfer, CURLcode res) {
+  if (transfer->twin) {
+    if (res != CURLE_OK && this->running) {
+      // the other attempt may still succeed, it takes over the request
+      transfer->twin->twin = NULL;
+      transfer->twin = NULL;
+      transfer->conn->EndRequest(res);
+      this->releaseConnection(transfer->conn);
+      delete transfer;
+      return;
+    }
+    this->cancelTwin(transfer);
+    if (transfer->duplicate && this->metrics) {
+      this->metrics->RecordHedge(true);
+    }
+  }
+  transfer->hedgePending = false;
+  RestClient::Response response = transfer->conn->EndRequest(res);
+  this->releaseConnection(transfer->conn);
+  transfer->conn = NULL;
+  transfer->easy = NULL;
+  transfer->duplicate = false;
+  transfer->attempt++;
+  if (this->scheduleRetry(transfer, res, response)) {
+    return;
+  }
+  try {
+    transfer->callback(response);
+  } catch (...) {
+    // a throwing callback must not take the event loop down
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pending--;
+  }
+  delete transfer;
+}
+
+namespace {
+
+// failures that may well go away when the request is sent again
+bool transient_error(CURLcode res) {
+  switch (res) {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+/**
+ * @brief abort the transfers Cancel() was called for. Only called on the
+ * event loop thread.
+ */
+void
+RestClient::MultiClient::applyCancels() {
+  std::vector<RestClient::CancelFlag> flags;
+  std::vector<Transfer*> waiting;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    flags.swap(this->cancelling);
+    for (size_t i = 0; i < flags.size(); ++i) {
+      for (std::deque<Transfer*>::iterator it = this->queued.begin();
+           it != this->queued.end();) {
+        if ((*it)->request.cancel == flags[i]) {
+          waiting.push_back(*it);
+          it = this->queued.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+
+  std::vector<Transfer*> running;
+  for (size_t i = 0; i < flags.size(); ++i) {
+    for (std::multimap<Clock::time_point, Transfer*>::iterator it =
+           this->delayed.begin(); it != this->delayed.end();) {
+      if (it->second->request.cancel == flags[i]) {
+        waiting.push_back(it->second);
+        it = this->delayed.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (std::map<CURL*, Transfer*>::iterator it = this->active.begin();
+         it != this->active.end();) {
+      if (it->second->request.cancel == flags[i]) {
+        curl_multi_remove_handle(this->multiHandle, it->first);
+        running.push_back(it->second);
+        this->active.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+  // the first of a hedged pair hands over to its twin, which then completes
+  for (size_t i = 0; i < running.size(); ++i) {
+    this->finish(running[i], CURLE_ABORTED_BY_CALLBACK);
+  }
+  for (size_t i = 0; i < waiting.size(); ++i) {
+    this->abort(waiting[i]);
+  }
+}
+
+/**
+ * @brief complete a transfer that is not running with code -1
+ *
+ * @param transfer queued or waiting for a retry, deleted afterwards
+ */
+void
+RestClient::MultiClient::abort(Transfer* transfer) {
+  RestClient::Response aborted;
+  aborted.code = -1;
+  aborted.body = "Request aborted.";
+  try {
+    transfer->callback(aborted);
+  } catch (...) {
+    // a throwing callback must not take the event loop down
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pending--;
+  }
+  delete transfer;
+}
+
+/**
+ * @brief put a failed transfer on the timer list if its retry policy allows
+ * another attempt. Only called on the event loop thread.
+ *
+ * @param transfer whose attempt failed, keeps counting as pending
+ * @param res result code of the attempt
+ * @param response of the attempt
+ *
+ * @return true if the transfer will be retried, false to complete it
+ */
+bool
+RestClient::MultiClient::scheduleRetry(Transfer* transfer, CURLcode res,
+                                       const RestClient::Response& response) {
+  const RestClient::Request& req = transfer->request;
+  if (!req.retry || !this->running || (req.cancel && req.cancel->load()) ||
+      !req.retry->CanRetry(req.method.empty() ? "GET" : req.method,
+                           transfer->attempt)) {
+    return false;
+  }
+  if (res == CURLE_OK ? !req.retry->IsRetryableStatus(response.code)
+                      : !transient_error(res)) {
+    return false;
+  }
+  // a stream consumer must not see the body twice, and a source cannot be
+  // read again
+  if ((req.sink && response.timing.decodedSize > 0) || req.source) {
+    return false;
+  }
+  const std::string* retryAfter =
+    RestClient::Helpers::find_header(response.headers, "Retry-After");
+  int delay = req.retry->DelayMs(transfer->attempt,
+                                 retryAfter ? *retryAfter : std::string());
+  this->delayed.insert(std::make_pair(
+      Clock::now() + std::chrono::milliseconds(delay), transfer));
+  if (this->metrics) {
+    this->metrics->RecordRetry();
+  }
+  return true;
+}
+
+/**
+ * @brief put transfers whose retry delay ran out in front of the queue, they
+ * were admitted before and should not wait behind newer requests. Only
+ * called on the event loop thread.
+ *
+ * @return number of transfers moved
+ */
+size_t
+RestClient::MultiClient::startDelayed() {
+  Clock::time_point now = Clock::now();
+  std::vector<Transfer*> due;
+  while (!this->delayed.empty() && this->delayed.begin()->first <= now) {
+    due.push_back(this->delayed.begin()->second);
+    this->delayed.erase(this->delayed.begin());
+  }
+  if (due.empty()) {
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queued.insert(this->queued.begin(), due.begin(), due.end());
+  }
+  return due.size();
+}
+
+/**
+ * @brief get how long the loop may wait for socket activity
+ *
+ * @return milliseconds until the next retry, hedge or first byte deadline
+ * is due, at most one second
+ */
+int
+RestClient::MultiClient::pollTimeout() {
+  Clock::time_point now = Clock::now();
+  Clock::time_point next = now + std::chrono::seconds(1);
+  if (!this->delayed.empty() && this->delayed.begin()->first < next) {
+    next = this->delayed.begin()->first;
+  }
+  for (std::map<CURL*, Transfer*>::iterator it = this->active.begin();
+       it != this->active.end(); ++it) {
+    const Transfer* transfer = it->second;
+    if (transfer->hedgePending && transfer->hedgeAt < next) {
+      next = transfer->hedgeAt;
+    }
+    // the progress callback checks the first byte deadline when woken up
+    int firstByteMs = transfer->request.deadlines.firstByteMs;
+    if (firstByteMs > 0) {
+      Clock::time_point deadline =
+        transfer->started + std::chrono::milliseconds(firstByteMs);
+      if (deadline > now && deadline < next) {
+        next = deadline;
+      }
+    }
+  }
+  int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      next - now).count() + 1;
+  return ms < 0 ? 0 : (ms > 1000 ? 1000 : static_cast<int>(ms));
+}
+
+/**
+ * @brief get an idle connection object or create a new one. Open sockets
+ * belong to the multi handle, so any connection object serves any origin.
+ *
+ * @return connection object
+ */
+RestClient::Connection*
+RestClient::MultiClient::takeConnection() {
+  if (this->idle.empty()) {
+    RestClient::Connection* conn = new RestClient::Connection("");
+    std::lock_guard<std::mutex> lock(this->mutex);
+    conn->SetSharedCache(this->sharedCache);
+    conn->SetMetrics(this->metrics);
+    return conn;
+  }
+  RestClient::Connection* conn = this->idle.back();
+  this->idle.pop_back();
+  return conn;
+}
+
+/**
+ * @brief keep a connection object around for the next transfer
+ *
+ * @param conn connection whose transfer finished
+ */
+void
+RestClient::MultiClient::releaseConnection(RestClient::Connection* conn) {
+  conn->ResetOptions();
+  this->idle.push_back(conn);
+}
@@ -0,0 +1,227 @@
+/**
+ * @file multiclient.h
+ * @brief concurrent requests on a single curl multi event loop
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_MULTICLIENT_H_
+#define INCLUDE_RESTCLIENT_CPP_MULTICLIENT_H_
+
+#include <curl/curl.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+#include "restclient.h"
+#include "connection.h"
+#include "sharedcache.h"
+#include "metrics.h"
+#include "retrypolicy.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/** @struct HedgePolicy
+  *  @brief when to send a duplicate of a request that is slow to answer
+  *  @var HedgePolicy::delayMs
+  *  Member 'delayMs' contains how long to wait for the first response byte
+  *  before sending the duplicate
+  *  @var HedgePolicy::percentile
+  *  Member 'percentile' takes the delay from the server latency recorded in
+  *  Metrics instead, e.g. 0.95. 0 or no recorded requests use delayMs.
+  *  @var HedgePolicy::alternateAddress
+  *  Member 'alternateAddress' optionally sends the duplicate to another IP
+  *  address of the same host, empty to let DNS decide
+  */
+typedef struct {
+  int delayMs;
+  double percentile;
+  std::string alternateAddress;
+} HedgePolicy;
+
+/** @struct Request
+  *  @brief This structure describes a request for the MultiClient
+  *  @var Request::method
+  *  Member 'method' contains the HTTP verb (GET, POST, PUT, DELETE, HEAD)
+  *  @var Request::url
+  *  Member 'url' contains the absolute URL to query
+  *  @var Request::headers
+  *  Member 'headers' contains the request headers
+  *  @var Request::body
+  *  Member 'body' contains the request body for POST and PUT
+  *  @var Request::timeout
+  *  Member 'timeout' contains the transfer timeout in seconds, 0 for none
+  *  @var Request::deadlines
+  *  Member 'deadlines' contains millisecond deadlines, a totalMs other than
+  *  0 replaces timeout
+  *  @var Request::sink
+  *  Member 'sink' optionally receives the body chunk by chunk, it may
+  *  return SINK_PAUSE and later get the transfer going with Resume()
+  *  @var Request::http2
+  *  Member 'http2' offers HTTP/2 on TLS connections, concurrent requests
+  *  to the same origin then share one connection
+  *  @var Request::retry
+  *  Member 'retry' optionally retries failed attempts, NULL for none.
+  *  Streamed requests are only retried while nothing reached the sink.
+  *  @var Request::hedge
+  *  Member 'hedge' optionally races a duplicate against a slow request,
+  *  NULL for none. Only meant for idempotent requests, ignored with a sink.
+  *  @var Request::cancel
+  *  Member 'cancel' optionally aborts the request once set, see
+  *  MultiClient::Cancel() for doing so without delay
+  *  @var Request::source
+  *  Member 'source' optionally produces the POST or PUT body instead of
+  *  body. It may return SOURCE_PAUSE and later get the transfer going with
+  *  Resume(). Requests with a source are neither retried nor hedged.
+  *  @var Request::uploadSize
+  *  Member 'uploadSize' contains the size of what source produces, -1 if
+  *  unknown. Only read when source is set.
+  *  @var Request::uploadProgress
+  *  Member 'uploadProgress' is optionally told how much of the body was
+  *  sent, on the event loop thread
+  */
+typedef struct {
+  std::string method;
+  std::string url;
+  HeaderFields headers;
+  std::string body;
+  int timeout;
+  Deadlines deadlines;
+  ChunkSink sink;
+  bool http2;
+  std::shared_ptr<const RetryPolicy> retry;
+  std::shared_ptr<const HedgePolicy> hedge;
+  CancelFlag cancel;
+  ChunkSource source;
+  int64_t uploadSize;
+  UploadProgress uploadProgress;
+} Request;
+
+/**
+  * @brief runs many requests concurrently on one event loop thread.
+  *
+  * Requests are driven by a curl multi handle, so a batch of N requests
+  * needs one thread and finishes in roughly the time of the slowest one.
+  * HTTP/2 requests to the same origin are multiplexed over one connection.
+  * Compressed responses are accepted and decoded as they arrive.
+  * Retries wait on the event loop as timers, no thread sleeps for them.
+  * A hedged request whose first byte is late gets a duplicate; the first
+  * of the two to succeed answers and the other one is cancelled.
+  * Completion callbacks are invoked on the event loop thread; they should
+  * return quickly and may submit further requests.
+  */
+class MultiClient {
+ public:
+    typedef std::function<void(RestClient::Response&)> Callback;
+    typedef std::function<void(size_t, RestClient::Response&)> BatchCallback;
+
+    // maxConcurrent limits the transfers running at once, 0 for no limit
+    explicit MultiClient(size_t maxConcurrent);
+    ~MultiClient();
+
+    // the client shared by the whole process
+    static MultiClient& instance();
+
+    // queue a request, callback is called once it finished
+    uint64_t Submit(const RestClient::Request& request, Callback callback);
+
+    // queue a batch, callback gets the index of each finished request
+    void Submit(const std::vector<RestClient::Request>& requests,
+                BatchCallback callback);
+
+    // queue a batch and block until all of it finished
+    std::vector<RestClient::Response> Perform(
+        const std::vector<RestClient::Request>& requests);
+
+    // continue a transfer whose sink returned SINK_PAUSE or whose source
+    // returned SOURCE_PAUSE
+    void Resume(uint64_t id);
+
+    // set flag and abort the requests carrying it right away
+    void Cancel(const RestClient::CancelFlag& flag);
+
+    // change the concurrency limit, 0 for no limit
+    void SetMaxConcurrent(size_t maxConcurrent);
+
+    // cache for DNS results and TLS sessions, NULL for none. Must be called
+    // before the first Submit().
+    void SetSharedCache(RestClient::SharedCache* cache);
+
+    // record request timings, NULL for none. Must be called before the first
+    // Submit().
+    void SetMetrics(RestClient::Metrics* metrics);
+
+    // number of requests queued, running or waiting for a retry
+    size_t Pending();
+
+ private:
+    typedef std::chrono::steady_clock Clock;
+    // a hedged request runs as two transfers pointing at each other through
+    // twin, both carrying the callback; whichever finishes calls it
+    typedef struct Transfer {
+      uint64_t id;
+      RestClient::Request request;
+      Callback callback;
+      RestClient::Connection* conn;
+      CURL* easy;
+      int attempt;
+      struct Transfer* twin;
+      bool duplicate;
+      bool hedgePending;
+      Clock::time_point hedgeAt;
+      Clock::time_point started;
+    } Transfer;
+
+    MultiClient(const MultiClient&);
+    MultiClient& operator=(const MultiClient&);
+
+    void run();
+    void applyResumes();
+    void applyCancels();
+    void abort(Transfer* transfer);
+    size_t startQueued();
+    void beginTransfer(Transfer* transfer);
+    void fireHedges();
+    void cancelTwin(Transfer* transfer);
+    void finish(Transfer* transfer, CURLcode res);
+    bool scheduleRetry(Transfer* transfer, CURLcode res,
+                       const RestClient::Response& response);
+    size_t startDelayed();
+    int pollTimeout();
+    RestClient::Connection* takeConnection();
+    void releaseConnection(RestClient::Connection* conn);
+
+    CURLM* multiHandle;
+    std::thread loop;
+    std::atomic<bool> running;
+
+    // guarded by mutex, filled by Submit() from any thread
+    std::mutex mutex;
+    std::deque<Transfer*> queued;
+    std::vector<uint64_t> resuming;
+    std::vector<RestClient::CancelFlag> cancelling;
+    size_t maxConcurrent;
+    size_t pending;
+    uint64_t nextId;
+
+    RestClient::SharedCache* sharedCache;
+    RestClient::Metrics* metrics;
+
+    // only touched by the loop thread
+    std::map<CURL*, Transfer*> active;
+    std::multimap<Clock::time_point, Transfer*> delayed;
+    std::vector<RestClient::Connection*> idle;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_MULTICLIENT_H_
@@ -0,0 +1,477 @@
+/**
+ * @file responsecache.cpp
+ * @brief implementation of the in memory HTTP cache
+ */
+
+#include "responsecache.h"
+
+#include <curl/curl.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+#include "helpers.h"
+#include "version.h"
+
+namespace {
+
+/** @struct CacheControl
+  *  @brief the parts of a response's caching headers the cache acts on
+  */
+typedef struct {
+  bool noStore;
+  bool noCache;
+  long lifetime;  // NOLINT(runtime/int)
+  long age;  // NOLINT(runtime/int)
+} CacheControl;
+
+std::string lower(std::string s) {
+  for (size_t i = 0; i < s.size(); ++i) {
+    s[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(s[i])));
+  }
+  return s;
+}
+
+time_t header_date(const RestClient::HeaderFields& headers,
+                   const std::string& name) {
+  const std::string* value = RestClient::Helpers::find_header(headers, name);
+  return value ? curl_getdate(value->c_str(), NULL) : -1;
+}
+
+// set a header, replacing it if present in any case
+void merge_header(RestClient::HeaderFields* headers, const std::string& name,
+                  const std::string& value) {
+  std::string key = lower(name);
+  for (RestClient::HeaderFields::iterator it = headers->begin();
+       it != headers->end(); ++it) {
+    if (lower(it->first) == key) {
+      it->second = value;
+      return;
+    }
+  }
+  (*headers)[name] = value;
+}
+
+/**
+ * @brief work out freshness lifetime and age of a response as it arrives
+ *
+ * @param headers of the response
+ * @param now time the response was received
+ *
+ * @return parsed caching information
+ */
+CacheControl parse_cache_control(const RestClient::HeaderFields& headers,
+                                 time_t now) {
+  CacheControl cc = {false, false, -1, 0};
+  const std::string* value =
+    RestClient::Helpers::find_header(headers, "Cache-Control");
+  if (value) {
+    std::string directives = lower(*value);
+    size_t start = 0;
+    while (start <= directives.size()) {
+      size_t end = directives.find(',', start);
+      if (end == std::string::npos) {
+        end = directives.size();
+      }
+      std::string directive = directives.substr(start, end - start);
+      RestClient::Helpers::trim(directive);
+      if (directive == "no-store") {
+        cc.noStore = true;
+      } else if (directive == "no-cache") {
+        cc.noCache = true;
+      } else if (directive.compare(0, 8, "max-age=") == 0) {
+        std::string seconds = directive.substr(8);
+        if (!seconds.empty() && seconds[0] == '"') {
+          seconds = seconds.substr(1);
+        }
+        cc.lifetime = std::strtol(seconds.c_str(), NULL, 10);
+      }
+      start = end + 1;
+    }
+  }
+
+  time_t date = header_date(headers, "Date");
+  if (date < 0) {
+    date = now;
+  }
+  if (cc.lifetime < 0) {
+    cc.lifetime = 0;
+    if (RestClient::Helpers::find_header(headers, "Expires")) {
+      // an unparsable Expires, like "0", means already expired
+      time_t expires = header_date(headers, "Expires");
+      if (expires > date) {
+        cc.lifetime = static_cast<long>(expires - date);  // NOLINT
+      }
+    } else {
+      // heuristic freshness: a tenth of the time since the last change
+      time_t modified = header_date(headers, "Last-Modified");
+      if (modified >= 0 && modified < date) {
+        cc.lifetime = static_cast<long>(date - modified) / 10;  // NOLINT
+      }
+    }
+  }
+
+  const std::string* age = RestClient::Helpers::find_header(headers, "Age");
+  cc.age = age ? std::strtol(age->c_str(), NULL, 10) : 0;
+  if (now > date && static_cast<long>(now - date) > cc.age) {  // NOLINT
+    cc.age = static_cast<long>(now - date);  // NOLINT
+  }
+  return cc;
+}
+
+}  // namespace
+
+/**
+ * @brief constructor for the ResponseCache object
+ *
+ * @param maxBytes - upper bound for the size of all bodies kept in memory
+ *
+ */
+RestClient::ResponseCache::ResponseCache(size_t maxBytes)
+                               : entries(), index(), bytes(0),
+                                 mappedCount(0), disk(NULL) {
+  this->maxBytes = maxBytes;
+}
+
+/**
+ * @brief get the cache shared by the whole process. Never destroyed, like
+ * the connection pool.
+ *
+ * @return cache instance
+ */
+RestClient::ResponseCache&
+RestClient::ResponseCache::instance() {
+  static RestClient::ResponseCache* cache = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    cache = new RestClient::ResponseCache(32 * 1024 * 1024);
+  });
+  return *cache;
+}
+
+/**
+ * @brief look for a stored response before sending a GET
+ *
+ * @param url that is about to be requested
+ * @param requestHeaders that will be sent, matched against Vary
+ * @param response receives the stored response if it is fresh
+ * @param conditional receives If-None-Match / If-Modified-Since for a stale
+ * response that can be revalidated
+ * @param mappedBody receives the body of a response read from disk instead
+ * of response->body, NULL to always copy it into response->body
+ *
+ * @return true if response was filled and no request is needed
+ */
+bool
+RestClient::ResponseCache::Lookup(
+    const std::string& url,
+    const RestClient::HeaderFields& requestHeaders,
+    RestClient::Response* response,
+    RestClient::HeaderFields* conditional,
+    std::shared_ptr<RestClient::MappedFile>* mappedBody) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<std::string, EntryList::iterator>::iterator it = this->find(url);
+  if (it == this->index.end() ||
+      !this->varyMatches(*it->second, requestHeaders)) {
+    return false;
+  }
+  Entry& entry = *it->second;
+  this->entries.splice(this->entries.begin(), this->entries, it->second);
+
+  int64_t age = entry.record.ageAtStore +
+                static_cast<int64_t>(time(NULL)) - entry.record.storedAt;
+  if (!entry.record.mustRevalidate && age < entry.record.lifetime) {
+    this->fill(entry, response, mappedBody);
+    return true;
+  }
+
+  const RestClient::HeaderFields& stored = entry.record.headers;
+  const std::string* etag = Helpers::find_header(stored, "ETag");
+  if (etag) {
+    (*conditional)["If-None-Match"] = *etag;
+  }
+  const std::string* modified = Helpers::find_header(stored, "Last-Modified");
+  if (modified) {
+    (*conditional)["If-Modified-Since"] = *modified;
+  }
+  return false;
+}
+
+/**
+ * @brief store the response of a GET, or complete a revalidation
+ *
+ * @param url that was requested
+ * @param requestHeaders that were sent, without the conditional ones
+ * @param response that was received
+ * @param mappedBody like for Lookup(), receives the body of a revalidated
+ * response read from disk
+ *
+ * @return the stored response with the timing of this request for a 304
+ * that matches a stored response, response otherwise. A 304 is returned
+ * as it is when the stored response was dropped since Lookup() and is not
+ * on disk either, the request then has to be sent again without the
+ * conditional headers.
+ */
+RestClient::Response
+RestClient::ResponseCache::Update(
+    const std::string& url,
+    const RestClient::HeaderFields& requestHeaders,
+    const RestClient::Response& response,
+    std::shared_ptr<RestClient::MappedFile>* mappedBody) {
+  time_t now = time(NULL);
+  std::unique_lock<std::mutex> lock(this->mutex);
+  // evicted from memory since Lookup() the response may still be on disk
+  std::map<std::string, EntryList::iterator>::iterator it =
+    response.code == 304 ? this->find(url) : this->index.find(url);
+
+  if (response.code == 304) {
+    if (it == this->index.end() ||
+        !this->varyMatches(*it->second, requestHeaders)) {
+      return response;
+    }
+    Entry& entry = *it->second;
+    // the 304 carries updated caching headers for the stored response
+    for (RestClient::HeaderFields::const_iterator h =
+         response.headers.begin(); h != response.headers.end(); ++h) {
+      if (h->first.compare(0, 5, "HTTP/") != 0 &&
+          lower(h->first) != "content-length") {
+        merge_header(&entry.record.headers, h->first, h->second);
+      }
+    }
+    CacheControl cc = parse_cache_control(entry.record.headers, now);
+    entry.record.storedAt = now;
+    entry.record.ageAtStore = cc.age;
+    entry.record.lifetime = cc.lifetime;
+    entry.record.mustRevalidate = cc.noCache;
+    this->entries.splice(this->entries.begin(), this->entries, it->second);
+    if (this->disk) {
+      this->disk->Update(entry.record);
+    }
+
+    RestClient::Response ret;
+    this->fill(entry, &ret, mappedBody);
+    ret.timing = response.timing;
+    return ret;
+  }
+
+  if (response.code != 200) {
+    return response;
+  }
+
+  CacheControl cc = parse_cache_control(response.headers, now);
+  const std::string* vary = Helpers::find_header(response.headers, "Vary");
+  bool validators =
+    Helpers::find_header(response.headers, "ETag") != NULL ||
+    Helpers::find_header(response.headers, "Last-Modified") != NULL;
+  if (it != this->index.end()) {
+    this->remove(it);
+  }
+  if (cc.noStore || (vary && vary->find('*') != std::string::npos) ||
+      (cc.lifetime <= 0 && !validators)) {
+    if (this->disk) {
+      this->disk->Remove(url);
+    }
+    return response;
+  }
+
+  Entry entry;
+  entry.record.url = url;
+  entry.record.code = response.code;
+  entry.record.headers = response.headers;
+  if (vary) {
+    size_t start = 0;
+    while (start <= vary->size()) {
+      size_t end = vary->find(',', start);
+      if (end == std::string::npos) {
+        end = vary->size();
+      }
+      std::string name = lower(vary->substr(start, end - start));
+      Helpers::trim(name);
+      if (!name.empty()) {
+        const std::string* value = Helpers::find_header(requestHeaders, name);
+        entry.record.vary[name] = value ? *value : "";
+      }
+      start = end + 1;
+    }
+  }
+  entry.record.storedAt = now;
+  entry.record.ageAtStore = cc.age;
+  entry.record.lifetime = cc.lifetime;
+  entry.record.mustRevalidate = cc.noCache;
+
+  RestClient::DiskCache* disk = this->disk;
+  if (response.body.size() <= this->maxBytes) {
+    entry.body = response.body;
+    this->entries.push_front(entry);
+    this->index[url] = this->entries.begin();
+    this->bytes += response.body.size();
+    this->evict();
+  }
+  lock.unlock();
+
+  // the body is written without holding the lock
+  if (disk) {
+    disk->Put(entry.record, response.body.data(), response.body.size());
+  }
+  return response;
+}
+
+/**
+ * @brief set the disk store responses are also kept in
+ *
+ * @param disk - NULL for none
+ */
+void
+RestClient::ResponseCache::SetDiskCache(RestClient::DiskCache* disk) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->disk = disk;
+}
+
+/**
+ * @brief change the size bound, dropping responses if needed
+ *
+ * @param maxBytes - upper bound for the size of all bodies kept in memory
+ */
+void
+RestClient::ResponseCache::SetMaxBytes(size_t maxBytes) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->maxBytes = maxBytes;
+  this->evict();
+}
+
+/**
+ * @brief get the size of all bodies kept in memory
+ *
+ * @return size in bytes
+ */
+size_t
+RestClient::ResponseCache::Size() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->bytes;
+}
+
+/**
+ * @brief drop all stored responses, on disk too
+ */
+void
+RestClient::ResponseCache::Clear() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->index.clear();
+  this->entries.clear();
+  this->bytes = 0;
+  this->mappedCount = 0;
+  if (this->disk) {
+    this->disk->Clear();
+  }
+}
+
+/**
+ * @brief check that a request asks for the same variant as a stored
+ * response, by comparing the headers the response named in Vary
+ *
+ * @param entry stored response
+ * @param requestHeaders of the new request
+ *
+ * @return true if the stored response may be used
+ */
+bool
+RestClient::ResponseCache::varyMatches(
+    const Entry& entry, const RestClient::HeaderFields& requestHeaders) {
+  for (RestClient::HeaderFields::const_iterator it =
+       entry.record.vary.begin(); it != entry.record.vary.end(); ++it) {
+    const std::string* value = Helpers::find_header(requestHeaders, it->first);
+    if ((value ? *value : "") != it->second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief turn a stored entry into a response
+ *
+ * @param entry stored response
+ * @param response to fill, its timing is cleared as nothing was transferred
+ * @param mappedBody receives a mapped body instead of response->body, NULL
+ * to copy it
+ */
+void
+RestClient::ResponseCache::fill(
+    const Entry& entry, RestClient::Response* response,
+    std::shared_ptr<RestClient::MappedFile>* mappedBody) {
+  response->code = entry.record.code;
+  response->headers = entry.record.headers;
+  response->timing = RestClient::RequestInfo();
+  if (!entry.mapped) {
+    response->body = entry.body;
+  } else if (mappedBody) {
+    response->body.clear();
+    *mappedBody = entry.mapped;
+  } else {
+    response->body.assign(entry.mapped->data(), entry.mapped->size());
+  }
+}
+
+/**
+ * @brief find the stored response for a URL, reading it from disk if it is
+ * not in memory, the mutex must be held
+ *
+ * @param url of the response
+ *
+ * @return index entry of the response, index.end() if there is none
+ */
+std::map<std::string, RestClient::ResponseCache::EntryList::iterator>::iterator
+RestClient::ResponseCache::find(const std::string& url) {
+  std::map<std::string, EntryList::iterator>::iterator it =
+    this->index.find(url);
+  if (it == this->index.end() && this->disk) {
+    Entry entry;
+    if (this->disk->Find(url, &entry.record, &entry.mapped)) {
+      // mapped bodies count against MAX_MAPPED, not the memory bound
+      this->entries.push_front(entry);
+      this->index[url] = this->entries.begin();
+      this->mappedCount++;
+      this->evict();
+      it = this->index.find(url);
+    }
+  }
+  return it;
+}
+
+/**
+ * @brief drop one response from memory, the mutex must be held
+ *
+ * @param it index entry of the response
+ */
+void
+RestClient::ResponseCache::remove(
+    std::map<std::string, EntryList::iterator>::iterator it) {
+  this->bytes -= it->second->body.size();
+  if (it->second->mapped) {
+    this->mappedCount--;
+  }
+  this->entries.erase(it->second);
+  this->index.erase(it);
+}
+
+/**
+ * @brief drop least recently used responses from memory until the size
+ * bound holds and at most MAX_MAPPED are mapped, the mutex must be held
+ */
+void
+RestClient::ResponseCache::evict() {
+  while (this->bytes > this->maxBytes && !this->entries.empty()) {
+    this->remove(this->index.find(this->entries.back().record.url));
+  }
+  EntryList::iterator entry = this->entries.end();
+  while (this->mappedCount > MAX_MAPPED && entry != this->entries.begin()) {
+    --entry;
+    if (entry->mapped) {
+      EntryList::iterator next = entry;
+      ++next;
+      this->remove(this->index.find(entry->record.url));
+      entry = next;
+    }
+  }
+}
@@ -0,0 +1,127 @@
+/**
+ * @file responsecache.h
+ * @brief in memory HTTP cache for GET responses
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_RESPONSECACHE_H_
+#define INCLUDE_RESTCLIENT_CPP_RESPONSECACHE_H_
+
+#include <ctime>
+#include <string>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "restclient.h"
+#include "diskcache.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief stores GET responses keyed by URL, following the freshness rules
+  * of a private HTTP cache.
+  *
+  * Responses are fresh for Cache-Control max-age, else until Expires, else
+  * for a tenth of the time since Last-Modified. Fresh responses are served
+  * without a request. Stale ones that have an ETag or Last-Modified are
+  * revalidated with If-None-Match / If-Modified-Since, and a 304 answer is
+  * turned back into the stored response. no-store responses are never kept,
+  * no-cache ones are revalidated every time.
+  *
+  * With a DiskCache attached, responses are also written to disk, and
+  * responses not in memory are looked up there, e.g. after a restart.
+  *
+  * Usage is split in two calls around the request so it works with any
+  * transport:
+  *
+  *   RestClient::Response res;
+  *   RestClient::HeaderFields conditional;
+  *   if (!cache.Lookup(url, headers, &res, &conditional, NULL)) {
+  *     // send the request with headers + conditional
+  *     res = cache.Update(url, headers, res, NULL);
+  *     // a 304 only comes back if the stored response went away
+  *     // meanwhile, send the request again with headers alone
+  *   }
+  *
+  * Passing a MappedFile pointer instead of NULL hands out bodies read from
+  * disk as their mapping, leaving Response::body empty, so they need not be
+  * copied.
+  */
+class ResponseCache {
+ public:
+    // maxBytes bounds the stored bodies, least recently used go first.
+    // Responses read from disk stay mapped instead, at most MAX_MAPPED.
+    explicit ResponseCache(size_t maxBytes);
+
+    // the cache shared by the whole process, 32 MB
+    static ResponseCache& instance();
+
+    // true if a fresh response for url was copied to response. Otherwise
+    // conditional receives the headers to add to the request, if any.
+    bool Lookup(const std::string& url,
+                const RestClient::HeaderFields& requestHeaders,
+                RestClient::Response* response,
+                RestClient::HeaderFields* conditional,
+                std::shared_ptr<RestClient::MappedFile>* mappedBody);
+
+    // store a response received for url. A 304 for a stored response is
+    // returned as the stored response, anything else as it is. So is a 304
+    // if the stored response has gone since Lookup().
+    RestClient::Response Update(const std::string& url,
+                                const RestClient::HeaderFields& requestHeaders,
+                                const RestClient::Response& response,
+                                std::shared_ptr<RestClient::MappedFile>*
+                                  mappedBody);
+
+    // also keep responses on disk, NULL to stop. Has to outlive the cache.
+    void SetDiskCache(RestClient::DiskCache* disk);
+
+    void SetMaxBytes(size_t maxBytes);
+
+    // size of all stored bodies
+    size_t Size();
+
+    void Clear();
+
+ private:
+    // the body is in memory, or mapped if the entry was read from disk
+    typedef struct {
+      RestClient::DiskCache::Record record;
+      std::string body;
+      std::shared_ptr<RestClient::MappedFile> mapped;
+    } Entry;
+    typedef std::list<Entry> EntryList;
+
+    // mapped entries kept, each holds a mapping and with it a file the
+    // DiskCache may already have evicted
+    static const size_t MAX_MAPPED = 64;
+
+    ResponseCache(const ResponseCache&);
+    ResponseCache& operator=(const ResponseCache&);
+
+    bool varyMatches(const Entry& entry,
+                     const RestClient::HeaderFields& requestHeaders);
+    std::map<std::string, EntryList::iterator>::iterator find(
+        const std::string& url);
+    void fill(const Entry& entry, RestClient::Response* response,
+              std::shared_ptr<RestClient::MappedFile>* mappedBody);
+    void remove(std::map<std::string, EntryList::iterator>::iterator it);
+    void evict();
+
+    std::mutex mutex;
+    // most recently used first
+    EntryList entries;
+    std::map<std::string, EntryList::iterator> index;
+    size_t maxBytes;
+    size_t bytes;
+    size_t mappedCount;
+    RestClient::DiskCache* disk;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_RESPONSECACHE_H_
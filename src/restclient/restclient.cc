@@ -3,10 +3,11 @@
  * @brief implementation of the restclient class
  *
  * This just provides static wrappers around the Connection class REST
- * methods. However since I didn't want to have to pull in a whole URI parsing
- * library just now, the Connection constructor is passed an empty string and
- * the full URL is passed to the REST methods. All those methods to is
- * concatenate them anyways. So this should do for now.
+ * methods. Each call checks a Connection out of the process wide
+ * ConnectionPool for the origin of its URL and checks it back in when done,
+ * so consecutive calls to the same origin reuse the open socket and TLS
+ * session. Pooled connections have no base URL, the full URL is passed to the
+ * REST methods.
  *
  * @author Daniel Schauenberg <d@unwiredcouch.com>
  */
@@ -15,8 +16,14 @@
 
 #include <curl/curl.h>
 
+#include <string>
+#include <utility>
+
 #include "version.h"
 #include "connection.h"
+#include "connectionpool.h"
+#include "responsecache.h"
+#include "singleflight.h"
 
 /**
  * @brief global init function. Call this before you start any threads.
@@ -35,9 +42,27 @@ int RestClient::init() {
  * program.
  */
 void RestClient::disable() {
+  RestClient::ConnectionPool::instance().Clear();
   curl_global_cleanup();
 }
 
+/**
+ * @brief get the headers the simple API sends with a GET, so other backends
+ * can send the same
+ *
+ * @return header fields
+ */
+RestClient::HeaderFields RestClient::defaultHeaders() {
+  RestClient::HeaderFields headers;
+  headers["User-Agent"] = "Mozilla/5.0 (Windows NT 10.0; WOW64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/69.0.3497.100 Safari/537.36";
+  headers["Accept"] = "*/*";
+  headers["Accept-Charset"] = "GB2312,utf-8;q=0.7,*;q=0.7";
+  headers["Accept-Language"] = "zh-cn,zh;q=0.5";
+  headers["Content-Type"] = "application/json;charset=UTF-8";
+  headers["Connection"] = "Keep-Alive";
+  return headers;
+}
+
 /**
  * @brief HTTP GET method
  *
@@ -46,16 +71,136 @@ void RestClient::disable() {
  * @return response struct
  */
 RestClient::Response RestClient::get(const std::string& url) {
+  return RestClient::get(url, 0);
+}
+
+/**
+ * @brief HTTP GET method with a transfer timeout
+ *
+ * @param url to query
+ * @param timeout in seconds, 0 to wait forever
+ *
+ * @return response struct
+ */
+RestClient::Response RestClient::get(const std::string& url, int timeout) {
+  return RestClient::get(url, timeout, NULL);
+}
+
+/**
+ * @brief HTTP GET method answered from a response cache where possible.
+ * Fresh cached responses are returned without a request, stale ones are
+ * revalidated and a 304 comes back as the cached response.
+ *
+ * @param url to query
+ * @param timeout in seconds, 0 to wait forever
+ * @param cache to use, NULL for none
+ *
+ * @return response struct
+ */
+RestClient::Response RestClient::get(const std::string& url, int timeout,
+                                     RestClient::ResponseCache* cache) {
+  return RestClient::get(url, timeout, cache, NULL);
+}
+
+/**
+ * @brief HTTP GET method answered from a response cache where possible,
+ * handing out bodies the cache read from disk without copying them
+ *
+ * @param url to query
+ * @param timeout in seconds, 0 to wait forever
+ * @param cache to use, NULL for none
+ * @param mappedBody receives the body instead of Response::body if it comes
+ * from the disk cache, NULL to always get it in Response::body
+ *
+ * @return response struct
+ */
+RestClient::Response RestClient::get(
+    const std::string& url, int timeout, RestClient::ResponseCache* cache,
+    std::shared_ptr<RestClient::MappedFile>* mappedBody) {
+  RestClient::Deadlines deadlines = {0, 0, timeout * 1000};
+  return RestClient::get(url, deadlines, cache, mappedBody,
+                         RestClient::CancelFlag());
+}
+
+/**
+ * @brief HTTP GET method with millisecond deadlines that can be cancelled
+ * from another thread, answered from a response cache where possible
+ *
+ * @param url to query
+ * @param deadlines for connecting, the first byte and the whole request
+ * @param cache to use, NULL for none
+ * @param mappedBody receives the body instead of Response::body if it comes
+ * from the disk cache, NULL to always get it in Response::body
+ * @param cancel aborts the request once set, NULL for none. Cancellable
+ * requests are never shared with identical ones in flight.
+ *
+ * @return response struct
+ */
+RestClient::Response RestClient::get(
+    const std::string& url, const RestClient::Deadlines& deadlines,
+    RestClient::ResponseCache* cache,
+    std::shared_ptr<RestClient::MappedFile>* mappedBody,
+    const RestClient::CancelFlag& cancel) {
   RestClient::Response ret;
-  RestClient::Connection *conn = new RestClient::Connection("");
-  conn->AppendHeader("User-Agent", "Mozilla/5.0 (Windows NT 10.0; WOW64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/69.0.3497.100 Safari/537.36");
-  conn->AppendHeader("Accept", "*/*");
-  conn->AppendHeader("Accept-Charset","GB2312,utf-8;q=0.7,*;q=0.7");
-  conn->AppendHeader("Accept-Language","zh-cn,zh;q=0.5");
-  conn->AppendHeader("Content-Type", "application/json;charset=UTF-8");
-  conn->AppendHeader("Connection","Keep-Alive");
-  ret = conn->get(url);
-  delete conn;
+  RestClient::HeaderFields headers = RestClient::defaultHeaders();
+
+  RestClient::HeaderFields conditional;
+  if (cache && cache->Lookup(url, headers, &ret, &conditional, mappedBody)) {
+    return ret;
+  }
+
+  RestClient::SingleFlight::Fetch fetch =
+      [&](RestClient::SingleFlight::Result* fetched) {
+    for (;;) {
+      RestClient::Connection *conn =
+        RestClient::ConnectionPool::instance().checkout(url);
+      conn->SetDeadlines(deadlines);
+      conn->SetCancelFlag(cancel);
+      conn->SetHeaders(headers);
+      conn->SetCompression(true);
+      for (RestClient::HeaderFields::const_iterator it = conditional.begin();
+           it != conditional.end(); ++it) {
+        conn->AppendHeader(it->first, it->second);
+      }
+      fetched->response = conn->get(url);
+      RestClient::ConnectionPool::instance().checkin(url, conn);
+      if (!cache) {
+        return;
+      }
+      fetched->response = cache->Update(url, headers, fetched->response,
+                                        &fetched->mappedBody);
+      // the cached response was dropped since Lookup(), so the 304 has
+      // nothing to complete. Ask for the full response instead.
+      if (fetched->response.code != 304 || conditional.empty()) {
+        return;
+      }
+      conditional.clear();
+    }
+  };
+
+  RestClient::SingleFlight::Result result;
+  if (cancel) {
+    fetch(&result);
+  } else {
+    // identical GETs in flight at the same time share one transfer.
+    // Callers with other deadlines or without the cache may get a different
+    // answer, so they do not share.
+    std::string key = RestClient::SingleFlight::Key("GET", url, headers);
+    key += std::to_string(deadlines.connectMs) + " " +
+           std::to_string(deadlines.firstByteMs) + " " +
+           std::to_string(deadlines.totalMs);
+    key += cache ? " cache" : "";
+    RestClient::SingleFlight::instance().Do(key, fetch, &result, NULL);
+  }
+
+  ret = std::move(result.response);
+  if (result.mappedBody) {
+    if (mappedBody) {
+      *mappedBody = result.mappedBody;
+    } else {
+      ret.body.assign(result.mappedBody->data(), result.mappedBody->size());
+    }
+  }
   return ret;
 }
 
@@ -72,10 +217,11 @@ RestClient::Response RestClient::post(const std::string& url,
                                       const std::string& ctype,
                                       const std::string& data) {
   RestClient::Response ret;
-  RestClient::Connection *conn = new RestClient::Connection("");
+  RestClient::Connection *conn =
+    RestClient::ConnectionPool::instance().checkout(url);
   conn->AppendHeader("Content-Type", ctype);
   ret = conn->post(url, data);
-  delete conn;
+  RestClient::ConnectionPool::instance().checkin(url, conn);
   return ret;
 }
 
@@ -92,10 +238,11 @@ RestClient::Response RestClient::put(const std::string& url,
                                      const std::string& ctype,
                                      const std::string& data) {
   RestClient::Response ret;
-  RestClient::Connection *conn = new RestClient::Connection("");
+  RestClient::Connection *conn =
+    RestClient::ConnectionPool::instance().checkout(url);
   conn->AppendHeader("Content-Type", ctype);
   ret = conn->put(url, data);
-  delete conn;
+  RestClient::ConnectionPool::instance().checkin(url, conn);
   return ret;
 }
 
@@ -108,9 +255,10 @@ RestClient::Response RestClient::put(const std::string& url,
  */
 RestClient::Response RestClient::del(const std::string& url) {
   RestClient::Response ret;
-  RestClient::Connection *conn = new RestClient::Connection("");
+  RestClient::Connection *conn =
+    RestClient::ConnectionPool::instance().checkout(url);
   ret = conn->del(url);
-  delete conn;
+  RestClient::ConnectionPool::instance().checkin(url, conn);
   return ret;
 }
 
@@ -123,8 +271,9 @@ RestClient::Response RestClient::del(const std::string& url) {
  */
 RestClient::Response RestClient::head(const std::string& url) {
   RestClient::Response ret;
-  RestClient::Connection *conn = new RestClient::Connection("");
+  RestClient::Connection *conn =
+    RestClient::ConnectionPool::instance().checkout(url);
   ret = conn->head(url);
-  delete conn;
+  RestClient::ConnectionPool::instance().checkin(url, conn);
   return ret;
 }
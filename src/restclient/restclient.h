@@ -11,7 +11,11 @@
 
 #include <string>
 #include <map>
+#include <atomic>
 #include <cstdlib>
+#include <cstdint>
+#include <functional>
+#include <memory>
 
 #include "version.h"
 
@@ -25,6 +29,152 @@ namespace RestClient {
   */
 typedef std::map<std::string, std::string> HeaderFields;
 
+/**
+  * @brief what a ChunkSink wants the transfer to do after a chunk
+  * SINK_CONTINUE - the chunk was consumed, go on
+  * SINK_PAUSE - the chunk was NOT consumed, pause the transfer and deliver
+  * it again once resumed (only supported for MultiClient transfers)
+  * SINK_ABORT - stop the transfer, it fails with code -1
+  */
+enum SinkResult {
+  SINK_CONTINUE = 0,
+  SINK_PAUSE = 1,
+  SINK_ABORT = 2
+};
+
+/**
+  * @brief receives response body chunks as they arrive instead of having
+  * them collected into Response::body, returns a SinkResult
+  */
+typedef std::function<int(const char* data, size_t length)> ChunkSink;
+
+/**
+  * @brief what a ChunkSource returns instead of a byte count
+  * SOURCE_PAUSE - nothing to send right now, pause the upload until
+  * resumed (only supported for MultiClient transfers)
+  * SOURCE_ABORT - stop the transfer, it fails with code -1
+  */
+enum SourceResult {
+  SOURCE_PAUSE = -1,
+  SOURCE_ABORT = -2
+};
+
+/**
+  * @brief produces the request body chunk by chunk instead of taking it
+  * from a string. Writes up to length bytes into buffer and returns how
+  * many it wrote, 0 once the body is complete, or a SourceResult
+  */
+typedef std::function<int64_t(char* buffer, size_t length)> ChunkSource;
+
+/**
+  * @brief gets told how much of the request body was sent so far and its
+  * total size, -1 if unknown
+  */
+typedef std::function<void(int64_t sent, int64_t total)> UploadProgress;
+
+/**
+  * @brief set to true to cancel the requests it was handed to. They end
+  * with code -1 and the body "Request aborted."
+  */
+typedef std::shared_ptr<std::atomic<bool> > CancelFlag;
+
+/**
+  *  @struct Deadlines
+  *  @brief time limits of a request in milliseconds, 0 for none
+  *  @var Deadlines::connectMs
+  *  Member 'connectMs' limits connecting, TLS handshake included. See
+  *  CURLOPT_CONNECTTIMEOUT_MS
+  *  @var Deadlines::firstByteMs
+  *  Member 'firstByteMs' limits the time from the start until the first
+  *  response byte arrives. It is checked from the progress callback, which
+  *  libcurl calls about once a second while nothing arrives, so on a
+  *  blocking Connection it can fire up to a second late. MultiClient wakes
+  *  up for it on time.
+  *  @var Deadlines::totalMs
+  *  Member 'totalMs' limits the whole request. See CURLOPT_TIMEOUT_MS
+  *
+  *  A request that misses a deadline ends with code 28
+  *  (CURLE_OPERATION_TIMEDOUT) and the body "Operation Timeout."
+  */
+typedef struct {
+  int connectMs;
+  int firstByteMs;
+  int totalMs;
+} Deadlines;
+
+/**
+  *  @struct RequestInfo
+  *  @brief holds some diagnostics information
+  *  about a request
+  *  @var RequestInfo::totalTime
+  *  Member 'totalTime' contains the total time of the last request in
+  *  seconds Total time of previous transfer. See CURLINFO_TOTAL_TIME
+  *  @var RequestInfo::nameLookupTime
+  *  Member 'nameLookupTime' contains the time spent in DNS lookup in
+  *  seconds Time from start until name resolving completed. See
+  *  CURLINFO_NAMELOOKUP_TIME
+  *  @var RequestInfo::connectTime
+  *  Member 'connectTime' contains the time it took until Time from start
+  *  until remote host or proxy completed. See CURLINFO_CONNECT_TIME
+  *  @var RequestInfo::appConnectTime
+  *  Member 'appConnectTime' contains the time from start until SSL/SSH
+  *  handshake completed. See CURLINFO_APPCONNECT_TIME
+  *  @var RequestInfo::preTransferTime
+  *  Member 'preTransferTime' contains the total time from start until
+  *  just before the transfer begins. See CURLINFO_PRETRANSFER_TIME
+  *  @var RequestInfo::startTransferTime
+  *  Member 'startTransferTime' contains the total time from start until
+  *  just when the first byte is received. See CURLINFO_STARTTRANSFER_TIME
+  *  @var RequestInfo::redirectTime
+  *  Member 'redirectTime' contains the total time taken for all redirect
+  *  steps before the final transfer. See CURLINFO_REDIRECT_TIME
+  *  @var RequestInfo::redirectCount
+  *  Member 'redirectCount' contains the number of redirects followed. See
+  *  CURLINFO_REDIRECT_COUNT
+  *  @var RequestInfo::uploadSize
+  *  Member 'uploadSize' contains the number of body bytes sent. See
+  *  CURLINFO_SIZE_UPLOAD_T
+  *  @var RequestInfo::downloadSize
+  *  Member 'downloadSize' contains the number of body bytes received, before
+  *  any content decoding. See CURLINFO_SIZE_DOWNLOAD_T
+  *  @var RequestInfo::decodedSize
+  *  Member 'decodedSize' contains the number of body bytes after content
+  *  decoding, equal to downloadSize for uncompressed responses
+  *  @var RequestInfo::connectionReused
+  *  Member 'connectionReused' is true if no new connection had to be opened
+  *  for the request. See CURLINFO_NUM_CONNECTS
+  *  @var RequestInfo::httpVersion
+  *  Member 'httpVersion' contains the HTTP version used ("1.0", "1.1", "2",
+  *  "3"), empty if no response was received. See CURLINFO_HTTP_VERSION
+  *  @var RequestInfo::remoteIp
+  *  Member 'remoteIp' contains the IP address of the server or proxy
+  *  connected to. See CURLINFO_PRIMARY_IP
+  *  @var RequestInfo::responseCode
+  *  Member 'responseCode' contains the last HTTP status received, also when
+  *  the transfer failed after it, 0 if none. See CURLINFO_RESPONSE_CODE
+  *  @var RequestInfo::effectiveUrl
+  *  Member 'effectiveUrl' contains the URL last requested, differing from
+  *  the one asked for after redirects. See CURLINFO_EFFECTIVE_URL
+  */
+typedef struct {
+  double totalTime;
+  double nameLookupTime;
+  double connectTime;
+  double appConnectTime;
+  double preTransferTime;
+  double startTransferTime;
+  double redirectTime;
+  int redirectCount;
+  uint64_t uploadSize;
+  uint64_t downloadSize;
+  uint64_t decodedSize;
+  bool connectionReused;
+  std::string httpVersion;
+  std::string remoteIp;
+  int responseCode;
+  std::string effectiveUrl;
+} RequestInfo;
+
 /** @struct Response
   *  @brief This structure represents the HTTP response data
   *  @var Response::code
@@ -33,23 +183,40 @@ typedef std::map<std::string, std::string> HeaderFields;
   *  Member 'body' contains the HTTP response body
   *  @var Response::headers
   *  Member 'headers' contains the HTTP response headers
+  *  @var Response::timing
+  *  Member 'timing' contains the diagnostics of the request that produced
+  *  this response
   */
 typedef struct {
   int code;
   std::string body;
   HeaderFields headers;
+  RequestInfo timing;
 } Response;
 
+class ResponseCache;
+class MappedFile;
+
 // init and disable functions
 int init();
 void disable();
 
+// headers get() sends, for other backends to send the same
+HeaderFields defaultHeaders();
+
 /**
   * public methods for the simple API. These don't allow a lot of
   * configuration but are meant for simple HTTP calls.
   *
   */
 Response get(const std::string& url);
+Response get(const std::string& url, int timeout);
+Response get(const std::string& url, int timeout, ResponseCache* cache);
+Response get(const std::string& url, int timeout, ResponseCache* cache,
+             std::shared_ptr<MappedFile>* mappedBody);
+Response get(const std::string& url, const Deadlines& deadlines,
+             ResponseCache* cache, std::shared_ptr<MappedFile>* mappedBody,
+             const CancelFlag& cancel);
 Response post(const std::string& url,
               const std::string& content_type,
               const std::string& data);
@@ -0,0 +1,172 @@
+/**
+ * @file retrypolicy.cpp
+ * @brief implementation of the retry policy
+ */
+
+#include "retrypolicy.h"
+
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "version.h"
+
+/**
+ * @brief constructor for the RetryPolicy object with the default settings
+ */
+RestClient::RetryPolicy::RetryPolicy() {
+  this->maxAttempts = 3;
+  this->baseDelayMs = 100;
+  this->maxDelayMs = 5000;
+  this->jitter = 1.0;
+  this->retryableStatus.insert(408);
+  this->retryableStatus.insert(429);
+  this->retryableStatus.insert(500);
+  this->retryableStatus.insert(502);
+  this->retryableStatus.insert(503);
+  this->retryableStatus.insert(504);
+  this->idempotentOnly = true;
+}
+
+/**
+ * @brief set how often a request is attempted in total
+ *
+ * @param attempts - values below 1 count as 1
+ */
+void
+RestClient::RetryPolicy::SetMaxAttempts(int attempts) {
+  this->maxAttempts = attempts < 1 ? 1 : attempts;
+}
+
+/**
+ * @brief get how often a request is attempted in total
+ *
+ * @return attempts, at least 1
+ */
+int
+RestClient::RetryPolicy::MaxAttempts() const {
+  return this->maxAttempts;
+}
+
+/**
+ * @brief set the exponential backoff
+ *
+ * @param baseDelayMs - delay before the first retry
+ * @param maxDelayMs - no delay is longer than this
+ */
+void
+RestClient::RetryPolicy::SetBackoff(int baseDelayMs, int maxDelayMs) {
+  this->baseDelayMs = baseDelayMs < 0 ? 0 : baseDelayMs;
+  this->maxDelayMs = maxDelayMs < this->baseDelayMs ? this->baseDelayMs
+                                                     : maxDelayMs;
+}
+
+/**
+ * @brief set how much of each delay is random
+ *
+ * @param jitter - 0 for fixed delays, 1 for anywhere between 0 and the delay
+ */
+void
+RestClient::RetryPolicy::SetJitter(double jitter) {
+  this->jitter = jitter < 0 ? 0 : (jitter > 1 ? 1 : jitter);
+}
+
+/**
+ * @brief set the response codes that are retried
+ *
+ * @param codes - HTTP status codes
+ */
+void
+RestClient::RetryPolicy::SetRetryableStatus(const std::set<int>& codes) {
+  this->retryableStatus = codes;
+}
+
+/**
+ * @brief set whether only idempotent methods are retried
+ *
+ * @param idempotentOnly - false to retry POST and friends as well
+ */
+void
+RestClient::RetryPolicy::SetIdempotentOnly(bool idempotentOnly) {
+  this->idempotentOnly = idempotentOnly;
+}
+
+/**
+ * @brief check whether repeating a request with this method is safe
+ *
+ * @param method HTTP verb in upper case
+ *
+ * @return true for GET, HEAD, OPTIONS, TRACE, PUT and DELETE
+ */
+bool
+RestClient::RetryPolicy::IsIdempotent(const std::string& method) {
+  return method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+         method == "TRACE" || method == "PUT" || method == "DELETE";
+}
+
+/**
+ * @brief check whether another attempt is allowed
+ *
+ * @param method HTTP verb in upper case
+ * @param attempt number of attempts made so far
+ *
+ * @return true if the request may be tried again
+ */
+bool
+RestClient::RetryPolicy::CanRetry(const std::string& method,
+                                  int attempt) const {
+  if (attempt >= this->maxAttempts) {
+    return false;
+  }
+  return !this->idempotentOnly || IsIdempotent(method);
+}
+
+/**
+ * @brief check whether a response code is worth another attempt
+ *
+ * @param code HTTP status code
+ *
+ * @return true if it is one of the retryable codes
+ */
+bool
+RestClient::RetryPolicy::IsRetryableStatus(int code) const {
+  return this->retryableStatus.count(code) > 0;
+}
+
+/**
+ * @brief compute the wait before the next attempt
+ *
+ * @param attempt number of attempts made so far, at least 1
+ * @param retryAfter value of the Retry-After header of the failed response.
+ * Only the delay-seconds form is understood, a date is ignored.
+ *
+ * @return delay in milliseconds
+ */
+int
+RestClient::RetryPolicy::DelayMs(int attempt,
+                                 const std::string& retryAfter) const {
+  double delay = this->baseDelayMs;
+  for (int i = 1; i < attempt && delay < this->maxDelayMs; ++i) {
+    delay *= 2;
+  }
+  if (delay > this->maxDelayMs) {
+    delay = this->maxDelayMs;
+  }
+  if (this->jitter > 0) {
+    static thread_local std::mt19937 random(std::random_device{}());
+    std::uniform_real_distribution<double> fraction(0.0, this->jitter);
+    delay -= delay * fraction(random);
+  }
+  if (!retryAfter.empty()) {
+    char* end = NULL;
+    long seconds = std::strtol(retryAfter.c_str(), &end, 10);  // NOLINT
+    if (end && *end == '\0' && seconds > 0 &&
+        seconds * 1000.0 > delay) {
+      delay = seconds * 1000.0;
+      if (delay > this->maxDelayMs) {
+        delay = this->maxDelayMs;
+      }
+    }
+  }
+  return static_cast<int>(delay);
+}
@@ -0,0 +1,80 @@
+/**
+ * @file retrypolicy.h
+ * @brief when and how soon to retry a failed request
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_RETRYPOLICY_H_
+#define INCLUDE_RESTCLIENT_CPP_RETRYPOLICY_H_
+
+#include <string>
+#include <set>
+
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief decides whether a failed request is tried again and how long to
+  * wait before doing so. It knows nothing about the transport, so the curl
+  * and the WinHTTP backends share it.
+  *
+  * The delay before retry n (starting at 1) is baseDelay * 2^(n-1), capped
+  * at maxDelay. jitter takes a random part of up to that fraction off the
+  * delay, so clients that failed together do not come back together; 1 is
+  * "full jitter". A Retry-After the server sent is used instead when it is
+  * longer, still capped at maxDelay.
+  *
+  * Only GET, HEAD, OPTIONS, PUT and DELETE are retried unless
+  * idempotentOnly is turned off. The policy only computes delays, waiting
+  * them out without blocking a thread is up to the caller (see MultiClient).
+  */
+class RetryPolicy {
+ public:
+    // 3 attempts, 100 ms doubling up to 5 s, full jitter, retrying 408,
+    // 429, 500, 502, 503 and 504 for idempotent methods
+    RetryPolicy();
+
+    // total number of attempts including the first one, 1 disables retries
+    void SetMaxAttempts(int attempts);
+    int MaxAttempts() const;
+
+    // delay before the first retry and upper bound of all delays
+    void SetBackoff(int baseDelayMs, int maxDelayMs);
+
+    // fraction of the delay that is randomised, 0 to 1
+    void SetJitter(double jitter);
+
+    // response codes worth another attempt, replaces the defaults
+    void SetRetryableStatus(const std::set<int>& codes);
+
+    // retry only methods that may be repeated without side effects
+    void SetIdempotentOnly(bool idempotentOnly);
+
+    // true for methods RFC 7231 defines as idempotent
+    static bool IsIdempotent(const std::string& method);
+
+    // attempt is the number of attempts made so far; true if method may be
+    // tried again
+    bool CanRetry(const std::string& method, int attempt) const;
+
+    // true if a response with this code is worth another attempt
+    bool IsRetryableStatus(int code) const;
+
+    // milliseconds to wait before the attempt after attempt, retryAfter is
+    // the Retry-After header of the failed response, empty if none
+    int DelayMs(int attempt, const std::string& retryAfter) const;
+
+ private:
+    int maxAttempts;
+    int baseDelayMs;
+    int maxDelayMs;
+    double jitter;
+    std::set<int> retryableStatus;
+    bool idempotentOnly;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_RETRYPOLICY_H_
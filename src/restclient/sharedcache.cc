@@ -0,0 +1,107 @@
+/**
+ * @file sharedcache.cpp
+ * @brief implementation of the shared curl cache
+ */
+
+#include "sharedcache.h"
+
+#include <curl/curl.h>
+
+#include <stdexcept>
+
+#include "version.h"
+
+/**
+ * @brief constructor for the SharedCache object
+ *
+ * @param shared - combination of DNS, SSL_SESSION and CONNECT
+ *
+ */
+RestClient::SharedCache::SharedCache(int shared) {
+  this->shareHandle = curl_share_init();
+  if (!this->shareHandle) {
+    throw std::runtime_error("Couldn't initialize curl share handle");
+  }
+  curl_share_setopt(this->shareHandle, CURLSHOPT_LOCKFUNC,
+                    RestClient::SharedCache::lock);
+  curl_share_setopt(this->shareHandle, CURLSHOPT_UNLOCKFUNC,
+                    RestClient::SharedCache::unlock);
+  curl_share_setopt(this->shareHandle, CURLSHOPT_USERDATA, this);
+  if (shared & DNS) {
+    curl_share_setopt(this->shareHandle, CURLSHOPT_SHARE,
+                      CURL_LOCK_DATA_DNS);
+  }
+  if (shared & SSL_SESSION) {
+    curl_share_setopt(this->shareHandle, CURLSHOPT_SHARE,
+                      CURL_LOCK_DATA_SSL_SESSION);
+  }
+  if (shared & CONNECT) {
+    curl_share_setopt(this->shareHandle, CURLSHOPT_SHARE,
+                      CURL_LOCK_DATA_CONNECT);
+  }
+}
+
+/**
+ * @brief destructor, all handles using the cache must be gone by now
+ */
+RestClient::SharedCache::~SharedCache() {
+  curl_share_cleanup(this->shareHandle);
+}
+
+/**
+ * @brief get the cache used by the connection pool and the multi client.
+ * Those run transfers on many threads, so it shares DNS results and TLS
+ * sessions but not connections. It is never destroyed, like the pool.
+ *
+ * @return cache instance
+ */
+RestClient::SharedCache&
+RestClient::SharedCache::instance() {
+  static RestClient::SharedCache* cache =
+    new RestClient::SharedCache(DNS | SSL_SESSION);
+  return *cache;
+}
+
+/**
+ * @brief get the curl share handle
+ *
+ * @return share handle
+ */
+CURLSH*
+RestClient::SharedCache::handle() {
+  return this->shareHandle;
+}
+
+/**
+ * @brief lock callback for libcurl
+ *
+ * @param curl easy handle asking for the lock
+ * @param data kind of data to lock
+ * @param access shared or exclusive, both take the same mutex
+ * @param userptr the SharedCache object
+ */
+void
+RestClient::SharedCache::lock(CURL* curl, curl_lock_data data,
+                              curl_lock_access access, void* userptr) {
+  (void)curl;
+  (void)access;
+  RestClient::SharedCache* cache =
+    reinterpret_cast<RestClient::SharedCache*>(userptr);
+  cache->locks[data].lock();
+}
+
+/**
+ * @brief unlock callback for libcurl
+ *
+ * @param curl easy handle releasing the lock
+ * @param data kind of data to unlock
+ * @param userptr the SharedCache object
+ */
+void
+RestClient::SharedCache::unlock(CURL* curl, curl_lock_data data,
+                                void* userptr) {
+  (void)curl;
+  RestClient::SharedCache* cache =
+    reinterpret_cast<RestClient::SharedCache*>(userptr);
+  cache->locks[data].unlock();
+}
@@ -0,0 +1,63 @@
+/**
+ * @file sharedcache.h
+ * @brief DNS, TLS session and connection cache shared between connections
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_SHAREDCACHE_H_
+#define INCLUDE_RESTCLIENT_CPP_SHAREDCACHE_H_
+
+#include <curl/curl.h>
+#include <mutex>
+
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief wraps a curl share handle so several Connection objects resolve a
+  * host once and resume TLS sessions instead of doing full handshakes.
+  *
+  * Every shared data kind gets its own mutex, which makes the cache safe to
+  * use from connections running on different threads at the same time.
+  */
+class SharedCache {
+ public:
+    /**
+      *  @brief the kinds of data that can be shared, combine with |
+      */
+    enum {
+      DNS = 1,
+      SSL_SESSION = 2,
+      // libcurl does not support sharing a connection cache between
+      // transfers running concurrently on different threads, so only use
+      // this when all users of the cache run on one thread
+      CONNECT = 4,
+      ALL = DNS | SSL_SESSION | CONNECT
+    };
+
+    explicit SharedCache(int shared);
+    ~SharedCache();
+
+    // DNS and TLS sessions shared by every connection of the process
+    static SharedCache& instance();
+
+    // share handle to set as CURLOPT_SHARE
+    CURLSH* handle();
+
+ private:
+    SharedCache(const SharedCache&);
+    SharedCache& operator=(const SharedCache&);
+
+    static void lock(CURL* curl, curl_lock_data data,
+                     curl_lock_access access, void* userptr);
+    static void unlock(CURL* curl, curl_lock_data data, void* userptr);
+
+    CURLSH* shareHandle;
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_SHAREDCACHE_H_
@@ -0,0 +1,153 @@
+/**
+ * @file singleflight.cpp
+ * @brief implementation of the request coalescing
+ */
+
+#include "singleflight.h"
+
+#include <string>
+
+#include "version.h"
+
+/**
+ * @brief constructor for the SingleFlight object
+ */
+RestClient::SingleFlight::SingleFlight() : calls(), metrics(NULL) {
+}
+
+/**
+ * @brief get the instance shared by the whole process. Never destroyed, so
+ * it is still usable from threads that outlive static destruction.
+ *
+ * @return single flight instance
+ */
+RestClient::SingleFlight&
+RestClient::SingleFlight::instance() {
+  static RestClient::SingleFlight* flight = NULL;
+  static std::once_flag created;
+  std::call_once(created, [] {
+    flight = new RestClient::SingleFlight();
+    flight->SetMetrics(&RestClient::Metrics::instance());
+  });
+  return *flight;
+}
+
+/**
+ * @brief build the key of a request. Header names are kept as given, the
+ * callers of one code path send them the same way.
+ *
+ * @param method HTTP verb
+ * @param url to query
+ * @param headers sent with the request
+ *
+ * @return key
+ */
+std::string
+RestClient::SingleFlight::Key(const std::string& method,
+                              const std::string& url,
+                              const RestClient::HeaderFields& headers) {
+  std::string key = method + " " + url + "\n";
+  for (RestClient::HeaderFields::const_iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    key += it->first;
+    key += ": ";
+    key += it->second;
+    key += "\n";
+  }
+  return key;
+}
+
+/**
+ * @brief run fetch unless a call for the same key is in flight, in which
+ * case wait for that one. fetch runs on the calling thread without the lock
+ * held.
+ *
+ * @param key of the request, see Key()
+ * @param fetch fills in the result, may throw
+ * @param result receives the result of the fetch
+ * @param shared set to whether the result came from another caller's fetch,
+ * may be NULL
+ */
+void
+RestClient::SingleFlight::Do(const std::string& key,
+                             const RestClient::SingleFlight::Fetch& fetch,
+                             RestClient::SingleFlight::Result* result,
+                             bool* shared) {
+  std::shared_ptr<Call> call;
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    std::map<std::string, std::shared_ptr<Call> >::iterator it =
+      this->calls.find(key);
+    if (it != this->calls.end()) {
+      call = it->second;
+      call->waiters++;
+      this->finished.wait(lock, [&call] { return call->done; });
+      lock.unlock();
+      if (shared) {
+        *shared = true;
+      }
+      if (this->metrics) {
+        this->metrics->RecordCoalesced();
+      }
+      if (call->error) {
+        std::rethrow_exception(call->error);
+      }
+      // the shared result is never modified once done is set
+      *result = *call->result;
+      return;
+    }
+    call = std::make_shared<Call>();
+    call->done = false;
+    call->waiters = 0;
+    this->calls[key] = call;
+  }
+
+  std::exception_ptr error;
+  try {
+    fetch(result);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    // no new waiters can arrive once the key is gone
+    this->calls.erase(key);
+  }
+  if (call->waiters > 0 && !error) {
+    call->result = std::make_shared<const Result>(*result);
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    call->done = true;
+    call->error = error;
+  }
+  this->finished.notify_all();
+  if (shared) {
+    *shared = false;
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * @brief set where shared requests are counted
+ *
+ * @param metrics to record into, NULL for none
+ */
+void
+RestClient::SingleFlight::SetMetrics(RestClient::Metrics* metrics) {
+  this->metrics = metrics;
+}
+
+/**
+ * @brief get the number of requests currently shared out
+ *
+ * @return number of keys with a running fetch
+ */
+size_t
+RestClient::SingleFlight::InFlight() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->calls.size();
+}
@@ -0,0 +1,96 @@
+/**
+ * @file singleflight.h
+ * @brief coalescing of identical requests that are in flight at once
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_SINGLEFLIGHT_H_
+#define INCLUDE_RESTCLIENT_CPP_SINGLEFLIGHT_H_
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+
+#include "restclient.h"
+#include "diskcache.h"
+#include "metrics.h"
+#include "version.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief lets concurrent callers asking for the same thing share one
+  * request.
+  *
+  * The first caller for a key runs the fetch, callers arriving with the same
+  * key before it finished block until it is done and get the same result
+  * instead of sending a request of their own. The caller running the fetch
+  * keeps its result as is; only when others are waiting is it copied once
+  * for them. A key is free again as soon as its fetch returned, so later
+  * callers always get a new request. If the fetch throws, every caller
+  * waiting for it gets the exception.
+  */
+class SingleFlight {
+ public:
+    /** @struct Result
+      *  @brief what a fetch produced, shared by all its callers
+      *  @var Result::response
+      *  Member 'response' contains the response
+      *  @var Result::mappedBody
+      *  Member 'mappedBody' contains the body instead of response.body if
+      *  it was read from the disk cache
+      */
+    typedef struct {
+      RestClient::Response response;
+      std::shared_ptr<RestClient::MappedFile> mappedBody;
+    } Result;
+
+    typedef std::function<void(Result* result)> Fetch;
+
+    SingleFlight();
+
+    // the instance used by the simple API in restclient.h
+    static SingleFlight& instance();
+
+    // key for a request, made of everything that can change the response
+    static std::string Key(const std::string& method, const std::string& url,
+                           const RestClient::HeaderFields& headers);
+
+    // run fetch into result, or wait for the call already running it for
+    // key and copy its result. shared is set to true for callers that did
+    // not run fetch themselves.
+    void Do(const std::string& key, const Fetch& fetch, Result* result,
+            bool* shared);
+
+    // count callers that shared a request, NULL to stop. Has to outlive the
+    // instance.
+    void SetMetrics(RestClient::Metrics* metrics);
+
+    // number of keys with a fetch running
+    size_t InFlight();
+
+ private:
+    typedef struct {
+      bool done;
+      size_t waiters;
+      std::shared_ptr<const Result> result;
+      std::exception_ptr error;
+    } Call;
+
+    SingleFlight(const SingleFlight&);
+    SingleFlight& operator=(const SingleFlight&);
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::map<std::string, std::shared_ptr<Call> > calls;
+    RestClient::Metrics* metrics;
+};
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_SINGLEFLIGHT_H_
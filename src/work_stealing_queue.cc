@@ -0,0 +1,203 @@
+#include "work_stealing_queue.h"
+
+namespace {
+
+// yields before an idle worker goes to sleep, a new connection arriving
+// meanwhile is picked up without a wake-up
+const int kSpinCount = 64;
+
+} // namespace
+
+WorkStealingQueue::Ring::Ring(size_t size) : enqueuePos_(0), dequeuePos_(0)
+{
+    size_t capacity = 2;
+    while (capacity < size)
+    {
+        capacity *= 2;
+    }
+    slots_.reset(new Slot[capacity]);
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask_ = capacity - 1;
+}
+
+// A slot is free for the producer at position pos when its sequence is pos
+// and holds a task for the consumer at pos when it is pos + 1.
+bool WorkStealingQueue::Ring::Push(std::function<void()> &fn)
+{
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &slots_[pos & mask_];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == pos)
+        {
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (sequence < pos)
+        {
+            return false;  // full
+        }
+        else
+        {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+    slot->task = std::move(fn);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool WorkStealingQueue::Ring::Pop(std::function<void()> *fn)
+{
+    size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &slots_[pos & mask_];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == pos + 1)
+        {
+            if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (sequence < pos + 1)
+        {
+            return false;  // empty
+        }
+        else
+        {
+            pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+    }
+    *fn = std::move(slot->task);
+    slot->task = nullptr;
+    slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+WorkStealingQueue::WorkStealingQueue(size_t workers, size_t ringSize)
+    : next_(0), pending_(0), sleepers_(0), shutdown_(false), overflowed_(0)
+{
+    if (workers == 0)
+    {
+        workers = 1;
+    }
+    for (size_t i = 0; i < workers; ++i)
+    {
+        rings_.emplace_back(new Ring(ringSize));
+    }
+    for (size_t i = 0; i < workers; ++i)
+    {
+        threads_.emplace_back([this, i] { Run(i); });
+    }
+}
+
+WorkStealingQueue::~WorkStealingQueue()
+{
+    if (!shutdown_)
+    {
+        shutdown();
+    }
+}
+
+void WorkStealingQueue::enqueue(std::function<void()> fn)
+{
+    // counted first so a worker never sees more taken than pending
+    pending_.fetch_add(1);
+    size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+    bool queued = false;
+    for (size_t i = 0; i < rings_.size() && !queued; ++i)
+    {
+        queued = rings_[(start + i) % rings_.size()]->Push(fn);
+    }
+    if (!queued)
+    {
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        overflow_.push_back(std::move(fn));
+        overflowed_.fetch_add(1);
+    }
+    // a worker counts itself as sleeping before it checks pending_ for the
+    // last time, so one of the two sides always sees the other
+    if (sleepers_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        wake_.notify_one();
+    }
+}
+
+void WorkStealingQueue::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        shutdown_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+    {
+        threads_[i].join();
+    }
+    threads_.clear();
+}
+
+bool WorkStealingQueue::Take(size_t worker, std::function<void()> *fn)
+{
+    for (size_t i = 0; i < rings_.size(); ++i)
+    {
+        if (rings_[(worker + i) % rings_.size()]->Pop(fn))
+        {
+            return true;
+        }
+    }
+    if (overflowed_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        if (!overflow_.empty())
+        {
+            *fn = std::move(overflow_.front());
+            overflow_.pop_front();
+            overflowed_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingQueue::Run(size_t worker)
+{
+    std::function<void()> fn;
+    int spins = 0;
+    for (;;)
+    {
+        if (Take(worker, &fn))
+        {
+            pending_.fetch_sub(1);
+            fn();
+            fn = nullptr;
+            spins = 0;
+            continue;
+        }
+        if (shutdown_ && pending_.load() == 0)
+        {
+            break;
+        }
+        if (++spins < kSpinCount)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        spins = 0;
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        sleepers_.fetch_add(1);
+        wake_.wait(lock, [this] { return pending_.load() > 0 || shutdown_; });
+        sleepers_.fetch_sub(1);
+    }
+}
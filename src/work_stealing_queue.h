@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+
+// httplib::TaskQueue that replaces the single locked list of
+// httplib::ThreadPool. Every worker owns a bounded lock-free ring; enqueue
+// puts tasks into the rings round-robin and workers take from their own ring
+// first, then steal from the others, so neither side takes a lock or
+// allocates while there is work. The rings hold slots for their tasks up
+// front. Only when every ring is full do tasks go to a locked overflow list.
+//
+// The rings are multi-producer multi-consumer (Vyukov's bounded queue) rather
+// than Chase-Lev deques: the accept loop, not the owning worker, produces
+// all tasks in httplib, so an owner-only push end would not help.
+//
+// Idle workers spin briefly, then sleep on a condition variable; enqueue
+// only touches it when somebody sleeps. shutdown() runs the queued tasks
+// before joining, like ThreadPool.
+class WorkStealingQueue : public httplib::TaskQueue
+{
+public:
+    explicit WorkStealingQueue(size_t workers, size_t ringSize = 256);
+    ~WorkStealingQueue() override;
+
+    void enqueue(std::function<void()> fn) override;
+    void shutdown() override;
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        std::function<void()> task;
+    };
+
+    class Ring
+    {
+    public:
+        explicit Ring(size_t size);
+        bool Push(std::function<void()> &fn);
+        bool Pop(std::function<void()> *fn);
+
+    private:
+        std::unique_ptr<Slot[]> slots_;
+        size_t mask_;
+        // keep the two ends on separate cache lines
+        char padding0_[64];
+        std::atomic<size_t> enqueuePos_;
+        char padding1_[64];
+        std::atomic<size_t> dequeuePos_;
+        char padding2_[64];
+    };
+
+    WorkStealingQueue(const WorkStealingQueue &);
+    WorkStealingQueue &operator=(const WorkStealingQueue &);
+
+    bool Take(size_t worker, std::function<void()> *fn);
+    void Run(size_t worker);
+
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_;
+    std::atomic<size_t> pending_;
+    std::atomic<size_t> sleepers_;
+    std::atomic<bool> shutdown_;
+    std::atomic<size_t> overflowed_;
+    std::mutex overflowMutex_;
+    std::deque<std::function<void()>> overflow_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+};
@@ -0,0 +1,138 @@
+/**
+ * @file backend_latency.cc
+ * @brief compares the libcurl and the cpp-httplib backends on a local server
+ *
+ * Starts a cpp-httplib server on 127.0.0.1 that answers /small with 1 KB and
+ * /large with 1 MB, then sends the same GETs through each RestClient::Backend
+ * over kept-alive connections and reports:
+ *
+ *   - latency:     sequential 1 KB GETs, median and 99th percentile
+ *   - throughput:  1 KB GETs from 4 threads at once, requests per second
+ *   - bulk:        sequential 1 MB GETs, megabytes per second
+ *
+ * build and run from the repository root:
+ *   g++ -O2 -std=c++14 -Isrc -Isrc/restclient test/bench/backend_latency.cc \
+ *       $(find src/restclient -name '*.cc') -lcurl -lpthread \
+ *       -o backend_latency && ./backend_latency
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+#include "restclient/backend.h"
+#include "restclient/connectionpool.h"
+#include "restclient/httplibbackend.h"
+#include "restclient/restclient.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kLatencyRequests = 5000;
+static const int kThreads = 4;
+static const int kThreadRequests = 2500;
+static const int kBulkRequests = 200;
+
+static double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+    .count();
+}
+
+// sends one GET and exits on anything but a 200, a failed request would
+// make the numbers meaningless
+static void fetch(RestClient::Backend* backend, const std::string& url) {
+  RestClient::Deadlines deadlines = {0, 0, 10000};
+  RestClient::Response res = backend->get(url, RestClient::defaultHeaders(),
+                                          deadlines, RestClient::CancelFlag());
+  if (res.code != 200) {
+    std::fprintf(stderr, "%s: GET %s failed with %d\n", backend->Name(),
+                 url.c_str(), res.code);
+    std::exit(1);
+  }
+}
+
+static void run(RestClient::Backend* backend, const std::string& base) {
+  std::string small = base + "/small";
+  std::string large = base + "/large";
+  for (int i = 0; i < 100; ++i) {
+    fetch(backend, small);
+  }
+
+  std::vector<double> latencies;
+  latencies.reserve(kLatencyRequests);
+  for (int i = 0; i < kLatencyRequests; ++i) {
+    Clock::time_point start = Clock::now();
+    fetch(backend, small);
+    latencies.push_back(elapsedMs(start) * 1000.0);
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.push_back(std::thread([backend, &small] {
+      for (int i = 0; i < kThreadRequests; ++i) {
+        fetch(backend, small);
+      }
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); ++t) {
+    threads[t].join();
+  }
+  double parallelMs = elapsedMs(start);
+
+  start = Clock::now();
+  for (int i = 0; i < kBulkRequests; ++i) {
+    fetch(backend, large);
+  }
+  double bulkMs = elapsedMs(start);
+
+  std::printf("%-8s %10.1f %10.1f %12.0f %10.1f\n", backend->Name(),
+              latencies[latencies.size() / 2],
+              latencies[latencies.size() * 99 / 100],
+              kThreads * kThreadRequests / (parallelMs / 1000.0),
+              kBulkRequests / (bulkMs / 1000.0));
+}
+
+int main() {
+  RestClient::init();
+
+  httplib::Server server;
+  std::string smallBody(1024, 's');
+  std::string largeBody(1024 * 1024, 'l');
+  server.Get("/small", [&](const httplib::Request&, httplib::Response& res) {
+    res.set_content(smallBody, "application/octet-stream");
+  });
+  server.Get("/large", [&](const httplib::Request&, httplib::Response& res) {
+    res.set_content(largeBody, "application/octet-stream");
+  });
+  // keep connections open for the whole run, the default closes them
+  // after 5 requests
+  server.set_keep_alive_max_count(1000000);
+  // headers and body go out in separate writes, Nagle would hold the body
+  // back until the client's delayed ACK
+  server.set_tcp_nodelay(true);
+  int port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&server] { server.listen_after_bind(); });
+  while (!server.is_running()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::string base = "http://127.0.0.1:" + std::to_string(port);
+
+  std::printf("%-8s %10s %10s %12s %10s\n", "backend", "p50 us", "p99 us",
+              "req/s x4", "MB/s");
+  run(&RestClient::CurlBackend::instance(), base);
+  // give the server threads held by idle connections back
+  RestClient::ConnectionPool::instance().Clear();
+  run(&RestClient::HttplibBackend::instance(), base);
+  RestClient::HttplibBackend::instance().Clear();
+
+  server.stop();
+  listener.join();
+  RestClient::disable();
+  return 0;
+}
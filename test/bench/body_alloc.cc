@@ -0,0 +1,120 @@
+/**
+ * @file body_alloc.cc
+ * @brief counts the allocations made while collecting a response body
+ *
+ * Feeds 1 KB, 1 MB and 100 MB bodies through the restclient header and write
+ * callbacks in 16 KB chunks, the way libcurl hands them over, and reports
+ * allocations and bytes allocated:
+ *
+ *   - no length:  no Content-Length header, the body grows as it arrives
+ *   - presized:   Content-Length reserves the body once, up to
+ *                 Helpers::MAX_BODY_RESERVE (8 MB), so the 100 MB body
+ *                 still grows as it arrives
+ *   - reused:     the body goes into a buffer kept across requests
+ *                 (Connection::SetResponseBuffer)
+ *
+ * build and run from the repository root:
+ *   g++ -O2 -std=c++14 -Isrc test/bench/body_alloc.cc \
+ *       src/restclient/helpers.cc -lcurl -o body_alloc && ./body_alloc
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "restclient/helpers.h"
+#include "restclient/restclient.h"
+
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  allocatedBytes += size;
+  void* p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+static const size_t CHUNK = 16 * 1024;
+
+// run one transfer through the callbacks, returns the body size collected
+static size_t transfer(const std::string& payload, bool sendLength,
+                       std::string* buffer) {
+  RestClient::Response response;
+  RestClient::Helpers::WriteObject w;
+  w.response = &response;
+  w.body = buffer ? buffer : &response.body;
+  w.sink = NULL;
+  w.expectBody = true;
+  w.decodedSize = 0;
+  if (buffer) {
+    buffer->clear();
+  }
+
+  char status[] = "HTTP/1.1 200 OK\r\n";
+  RestClient::Helpers::header_callback(status, 1, sizeof(status) - 1, &w);
+  char type[] = "Content-Type: application/octet-stream\r\n";
+  RestClient::Helpers::header_callback(type, 1, sizeof(type) - 1, &w);
+  if (sendLength) {
+    std::string length = "Content-Length: " +
+                         std::to_string(payload.size()) + "\r\n";
+    RestClient::Helpers::header_callback(&length[0], 1, length.size(), &w);
+  }
+  char blank[] = "\r\n";
+  RestClient::Helpers::header_callback(blank, 1, 2, &w);
+
+  char* data = const_cast<char*>(payload.data());
+  for (size_t off = 0; off < payload.size(); off += CHUNK) {
+    size_t n = payload.size() - off < CHUNK ? payload.size() - off : CHUNK;
+    RestClient::Helpers::write_callback(data + off, 1, n, &w);
+  }
+  return w.body->size();
+}
+
+static void run(const char* label, size_t size, int rounds) {
+  std::string payload(size, 'x');
+  std::string reused;
+  const char* modes[] = {"no length", "presized", "reused"};
+
+  for (int mode = 0; mode < 3; ++mode) {
+    size_t before = allocations;
+    size_t beforeBytes = allocatedBytes;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    size_t got = 0;
+    for (int i = 0; i < rounds; ++i) {
+      got += transfer(payload, mode > 0, mode == 2 ? &reused : NULL);
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    if (got != size * rounds) {
+      std::printf("body size mismatch\n");
+      std::exit(1);
+    }
+    std::printf("%-6s %-10s %8.1f allocs/req %12.0f bytes/req %9.3f ms/req\n",
+                label, modes[mode],
+                static_cast<double>(allocations - before) / rounds,
+                static_cast<double>(allocatedBytes - beforeBytes) / rounds,
+                ms / rounds);
+  }
+}
+
+int main() {
+  run("1KB", 1024, 10000);
+  run("1MB", 1024 * 1024, 200);
+  run("100MB", 100 * 1024 * 1024, 3);
+  return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file file_serving.cc
+ * @brief memory and throughput of serving mounted files from httplib::Server
+ *
+ * 8 client threads each download a 64 MiB file 4 times from a server on
+ * 127.0.0.1, once per mode:
+ *
+ *   - mount:  Server::set_mount_point, the file goes out with sendfile (mmap
+ *             for streams without it) straight from the page cache
+ *   - body:   a handler that reads the file into Response::body, the way
+ *             mounted files were served before
+ *
+ * Reported are MiB/s and how far the peak resident memory of the process
+ * grew during the run. The clients throw the data away as it arrives, so
+ * the growth is the server's. mount runs first because the peak only ever
+ * goes up.
+ *
+ * build and run from the repository root:
+ *   g++ -O2 -std=c++14 -Isrc test/bench/file_serving.cc -lpthread \
+ *       -o file_serving && ./file_serving
+ */
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kClients = 8;
+static const int kDownloadsPerClient = 4;
+static const size_t kFileSize = 64 * 1024 * 1024;
+
+static double elapsedSeconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static long peakRssKiB() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void run(const char* mode, const std::string& path,
+                httplib::Server& server) {
+  server.set_tcp_nodelay(true);
+  int port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&server] { server.listen_after_bind(); });
+  while (!server.is_running()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  long rssBefore = peakRssKiB();
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> clients;
+  for (int c = 0; c < kClients; ++c) {
+    clients.push_back(std::thread([port, &path] {
+      httplib::Client client("127.0.0.1", port);
+      for (int i = 0; i < kDownloadsPerClient; ++i) {
+        size_t received = 0;
+        httplib::Result res =
+            client.Get(path.c_str(), [&received](const char*, size_t n) {
+              received += n;
+              return true;
+            });
+        if (!res || res->status != 200 || received != kFileSize) {
+          std::fprintf(stderr, "GET %s failed\n", path.c_str());
+          std::exit(1);
+        }
+      }
+    }));
+  }
+  for (size_t c = 0; c < clients.size(); ++c) {
+    clients[c].join();
+  }
+  double seconds = elapsedSeconds(start);
+  server.stop();
+  listener.join();
+
+  double mib = static_cast<double>(kFileSize) * kClients * kDownloadsPerClient /
+               (1024 * 1024);
+  std::printf("%-8s %12.0f %18ld\n", mode, mib / seconds,
+              (peakRssKiB() - rssBefore) / 1024);
+}
+
+int main() {
+  char dir[] = "/tmp/file_serving.XXXXXX";
+  if (!mkdtemp(dir)) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::string file = std::string(dir) + "/large.bin";
+  {
+    std::ofstream out(file.c_str(), std::ios_base::binary);
+    std::string block(1024 * 1024, 'x');
+    for (size_t i = 0; i < kFileSize / block.size(); ++i) {
+      out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+  }
+
+  std::printf("%-8s %12s %18s\n", "mode", "MiB/s", "peak RSS +MiB");
+  {
+    httplib::Server server;
+    server.set_mount_point("/", dir);
+    run("mount", "/large.bin", server);
+  }
+  {
+    httplib::Server server;
+    server.Get("/large.bin", [&file](const httplib::Request&,
+                                     httplib::Response& res) {
+      httplib::detail::read_file(file, res.body);
+      res.set_header("Content-Type", "application/octet-stream");
+    });
+    run("body", "/large.bin", server);
+  }
+
+  unlink(file.c_str());
+  rmdir(dir);
+  return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file idle_connections.cc
+ * @brief keep-alive connections a httplib::Server with 4 workers can hold
+ *
+ * A forked client process opens keep-alive connections to a server on
+ * 127.0.0.1 one after the other, sends one GET on each and leaves it open.
+ * Linux only, the server runs in both modes:
+ *
+ *   - threads:  every connection holds a worker for the keep-alive timeout
+ *               (1 s here), so the fifth connection waits for the first to
+ *               time out. Only 32 connections are opened.
+ *   - reactor:  Server::set_reactor_mode, idle connections wait in epoll.
+ *               10000 connections (or the count given as argument) are
+ *               opened, then 2000 GETs go out on random ones of them.
+ *
+ * Reported are the connections served per second, the server's thread count
+ * while they are all open and the latency of the GETs on idle connections.
+ * The client runs in its own process so each side stays below the usual
+ * open file limit.
+ *
+ * build and run from the repository root:
+ *   g++ -O2 -std=c++14 -Isrc test/bench/idle_connections.cc -lpthread \
+ *       -o idle_connections && ./idle_connections
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t kWorkers = 4;
+static const int kLatencyRequests = 2000;
+
+static double elapsedSeconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int openConnection(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = sockaddr_in();
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                        sizeof(addr)) != 0) {
+    std::perror("connect");
+    std::exit(1);
+  }
+  return fd;
+}
+
+// sends a GET and reads the 2 byte response body
+static void request(int fd) {
+  static const char kRequest[] = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  if (send(fd, kRequest, sizeof(kRequest) - 1, 0) < 0) {
+    std::perror("send");
+    std::exit(1);
+  }
+  std::string response;
+  char buffer[1024];
+  while (response.size() < 4 ||
+         response.compare(response.size() - 2, 2, "ok") != 0) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      std::fprintf(stderr, "connection closed\n");
+      std::exit(1);
+    }
+    response.append(buffer, static_cast<size_t>(n));
+  }
+}
+
+static int threadCount() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 8, "Threads:") == 0) {
+      return std::atoi(line.c_str() + 8);
+    }
+  }
+  return -1;
+}
+
+static void run(const char* mode, bool reactor, int connections) {
+  httplib::Server server;
+  server.new_task_queue = [] { return new httplib::ThreadPool(kWorkers); };
+  server.set_reactor_mode(reactor);
+  server.set_keep_alive_timeout(reactor ? 60 : 1);
+  server.set_keep_alive_max_count(1000000);
+  server.set_tcp_nodelay(true);
+  server.Get("/", [](const httplib::Request&, httplib::Response& res) {
+    res.set_content("ok", "text/plain");
+  });
+  int port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&server] { server.listen_after_bind(); });
+  while (!server.is_running()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // opened tells the server the connections are up, resume lets the
+  // client go on once the server counted its threads
+  int opened[2];
+  int resume[2];
+  if (pipe(opened) != 0 || pipe(resume) != 0) {
+    std::perror("pipe");
+    std::exit(1);
+  }
+  std::fflush(stdout);
+  pid_t child = fork();
+  if (child == 0) {
+    Clock::time_point start = Clock::now();
+    std::vector<int> fds;
+    for (int i = 0; i < connections; ++i) {
+      fds.push_back(openConnection(port));
+      request(fds.back());
+    }
+    double rate = connections / elapsedSeconds(start);
+    char byte = 0;
+    if (write(opened[1], &byte, 1) != 1 || read(resume[0], &byte, 1) != 1) {
+      _exit(1);
+    }
+
+    std::vector<double> latencies;
+    if (reactor) {
+      std::mt19937 random(42);
+      std::uniform_int_distribution<size_t> pick(0, fds.size() - 1);
+      for (int i = 0; i < kLatencyRequests; ++i) {
+        Clock::time_point sent = Clock::now();
+        request(fds[pick(random)]);
+        latencies.push_back(elapsedSeconds(sent) * 1e6);
+      }
+      std::sort(latencies.begin(), latencies.end());
+    }
+    std::printf("%-8s %12d %14.0f ", mode, connections, rate);
+    if (reactor) {
+      std::printf("%12.0f %12.0f",
+                  latencies[latencies.size() / 2],
+                  latencies[latencies.size() * 99 / 100]);
+    } else {
+      std::printf("%12s %12s", "-", "-");
+    }
+    std::fflush(stdout);
+    for (size_t i = 0; i < fds.size(); ++i) {
+      close(fds[i]);
+    }
+    _exit(0);
+  }
+
+  char byte = 0;
+  if (read(opened[0], &byte, 1) != 1) {
+    std::fprintf(stderr, "client failed\n");
+    std::exit(1);
+  }
+  int threads = threadCount();
+  if (write(resume[1], &byte, 1) != 1) {
+    std::exit(1);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  std::printf(" %10d\n", threads);
+  server.stop();
+  listener.join();
+}
+
+int main(int argc, char** argv) {
+  int connections = argc > 1 ? std::atoi(argv[1]) : 10000;
+  std::printf("%-8s %12s %14s %12s %12s %10s\n", "mode", "connections",
+              "served/s", "p50 us", "p99 us", "threads");
+  std::fflush(stdout);
+  run("threads", false, static_cast<int>(kWorkers) * 8);
+  run("reactor", true, connections);
+  return 0;
+}
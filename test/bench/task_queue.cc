@@ -0,0 +1,119 @@
+/**
+ * @file task_queue.cc
+ * @brief compares httplib::ThreadPool with WorkStealingQueue
+ *
+ * Runs each queue with 1, 8 and 64 workers and reports:
+ *
+ *   - dispatch:  tasks per second a single producer gets through the queue,
+ *                the way the httplib accept loop hands over every socket.
+ *                The tasks only count themselves, so this is the queue's
+ *                own overhead.
+ *   - accept:    new connections per second a httplib::Server on 127.0.0.1
+ *                serves, 8 client threads each sending one GET per
+ *                connection
+ *
+ * build and run from the repository root:
+ *   g++ -O2 -std=c++14 -Isrc test/bench/task_queue.cc \
+ *       src/work_stealing_queue.cc -lpthread -o task_queue && ./task_queue
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+#include "work_stealing_queue.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef std::function<httplib::TaskQueue*(size_t workers)> QueueFactory;
+
+static const int kDispatchTasks = 1000000;
+static const int kClients = 8;
+static const int kConnectionsPerClient = 400;
+
+static double elapsedSeconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double dispatchRate(const QueueFactory& factory, size_t workers) {
+  std::unique_ptr<httplib::TaskQueue> queue(factory(workers));
+  std::atomic<int> done(0);
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < kDispatchTasks; ++i) {
+    // the same capture size as the accept loop's [this, sock]
+    int socket = i;
+    queue->enqueue([&done, socket] { done.fetch_add(socket >= 0 ? 1 : 0); });
+  }
+  while (done.load() < kDispatchTasks) {
+    std::this_thread::yield();
+  }
+  double seconds = elapsedSeconds(start);
+  queue->shutdown();
+  return kDispatchTasks / seconds;
+}
+
+static double acceptRate(const QueueFactory& factory, size_t workers) {
+  httplib::Server server;
+  server.new_task_queue = [&factory, workers] { return factory(workers); };
+  server.set_tcp_nodelay(true);
+  server.Get("/", [](const httplib::Request&, httplib::Response& res) {
+    res.set_content("ok", "text/plain");
+  });
+  int port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&server] { server.listen_after_bind(); });
+  while (!server.is_running()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> clients;
+  for (int c = 0; c < kClients; ++c) {
+    clients.push_back(std::thread([port] {
+      for (int i = 0; i < kConnectionsPerClient; ++i) {
+        httplib::Client client("127.0.0.1", port);
+        client.set_keep_alive(false);
+        httplib::Result res = client.Get("/");
+        if (!res || res->status != 200) {
+          std::fprintf(stderr, "GET failed\n");
+          std::exit(1);
+        }
+      }
+    }));
+  }
+  for (size_t c = 0; c < clients.size(); ++c) {
+    clients[c].join();
+  }
+  double seconds = elapsedSeconds(start);
+  server.stop();
+  listener.join();
+  return kClients * kConnectionsPerClient / seconds;
+}
+
+int main() {
+  QueueFactory threadPool = [](size_t workers) {
+    return new httplib::ThreadPool(workers);
+  };
+  QueueFactory workStealing = [](size_t workers) {
+    return new WorkStealingQueue(workers);
+  };
+  const size_t workerCounts[] = {1, 8, 64};
+
+  std::printf("%-14s %8s %14s %14s\n", "queue", "workers", "dispatch/s",
+              "accept/s");
+  for (size_t i = 0; i < sizeof(workerCounts) / sizeof(workerCounts[0]);
+       ++i) {
+    size_t workers = workerCounts[i];
+    std::printf("%-14s %8zu %14.0f %14.0f\n", "ThreadPool", workers,
+                dispatchRate(threadPool, workers),
+                acceptRate(threadPool, workers));
+    std::printf("%-14s %8zu %14.0f %14.0f\n", "WorkStealing", workers,
+                dispatchRate(workStealing, workers),
+                acceptRate(workStealing, workers));
+  }
+  return 0;
+}
@@ -3,8 +3,85 @@ const path = require('path')
 
 let js = path.join(__dirname,  '/test.js')
 
+// responses of {cache: true} requests survive restarts
+sysutilities.setCacheDirectory(path.join(require('os').tmpdir(), 'sysutilities-cache'));
+
 // sysutilities.unsafeShowOpenWith(js)
 console.log(sysutilities.deviceId())
 
 const resp = sysutilities.httpGet('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json');
-console.log(resp);
\ No newline at end of file
+console.log(resp);
+// served from the response cache or revalidated with a conditional request
+const cached = sysutilities.httpGet('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json', { cache: true });
+console.log(cached.code, cached.timing.totalTime);
+sysutilities.httpGetAsync('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json', { timeout: 3000 })
+    .then((resp) => console.log(resp));
+sysutilities.httpGetAsync('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json', { responseType: 'buffer' })
+    .then((resp) => console.log(resp.code, JSON.parse(resp.body)));
+// cpp-httplib keeps its own keep-alive connections, https falls back to libcurl
+sysutilities.httpGetAsync('http://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json', { backend: 'httplib' })
+    .then((resp) => console.log('httplib', resp.code, resp.timing.connectionReused));
+const controller = new AbortController();
+sysutilities.httpGetAsync('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json',
+    { connectTimeout: 1000, firstByteTimeout: 2000, timeout: 5000, signal: controller.signal })
+    .catch((err) => console.log('aborted', err.name));
+controller.abort();
+// a duplicate goes out if the first byte takes longer than the p95 so far
+sysutilities.httpGetMany(['https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json'],
+    { hedge: { delay: 300, percentile: 0.95 } }).then((resps) => console.log('hedged', resps[0].code));
+
+sysutilities.httpGetMany([
+    'https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json',
+    'https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json'
+], { concurrency: 2, timeout: 3000, http2: true, retry: { attempts: 3, baseDelay: 200 } }).then((resps) => resps.forEach((r) => console.log(r.code, r.timing.httpVersion, r.timing.connectionReused)));
+
+(async () => {
+    let size = 0;
+    const stream = sysutilities.httpGetStream('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json');
+    stream.on('response', (r) => console.log('stream', r.code));
+    for await (const chunk of stream) {
+        size += chunk.length;
+    }
+    console.log('streamed', size);
+})();
+
+(async () => {
+    function* parts() {
+        for (let i = 0; i < 4; i++) {
+            yield Buffer.alloc(256 * 1024, i);
+        }
+    }
+    const uploaded = await sysutilities.httpUpload('https://httpbin.org/post', parts(), {
+        onProgress: (sent, total) => console.log('uploaded', sent, total)
+    });
+    console.log('upload', uploaded.code);
+    const put = await sysutilities.httpUpload('https://httpbin.org/put', { path: __filename }, { method: 'PUT' });
+    console.log('put', put.code);
+})().catch((err) => console.log('upload failed', err.message));
+
+sysutilities.downloadFile('https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat/fc-serverlist.json',
+    require('os').tmpdir() + '/fc-serverlist.json',
+    { segments: 4, retry: 3, onProgress: (received, total) => console.log('downloaded', received, total) })
+    .then((r) => console.log('download', r.code));
+
+(async () => {
+    // files and proxied API calls are answered on native threads
+    const server = sysutilities.startServer({
+        threads: 4,
+        routes: [
+            { path: '/test', dir: __dirname, headers: { 'Cache-Control': 'max-age=60' } },
+            { path: '/api', proxy: 'https://feichatpublic.oss-cn-guangzhou.aliyuncs.com/FeiChat' }
+        ]
+    });
+    const base = 'http://127.0.0.1:' + server.port;
+    const file = await sysutilities.httpGetAsync(base + '/test/test.js');
+    const proxied = await sysutilities.httpGetAsync(base + '/api/fc-serverlist.json');
+    console.log('served', file.code, file.body.length, 'proxied', proxied.code);
+    await server.stop();
+})();
+
+setTimeout(() => {
+    const metrics = sysutilities.httpMetrics();
+    console.log(metrics.requests, metrics.reusedConnections, metrics.retries, metrics.hedges, metrics.hedgeWins, metrics.phases.total);
+    console.log(sysutilities.httpMetrics('prometheus'));
+}, 5000);